@@ -15,166 +15,1465 @@
    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
    */
 
-#include <time.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "arpeggiator.h"
 
-typedef struct {
-    enum chordtype   chord;
-    int              range;
-    enum timetype    time;
-    float            gate;
-    int              cycle;
-    float            skip;
-    enum dirtype     dir;
+static void selectStepper(Arpeggiator* arp);
 
-    uint32_t         note_index; 
-    uint32_t         arpeggio_length; // number of arpeggio notes
-    uint8_t          arpeggio_notes[2*10*3];  // max octaves*max notes/octave*2(up-down)
-} Arpeggiator;
+float getGate(Arpeggiator* arp) {
+    return arp->gate;
+}
 
-Arpeggiator arp_state;
+/* Setters: return 0 if no change, -1 if new value set */
+int setChord(Arpeggiator* arp, enum chordtype chord) {
+    if(arp->chord != chord) {
+        arp->chord = chord;
+        return -1;
+    }
+    return 0;
+}
 
-float getGate() {
-    return arp_state.gate;
+int setUserChord(Arpeggiator* arp, uint16_t intervals) {
+    intervals &= ARP_INTERVALS_ALL;
+    if(arp->user_chord != intervals) {
+        arp->user_chord = intervals;
+        return -1;
+    }
+    return 0;
 }
 
-/* Setters: return 0 if no change, -1 if new value set */
-int setChord(enum chordtype chord) {
-    if(arp_state.chord != chord) {
-        arp_state.chord = chord;
+int setRange(Arpeggiator* arp, int range) {
+    if(arp->range != range) {
+        arp->range = range;
         return -1;
     }
     return 0;
 }
 
-int setRange(int range) {
-    if(arp_state.range != range) {
-        arp_state.range = range;
+int setTime(Arpeggiator* arp, enum timetype time) {
+    if(arp->time != time) {
+        arp->time = time;
         return -1;
     }
     return 0;
 }
 
-int setTime(enum timetype time) {
-    if(arp_state.time != time) {
-        arp_state.time = time;
+int setGate(Arpeggiator* arp, float gate) {
+    if(arp->gate != gate) {
+        arp->gate = gate;
         return -1;
     }
     return 0;
 }
 
-int setGate(float gate) {
-    if(arp_state.gate != gate) {
-        arp_state.gate = gate;
+int setCycle(Arpeggiator* arp, int cycle) {
+    if(arp->cycle != cycle) {
+        arp->cycle = cycle;
         return -1;
     }
     return 0;
 }
 
-int setCycle(int cycle) {
-    if(arp_state.cycle != cycle) {
-        arp_state.cycle = cycle;
+int setSkip(Arpeggiator* arp, float skip) {
+    if(arp->skip != skip) {
+        arp->skip = skip;
+        selectStepper(arp);
         return -1;
     }
     return 0;
 }
 
-int setSkip(float skip) {
-    if(arp_state.skip != skip) {
-        arp_state.skip = skip;
+int setDir(Arpeggiator* arp, enum dirtype dir) {
+    if(arp->dir != dir) {
+        arp->dir = dir;
         return -1;
     }
     return 0;
 }
 
-int setDir(enum dirtype dir) {
-    if(arp_state.dir != dir) {
-        arp_state.dir = dir;
+int setSeed(Arpeggiator* arp, uint32_t seed) {
+    if(arp->seed != seed) {
+        arp->seed = seed;
         return -1;
     }
     return 0;
 }
 
-void updateArpeggioNotes() {
-    int i;
-    switch(arp_state.chord) {
-        case OCTAVE:
-            for(i = 0; i < arp_state.range; i++) {
-                arp_state.arpeggio_notes[i] = 12 * i;
-            }
-            //lv2_log_error(&self.logger, "%d %d %d\n", i, self.arpeggio_notes[0], self.arpeggio_notes[1]);
-            arp_state.arpeggio_length = i;
-            break;
-        case MAJOR:
-            for(i = 0; i < arp_state.range; i++) {
-                arp_state.arpeggio_notes[3 * i + 0] = 12 * i;
-                arp_state.arpeggio_notes[3 * i + 1] = 12 * i + 4;
-                arp_state.arpeggio_notes[3 * i + 2] = 12 * i + 3;
-            }
-            arp_state.arpeggio_length = 3 * i;
-            break;
-        case MINOR:
-            for(i = 0; i < arp_state.range; i++) {
-                arp_state.arpeggio_notes[3 * i + 0] = 12 * i;
-                arp_state.arpeggio_notes[3 * i + 1] = 12 * i + 3;
-                arp_state.arpeggio_notes[3 * i + 2] = 12 * i + 4;
+// scrambles a seed so that nearby seeds give unrelated sequences
+static uint32_t scrambleSeed(uint32_t seed) {
+    seed ^= seed >> 16;
+    seed *= 0x7feb352d;
+    seed ^= seed >> 15;
+    seed *= 0x846ca68b;
+    seed ^= seed >> 16;
+    return seed ? seed : 0x9e3779b9;
+}
+
+/* Per-instance random numbers for the skip feature. Unlike random() this
+   has no shared state or locks, so it is safe to use from run() */
+void seedRandom(Arpeggiator* arp, uint32_t seed) {
+    arp->random_state = scrambleSeed(seed);
+}
+
+static inline uint32_t xorshift32(uint32_t x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+uint32_t nextRandom(Arpeggiator* arp) {
+    arp->random_state = xorshift32(arp->random_state);
+    return arp->random_state;
+}
+
+int setMode(Arpeggiator* arp, enum modetype mode) {
+    if(arp->mode != mode) {
+        arp->mode = mode;
+        return -1;
+    }
+    return 0;
+}
+
+void heldClear(HeldNotes* held) {
+    memset(held, 0, sizeof(HeldNotes));
+}
+
+bool heldContains(const HeldNotes* held, uint8_t note) {
+    return (held->bits[note >> 6] >> (note & 63)) & 1;
+}
+
+bool heldAdd(HeldNotes* held, uint8_t note) {
+    if(note >= 128 || heldContains(held, note)) return false;
+    held->bits[note >> 6] |= (uint64_t) 1 << (note & 63);
+    held->order[held->count++] = note;
+    return true;
+}
+
+bool heldRemove(HeldNotes* held, uint8_t note) {
+    if(note >= 128 || !heldContains(held, note)) return false;
+    held->bits[note >> 6] &= ~((uint64_t) 1 << (note & 63));
+    uint32_t i = 0;
+    while(held->order[i] != note) ++i;
+    memmove(&held->order[i], &held->order[i + 1], held->count - i - 1);
+    --held->count;
+    return true;
+}
+
+uint32_t heldSorted(const HeldNotes* held, uint8_t* notes) {
+    // walk the set bits from the lowest pitch up
+    uint32_t n = 0;
+    for(int w = 0; w < 2; w++) {
+        uint64_t bits = held->bits[w];
+        while(bits) {
+            notes[n++] = 64 * w + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+    return n;
+}
+
+/* Held note changes: return 0 if no change, -1 if the set changed */
+int addHeldNote(Arpeggiator* arp, uint8_t note) {
+    if(!heldAdd(&arp->held, note)) return 0;
+    if(arp->mode != MODE_TRANSPOSE) buildArpeggioNotes(arp);
+    return -1;
+}
+
+int removeHeldNote(Arpeggiator* arp, uint8_t note) {
+    if(!heldRemove(&arp->held, note)) return 0;
+    if(arp->mode != MODE_TRANSPOSE) buildArpeggioNotes(arp);
+    return -1;
+}
+
+void setKeyVelocity(Arpeggiator* arp, uint8_t note, uint8_t velocity) {
+    if(note < 128) arp->key_velocity[note] = velocity;
+}
+
+/* The velocity of the held key a played note comes from. Notes in the
+   range above a key are octaves of it. In transpose mode every note
+   takes the velocity of the first key. */
+uint8_t noteVelocity(const Arpeggiator* arp, uint8_t note) {
+    const HeldNotes* held = &arp->held;
+    if(held->count == 0) return 0;
+    if(arp->mode == MODE_TRANSPOSE) return arp->key_velocity[held->order[0]];
+    for(int key = note; key >= 0; key -= 12) {
+        if(heldContains(held, key)) return arp->key_velocity[key];
+    }
+    return arp->key_velocity[held->order[0]];
+}
+
+const uint16_t arp_chords[CHORD_USER] = {
+    [OCTAVE]     = 0x001, // 0
+    [MAJOR]      = 0x091, // 0 4 7
+    [MINOR]      = 0x089, // 0 3 7
+    [MAJOR_7]    = 0x891, // 0 4 7 11
+    [MINOR_7]    = 0x489, // 0 3 7 10
+    [DOMINANT_7] = 0x491, // 0 4 7 10
+    [SUS_2]      = 0x085, // 0 2 7
+    [SUS_4]      = 0x0a1, // 0 5 7
+    [DIMINISHED] = 0x049, // 0 3 6
+    [AUGMENTED]  = 0x111, // 0 4 8
+    [POWER]      = 0x081, // 0 7
+};
+
+const uint16_t arp_scales[SCALE_USER] = {
+    [SCALE_CHROMATIC]        = ARP_INTERVALS_ALL,
+    [SCALE_MAJOR]            = 0xab5, // 0 2 4 5 7 9 11
+    [SCALE_MINOR]            = 0x5ad, // 0 2 3 5 7 8 10
+    [SCALE_HARMONIC_MINOR]   = 0x9ad, // 0 2 3 5 7 8 11
+    [SCALE_DORIAN]           = 0x6ad, // 0 2 3 5 7 9 10
+    [SCALE_PHRYGIAN]         = 0x5ab, // 0 1 3 5 7 8 10
+    [SCALE_LYDIAN]           = 0xad5, // 0 2 4 6 7 9 11
+    [SCALE_MIXOLYDIAN]       = 0x6b5, // 0 2 4 5 7 9 10
+    [SCALE_LOCRIAN]          = 0x56b, // 0 1 3 5 6 8 10
+    [SCALE_MAJOR_PENTATONIC] = 0x295, // 0 2 4 7 9
+    [SCALE_MINOR_PENTATONIC] = 0x4a9, // 0 3 5 7 10
+    [SCALE_BLUES]            = 0x4e9, // 0 3 5 6 7 10
+};
+
+uint16_t chordIntervals(const Arpeggiator* arp) {
+    if(arp->chord == CHORD_USER) return arp->user_chord;
+    if(arp->chord >= OCTAVE && arp->chord < CHORD_USER) return arp_chords[arp->chord];
+    return 0;
+}
+
+static void buildChordIntervals(const Arpeggiator* arp, ArpTable* table) {
+    uint16_t intervals = chordIntervals(arp);
+    table->length = 0;
+    for(int octave = 0; octave < arp->range; octave++) {
+        if(table->length + 12 > ARP_MAX_NOTES / 2) break;
+        for(int i = 0; i < 12; i++) {
+            if(intervals & (1 << i)) table->notes[table->length++] = 12 * octave + i;
+        }
+    }
+}
+
+static void buildHeldNotes(const Arpeggiator* arp, ArpTable* table) {
+    uint8_t source[128];
+    uint32_t source_length, i;
+    int octave;
+
+    if(arp->mode == MODE_AS_PLAYED) {
+        source_length = arp->held.count;
+        memcpy(source, arp->held.order, source_length);
+    } else {
+        source_length = heldSorted(&arp->held, source);
+    }
+    table->step_size = arp->mode == MODE_CHORD && source_length ? source_length : 1;
+
+    // the held notes repeated over the range, octave by octave. Leave
+    // room for the way back in up-down.
+    table->length = 0;
+    for(octave = 0; octave < arp->range; octave++) {
+        if(table->length + table->step_size > ARP_MAX_NOTES / 2) break;
+        for(i = 0; i < source_length; i++) {
+            uint32_t note = source[i] + 12 * octave;
+            if(note >= 128) {
+                // out of range notes are dropped, or silenced in a chord
+                if(arp->mode != MODE_CHORD) continue;
+                note = 128;
             }
-            arp_state.arpeggio_length = 3 * i;
-            break;
+            table->notes[table->length++] = note;
+        }
+    }
+}
+
+/* Folds the cycle into the playing order and sets the step flags. With a
+   cycle the step after step (cycle % steps) is skipped: it is dropped
+   from the table, or if it is the first step the loop starts at the
+   second one. */
+static void compileSteps(const Arpeggiator* arp, ArpTable* table) {
+    uint32_t i, j, size = table->step_size;
+    uint32_t steps = table->length / size;
+
+    table->loop_step = 0;
+    if(arp->cycle > 0 && steps > 1) {
+        uint32_t cycle = arp->cycle % steps;
+        if(cycle == steps - 1) {
+            table->loop_step = 1;
+        } else {
+            memmove(&table->notes[(cycle + 1) * size],
+                    &table->notes[(cycle + 2) * size],
+                    (steps - cycle - 2) * size);
+            --steps;
+            table->length -= size;
+        }
     }
+    table->steps = steps;
 
-    if(arp_state.dir == DIR_DOWN) {
+    for(i = 0; i < steps; i++) {
+        uint8_t flags = ARP_STEP_SILENT;
+        for(j = 0; j < size; j++) {
+            if(table->notes[i * size + j] < 128) flags &= ~ARP_STEP_SILENT;
+        }
+        table->flags[i] = flags;
+    }
+}
+
+/* Builds the table for the current parameters and held keys. Only reads
+   the engine, so it can fill a table that isn't being played */
+void buildArpeggioTable(const Arpeggiator* arp, ArpTable* table) {
+    uint32_t i, steps;
+    uint8_t* notes = table->notes;
+
+    table->step_size = 1;
+    if(arp->mode == MODE_TRANSPOSE) {
+        buildChordIntervals(arp, table);
+    } else {
+        buildHeldNotes(arp, table);
+    }
+
+    // the direction works on whole steps, so chords stay together
+    steps = table->length / table->step_size;
+    if(arp->dir == DIR_DOWN) {
         // reverse the order
-        for(i = 0; i < arp_state.arpeggio_length/2; i++) {
-            uint8_t swap = arp_state.arpeggio_notes[i];
-            arp_state.arpeggio_notes[i] =
-                arp_state.arpeggio_notes[arp_state.arpeggio_length - i];
-            arp_state.arpeggio_notes[arp_state.arpeggio_length - i] = swap;
+        for(i = 0; i < steps / 2; i++) {
+            uint8_t swap[128];
+            uint8_t* a = &notes[i * table->step_size];
+            uint8_t* b = &notes[(steps - 1 - i) * table->step_size];
+            memcpy(swap, a, table->step_size);
+            memcpy(a, b, table->step_size);
+            memcpy(b, swap, table->step_size);
+        }
+    }
+
+    if(arp->dir == DIR_UPDOWN) {
+        // back down again, without repeating the top and bottom steps
+        for(i = steps - 2; i > 0 && steps > 2; i--) {
+            memcpy(&notes[table->length],
+                    &notes[i * table->step_size], table->step_size);
+            table->length += table->step_size;
+        }
+    }
+
+    compileSteps(arp, table);
+}
+
+/* The step players. playTableStep() and tableNotes() are inlined into
+   one function for each combination of their flags, so a step doesn't
+   test for features that are not in use. selectStepper() picks the
+   functions whenever the table or the skip setting changes, so a new
+   kind of table built above needs its case there. */
+static inline __attribute__((always_inline)) uint32_t tableNotes(
+        const ArpTable* table, uint32_t step, uint8_t base_note, uint8_t* notes,
+        const bool chord) {
+    uint32_t i, n = 0;
+    const uint8_t* source = &table->notes[step * table->step_size];
+    if(chord) {
+        if(!(table->flags[step] & ARP_STEP_SILENT)) {
+            for(i = 0; i < table->step_size; i++) {
+                uint32_t note = source[i] + base_note;
+                notes[n] = note;
+                n += note < 128;
+            }
+        }
+    } else {
+        uint32_t note = source[0] + base_note;
+        notes[0] = note;
+        n = note < 128;
+    }
+    return n;
+}
+
+static inline __attribute__((always_inline)) uint32_t playTableStep(
+        Arpeggiator* arp, uint8_t base_note, uint8_t* notes,
+        const bool chord, const bool skip) {
+    const ArpTable* table = arp->table;
+
+    // a new table can be shorter than the one the position was in
+    uint32_t step = arp->note_index;
+    if(step >= table->steps) step = table->loop_step;
+
+    uint32_t n = tableNotes(table, step, base_note, notes, chord);
+
+    // scale the random number to 0-99 without a division
+    if(skip && (((uint64_t) nextRandom(arp) * 100) >> 32) < arp->skip) {
+        n = 0;
+    }
+
+    if(++step == table->steps) step = table->loop_step;
+    arp->note_index = step;
+    return n;
+}
+
+static uint32_t stepEmpty(Arpeggiator* arp, uint8_t base_note, uint8_t* notes) {
+    (void) arp;
+    (void) base_note;
+    (void) notes;
+    return 0;
+}
+
+static uint32_t stepSingle(Arpeggiator* arp, uint8_t base_note, uint8_t* notes) {
+    return playTableStep(arp, base_note, notes, false, false);
+}
+
+static uint32_t stepSingleSkip(Arpeggiator* arp, uint8_t base_note, uint8_t* notes) {
+    return playTableStep(arp, base_note, notes, false, true);
+}
+
+static uint32_t stepChord(Arpeggiator* arp, uint8_t base_note, uint8_t* notes) {
+    return playTableStep(arp, base_note, notes, true, false);
+}
+
+static uint32_t stepChordSkip(Arpeggiator* arp, uint8_t base_note, uint8_t* notes) {
+    return playTableStep(arp, base_note, notes, true, true);
+}
+
+static uint32_t notesEmpty(const ArpTable* table, uint32_t step, uint8_t base_note,
+        uint8_t* notes) {
+    (void) table;
+    (void) step;
+    (void) base_note;
+    (void) notes;
+    return 0;
+}
+
+static uint32_t notesSingle(const ArpTable* table, uint32_t step, uint8_t base_note,
+        uint8_t* notes) {
+    return tableNotes(table, step, base_note, notes, false);
+}
+
+static uint32_t notesChord(const ArpTable* table, uint32_t step, uint8_t base_note,
+        uint8_t* notes) {
+    return tableNotes(table, step, base_note, notes, true);
+}
+
+static void selectStepper(Arpeggiator* arp) {
+    const ArpTable* table = arp->table;
+    bool skip = arp->skip > 0;
+    if(!table || table->steps == 0) {
+        arp->step = stepEmpty;
+        arp->notes = notesEmpty;
+    } else if(table->step_size == 1) {
+        arp->step = skip ? stepSingleSkip : stepSingle;
+        arp->notes = notesSingle;
+    } else {
+        arp->step = skip ? stepChordSkip : stepChord;
+        arp->notes = notesChord;
+    }
+}
+
+/* Plays table from now on. The table must not change while it is played */
+void setArpeggioTable(Arpeggiator* arp, const ArpTable* table) {
+    arp->table = table;
+    selectStepper(arp);
+}
+
+void buildArpeggioNotes(Arpeggiator* arp) {
+    buildArpeggioTable(arp, &arp->table_buffer);
+    setArpeggioTable(arp, &arp->table_buffer);
+}
+
+void updateArpeggioNotes(Arpeggiator* arp) {
+    buildArpeggioNotes(arp);
+    resetArpeggio(arp);
+}
+
+/* Gives dst the settings of src, but keeps its own held keys, table and
+   position. A changed fixed seed restarts its random sequence. */
+void copySettings(Arpeggiator* dst, const Arpeggiator* src) {
+    setChord(dst, src->chord);
+    setUserChord(dst, src->user_chord);
+    setRange(dst, src->range);
+    setTime(dst, src->time);
+    setGate(dst, src->gate);
+    setCycle(dst, src->cycle);
+    setDir(dst, src->dir);
+    setMode(dst, src->mode);
+    if(setSeed(dst, src->seed) && dst->seed) seedRandom(dst, dst->seed);
+    setSkip(dst, src->skip);
+}
+
+void resetArpeggio(Arpeggiator* arp) {
+    // a fixed seed restarts the same random sequence every time
+    if(arp->seed) seedRandom(arp, arp->seed);
+    if(!arp->random_state) seedRandom(arp, 0);
+    arp->note_index = 0;
+}
+
+/* Not real-time safe: expands the table of a preset in MODE_TRANSPOSE */
+void compilePreset(ArpPreset* preset) {
+    Arpeggiator arp;
+    memset(&arp, 0, sizeof(arp));
+    memset(&preset->table, 0, sizeof(ArpTable));
+    arp.chord = preset->chord;
+    arp.range = preset->range;
+    arp.cycle = preset->cycle;
+    arp.dir = preset->dir;
+    arp.mode = preset->mode;
+    if(preset->mode == MODE_TRANSPOSE) buildArpeggioTable(&arp, &preset->table);
+}
+
+/* Switches to a compiled preset and restarts the arpeggio. No table is
+   built in MODE_TRANSPOSE, the preset's own table is played. */
+void applyPreset(Arpeggiator* arp, const ArpPreset* preset) {
+    arp->chord = preset->chord;
+    arp->range = preset->range;
+    arp->time = preset->time;
+    arp->gate = preset->gate;
+    arp->cycle = preset->cycle;
+    arp->skip = preset->skip;
+    arp->dir = preset->dir;
+    arp->mode = preset->mode;
+    // the held note modes keep the old table until the caller has one
+    if(preset->mode == MODE_TRANSPOSE) setArpeggioTable(arp, &preset->table);
+    resetArpeggio(arp);
+}
+
+const ArpPreset arp_presets[ARP_PRESETS] = {
+    // basic-bass
+    { .chord = OCTAVE, .range = 2, .time = NOTE_1_8, .gate = 100, .cycle = 0,
+        .skip = 0, .dir = DIR_UP, .mode = MODE_TRANSPOSE },
+    // fast-major-chords
+    { .chord = MAJOR, .range = 3, .time = NOTE_1_16, .gate = 100, .cycle = 0,
+        .skip = 0, .dir = DIR_UP, .mode = MODE_TRANSPOSE },
+    // complex-random-chords
+    { .chord = MAJOR, .range = 3, .time = NOTE_1_16, .gate = 65, .cycle = 1,
+        .skip = 23, .dir = DIR_UPDOWN, .mode = MODE_TRANSPOSE },
+};
+
+void saveSnapshot(const Arpeggiator* arp, ArpSnapshot* snapshot) {
+    saveSnapshotState(arp, arp->note_index, arp->random_state, snapshot);
+}
+
+/* saveSnapshot() for an engine whose position and random sequence are
+   kept elsewhere, like in an ArpLanes */
+void saveSnapshotState(const Arpeggiator* arp, uint32_t note_index,
+        uint32_t random_state, ArpSnapshot* snapshot) {
+    memset(snapshot, 0, sizeof(ArpSnapshot));
+    snapshot->magic = ARP_SNAPSHOT_MAGIC;
+    snapshot->version = ARP_SNAPSHOT_VERSION;
+    snapshot->size = sizeof(ArpSnapshot);
+    snapshot->chord = arp->chord;
+    snapshot->user_chord = arp->user_chord;
+    snapshot->range = arp->range;
+    snapshot->time = arp->time;
+    snapshot->gate = arp->gate;
+    snapshot->cycle = arp->cycle;
+    snapshot->skip = arp->skip;
+    snapshot->dir = arp->dir;
+    snapshot->mode = arp->mode;
+    snapshot->seed = arp->seed;
+    snapshot->note_index = note_index;
+    snapshot->random_state = random_state;
+    if(arp->table) {
+        // where the next step would really start, as in playTableStep()
+        if(snapshot->note_index >= arp->table->steps) {
+            snapshot->note_index = arp->table->steps ? arp->table->loop_step : 0;
+        }
+        snapshot->arpeggio_length = arp->table->length;
+        snapshot->step_size = arp->table->step_size;
+        snapshot->steps = arp->table->steps;
+        snapshot->loop_step = arp->table->loop_step;
+        memcpy(snapshot->arpeggio_notes, arp->table->notes, sizeof(snapshot->arpeggio_notes));
+        memcpy(snapshot->step_flags, arp->table->flags, sizeof(snapshot->step_flags));
+    }
+}
+
+// the table of a snapshot must be one that the step players can play
+// without writing past the 128 notes of a step
+static bool validSnapshotTable(const ArpSnapshot* snapshot) {
+    if(snapshot->step_size == 0 || snapshot->step_size > 128 ||
+            snapshot->steps > ARP_MAX_NOTES ||
+            snapshot->arpeggio_length > ARP_MAX_NOTES ||
+            (uint64_t) snapshot->steps * snapshot->step_size != snapshot->arpeggio_length) {
+        return false;
+    }
+    if(snapshot->steps ? snapshot->loop_step >= snapshot->steps ||
+            snapshot->note_index >= snapshot->steps : snapshot->note_index != 0) {
+        return false;
+    }
+    // 128 marks a silent note of a chord step
+    for(uint32_t i = 0; i < snapshot->arpeggio_length; i++) {
+        if(snapshot->arpeggio_notes[i] > 128) return false;
+    }
+    return true;
+}
+
+// returns false, leaving the engine unchanged, if the data is not a
+// valid snapshot of this version
+bool restoreSnapshot(Arpeggiator* arp, const void* data, uint32_t size) {
+    const ArpSnapshot* snapshot = (const ArpSnapshot*) data;
+    if(size != sizeof(ArpSnapshot) ||
+            snapshot->magic != ARP_SNAPSHOT_MAGIC ||
+            snapshot->version != ARP_SNAPSHOT_VERSION ||
+            snapshot->size != sizeof(ArpSnapshot) ||
+            snapshot->chord < 0 || snapshot->chord >= CHORD_ERROR ||
+            snapshot->time < 0 || snapshot->time >= NOTE_ERROR ||
+            snapshot->dir < 0 || snapshot->dir >= DIR_ERROR ||
+            snapshot->mode < 0 || snapshot->mode >= MODE_ERROR ||
+            !validSnapshotTable(snapshot) ||
+            snapshot->random_state == 0) {
+        return false;
+    }
+    arp->chord = (enum chordtype) snapshot->chord;
+    arp->user_chord = snapshot->user_chord & ARP_INTERVALS_ALL;
+    arp->range = snapshot->range;
+    arp->time = (enum timetype) snapshot->time;
+    arp->gate = snapshot->gate;
+    arp->cycle = snapshot->cycle;
+    arp->skip = snapshot->skip;
+    arp->dir = (enum dirtype) snapshot->dir;
+    arp->mode = (enum modetype) snapshot->mode;
+    arp->seed = snapshot->seed;
+    arp->note_index = snapshot->note_index;
+    arp->random_state = snapshot->random_state;
+    arp->table_buffer.length = snapshot->arpeggio_length;
+    arp->table_buffer.step_size = snapshot->step_size;
+    arp->table_buffer.steps = snapshot->steps;
+    arp->table_buffer.loop_step = snapshot->loop_step;
+    memcpy(arp->table_buffer.notes, snapshot->arpeggio_notes, sizeof(arp->table_buffer.notes));
+    memcpy(arp->table_buffer.flags, snapshot->step_flags, sizeof(arp->table_buffer.flags));
+    setArpeggioTable(arp, &arp->table_buffer);
+    // held keys are not part of the snapshot, since no note offs would
+    // ever arrive for them. The next key press rebuilds the table.
+    heldClear(&arp->held);
+    return true;
+}
+
+uint8_t nextNote(Arpeggiator* arp, uint8_t base_note) {
+    uint8_t notes[128];
+    if(!arp->table || arp->step(arp, base_note, notes) == 0) return 128;
+    return notes[0];
+}
+
+/* Moves the table position, step is wrapped to the table's steps */
+void seekStep(Arpeggiator* arp, uint32_t step) {
+    if(arp->table && arp->table->steps) arp->note_index = step % arp->table->steps;
+}
+
+/* Plays the next step for the held keys. Fills notes (room for 128)
+   and returns the number of notes to start, 0 for a silent step */
+uint32_t nextStep(Arpeggiator* arp, uint8_t* notes) {
+    if(arp->held.count == 0 || !arp->table) return 0;
+    if(arp->mode == MODE_TRANSPOSE) {
+        return arp->step(arp, arp->held.order[0], notes);
+    }
+    return arp->step(arp, 0, notes);
+}
+
+/* The notes of one step of the table for the held keys, without moving
+   the position or drawing a random number, for engines whose position
+   and skip are kept elsewhere, like in an ArpLanes. step must be below
+   the table's steps. */
+uint32_t stepNotes(const Arpeggiator* arp, uint32_t step, uint8_t* notes) {
+    if(arp->held.count == 0 || !arp->table) return 0;
+    if(arp->mode == MODE_TRANSPOSE) {
+        return arp->notes(arp->table, step, arp->held.order[0], notes);
+    }
+    return arp->notes(arp->table, step, 0, notes);
+}
+
+/* Every lane starts at its first step, with one step of value 0, no
+   skip and a gate of one hit */
+void lanesInit(ArpLanes* lanes, uint32_t count) {
+    memset(lanes, 0, sizeof(ArpLanes));
+    lanes->count = count < ARP_MAX_LANES ? count : ARP_MAX_LANES;
+    for(uint32_t i = 0; i < ARP_MAX_LANES; i++) {
+        lanes->length[i] = 1;
+        lanes->random[i] = scrambleSeed(i);
+        lanes->hits[i] = 1;
+        lanes->gate[i] = 1;
+    }
+}
+
+void lanesReset(ArpLanes* lanes) {
+    memset(lanes->index, 0, sizeof(lanes->index));
+}
+
+/* Starts the random sequence of a lane, like seedRandom() does for an
+   engine */
+void lanesSeed(ArpLanes* lanes, uint32_t lane, uint32_t seed) {
+    lanes->random[lane] = scrambleSeed(seed);
+}
+
+/* Sets the chance that a step of the lane is silent, in percent. The
+   engine scales its random number to 0-99 and skips the step when that
+   is below skip, which are the numbers below ceil(skip) * 2^32 / 100, so
+   the threshold is the last of those and the same numbers are skipped. */
+void lanesSetSkip(ArpLanes* lanes, uint32_t lane, float skip) {
+    uint32_t threshold = 0;
+    if(skip >= 100) {
+        threshold = UINT32_MAX;
+    } else if(skip > 0) {
+        uint64_t percent = (uint64_t) ceilf(skip);
+        threshold = (uint32_t) (((percent << 32) + 99) / 100 - 1);
+    }
+    lanes->skip[lane] = threshold;
+}
+
+// only the lanes in use can be due
+static inline uint64_t dueLanes(const ArpLanes* lanes, uint64_t due) {
+    return lanes->count < 64 ? due & (((uint64_t) 1 << lanes->count) - 1) : due;
+}
+
+/* Steps the lanes with a bit in due. Every lane in use gets its value,
+   its position and the end of its gate, step_length / hits * gate after
+   a hit starts. The due lanes then draw their random number, if they
+   have a skip threshold, and move on. The others are left as they are,
+   and their play bits are clear. */
+void lanesStepScalar(ArpLanes* lanes, uint64_t due, double step_length, ArpLaneStep* out) {
+    due = dueLanes(lanes, due);
+    out->play = 0;
+    for(uint32_t i = 0; i < lanes->count; i++) {
+        // a shortened lane can have its position past the end
+        uint32_t index = lanes->index[i];
+        if(index >= lanes->length[i]) index = lanes->loop[i];
+        out->value[i] = lanes->values[i][index & (ARP_LANE_STEPS - 1)];
+        out->step[i] = index;
+        out->off[i] = lanes->gate[i] * (step_length / lanes->hits[i]);
+        if(!(due >> i & 1)) continue;
+
+        bool play = true;
+        if(lanes->skip[i]) {
+            lanes->random[i] = xorshift32(lanes->random[i]);
+            play = lanes->random[i] > lanes->skip[i];
+        }
+        out->play |= (uint64_t) play << i;
+        if(++index >= lanes->length[i]) index = lanes->loop[i];
+        lanes->index[i] = index;
+    }
+}
+
+/* The vector versions work on whole vectors, so the values, positions
+   and gates of the lanes past count are worked out as well. They are
+   never due, and their results are never read. The AVX2 version is
+   compiled for every x86 build, and lanesStep() only calls it when the
+   CPU has AVX2, so the plugin doesn't need to be built for one CPU.
+   The lengths and positions are small, so signed compares do for the
+   wraps. The random numbers are compared unsigned, by flipping the sign
+   bits first. */
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void lanesStepAVX2(ArpLanes* lanes, uint64_t due, double step_length,
+        ArpLaneStep* out) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    const __m256i last = _mm256_set1_epi32(ARP_LANE_STEPS - 1);
+    const __m256d length = _mm256_set1_pd(step_length);
+    // the bit of each lane in a byte of the due mask
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    // offsets of the rows of 8 lanes in values, for the gather
+    const __m256i row = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+            _mm256_set1_epi32(ARP_LANE_STEPS));
+
+    due = dueLanes(lanes, due);
+    out->play = 0;
+    for(uint32_t i = 0; i < lanes->count; i += 8) {
+        __m256i steps = _mm256_loadu_si256((const __m256i*) &lanes->length[i]);
+        __m256i loop = _mm256_loadu_si256((const __m256i*) &lanes->loop[i]);
+        __m256i at = _mm256_loadu_si256((const __m256i*) &lanes->index[i]);
+        __m256i index = _mm256_blendv_epi8(loop, at, _mm256_cmpgt_epi32(steps, at));
+        _mm256_storeu_si256((__m256i*) &out->step[i], index);
+        const int* base = (const int*) lanes->values[i];
+        __m256i value = _mm256_i32gather_epi32(base,
+                _mm256_add_epi32(row, _mm256_and_si256(index, last)), 4);
+        _mm256_storeu_si256((__m256i*) &out->value[i], value);
+
+        // the gates, 4 doubles at a time
+        __m256i hits = _mm256_loadu_si256((const __m256i*) &lanes->hits[i]);
+        __m256d hit = _mm256_div_pd(length, _mm256_cvtepi32_pd(_mm256_castsi256_si128(hits)));
+        _mm256_storeu_pd(&out->off[i], _mm256_mul_pd(_mm256_loadu_pd(&lanes->gate[i]), hit));
+        hit = _mm256_div_pd(length, _mm256_cvtepi32_pd(_mm256_extracti128_si256(hits, 1)));
+        _mm256_storeu_pd(&out->off[i + 4], _mm256_mul_pd(_mm256_loadu_pd(&lanes->gate[i + 4]), hit));
+
+        // the due lanes with a skip threshold draw a random number
+        __m256i is_due = _mm256_and_si256(_mm256_set1_epi32((int) (due >> i & 0xff)), bit);
+        is_due = _mm256_cmpeq_epi32(is_due, bit);
+        __m256i skip = _mm256_loadu_si256((const __m256i*) &lanes->skip[i]);
+        __m256i draws = _mm256_andnot_si256(
+                _mm256_cmpeq_epi32(skip, _mm256_setzero_si256()), is_due);
+        __m256i random = _mm256_loadu_si256((const __m256i*) &lanes->random[i]);
+        __m256i x = _mm256_xor_si256(random, _mm256_slli_epi32(random, 13));
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+        random = _mm256_blendv_epi8(random, x, draws);
+        _mm256_storeu_si256((__m256i*) &lanes->random[i], random);
+        __m256i kept = _mm256_cmpgt_epi32(_mm256_xor_si256(random, sign),
+                _mm256_xor_si256(skip, sign));
+        __m256i play = _mm256_andnot_si256(_mm256_andnot_si256(kept, draws), is_due);
+        out->play |= (uint64_t) (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(play)) << i;
+
+        // and move on
+        __m256i next = _mm256_add_epi32(index, one);
+        next = _mm256_blendv_epi8(loop, next, _mm256_cmpgt_epi32(steps, next));
+        _mm256_storeu_si256((__m256i*) &lanes->index[i], _mm256_blendv_epi8(at, next, is_due));
+    }
+}
+#endif
+
+#if defined(__SSE2__)
+// mask ? a : b, SSE2 has no blend
+static inline __m128i select128(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void lanesStepSSE2(ArpLanes* lanes, uint64_t due, double step_length,
+        ArpLaneStep* out) {
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i sign = _mm_set1_epi32(INT32_MIN);
+    const __m128d length = _mm_set1_pd(step_length);
+    const __m128i bit = _mm_setr_epi32(1, 2, 4, 8);
+
+    due = dueLanes(lanes, due);
+    out->play = 0;
+    for(uint32_t i = 0; i < lanes->count; i += 4) {
+        __m128i steps = _mm_loadu_si128((const __m128i*) &lanes->length[i]);
+        __m128i loop = _mm_loadu_si128((const __m128i*) &lanes->loop[i]);
+        __m128i at = _mm_loadu_si128((const __m128i*) &lanes->index[i]);
+        __m128i index = select128(_mm_cmpgt_epi32(steps, at), at, loop);
+        _mm_storeu_si128((__m128i*) &out->step[i], index);
+        // SSE2 has no gather
+        for(uint32_t j = 0; j < 4; j++) {
+            out->value[i + j] = lanes->values[i + j][out->step[i + j] & (ARP_LANE_STEPS - 1)];
+        }
+
+        // the gates, 2 doubles at a time
+        __m128i hits = _mm_loadu_si128((const __m128i*) &lanes->hits[i]);
+        __m128d hit = _mm_div_pd(length, _mm_cvtepi32_pd(hits));
+        _mm_storeu_pd(&out->off[i], _mm_mul_pd(_mm_loadu_pd(&lanes->gate[i]), hit));
+        hit = _mm_div_pd(length, _mm_cvtepi32_pd(_mm_shuffle_epi32(hits, _MM_SHUFFLE(3, 2, 3, 2))));
+        _mm_storeu_pd(&out->off[i + 2], _mm_mul_pd(_mm_loadu_pd(&lanes->gate[i + 2]), hit));
+
+        // the due lanes with a skip threshold draw a random number
+        __m128i is_due = _mm_and_si128(_mm_set1_epi32((int) (due >> i & 0xf)), bit);
+        is_due = _mm_cmpeq_epi32(is_due, bit);
+        __m128i skip = _mm_loadu_si128((const __m128i*) &lanes->skip[i]);
+        __m128i draws = _mm_andnot_si128(_mm_cmpeq_epi32(skip, _mm_setzero_si128()), is_due);
+        __m128i random = _mm_loadu_si128((const __m128i*) &lanes->random[i]);
+        __m128i x = _mm_xor_si128(random, _mm_slli_epi32(random, 13));
+        x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+        x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+        random = select128(draws, x, random);
+        _mm_storeu_si128((__m128i*) &lanes->random[i], random);
+        __m128i kept = _mm_cmpgt_epi32(_mm_xor_si128(random, sign), _mm_xor_si128(skip, sign));
+        __m128i play = _mm_andnot_si128(_mm_andnot_si128(kept, draws), is_due);
+        out->play |= (uint64_t) (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(play)) << i;
+
+        // and move on
+        __m128i next = _mm_add_epi32(index, one);
+        next = select128(_mm_cmpgt_epi32(steps, next), next, loop);
+        _mm_storeu_si128((__m128i*) &lanes->index[i], select128(is_due, next, at));
+    }
+}
+#endif
+
+void lanesStep(ArpLanes* lanes, uint64_t due, double step_length, ArpLaneStep* out) {
+#if defined(__x86_64__) || defined(__i386__)
+    if(__builtin_cpu_supports("avx2")) {
+        lanesStepAVX2(lanes, due, step_length, out);
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    lanesStepSSE2(lanes, due, step_length, out);
+#else
+    lanesStepScalar(lanes, due, step_length, out);
+#endif
+}
+
+void patternClear(ArpPattern* pattern) {
+    memset(pattern, 0, sizeof(ArpPattern));
+}
+
+static const char* const lane_names[ARP_LANE_TYPES] = {
+    [LANE_PITCH] = "pitch",
+    [LANE_RHYTHM] = "rhythm",
+    [LANE_GATE] = "gate",
+    [LANE_VELOCITY] = "velocity",
+};
+
+// one value of a lane, or false if the word can't be read
+// Holds a lane value to the range parsePattern() reads
+static int32_t limitLaneValue(enum lanetype lane, long value) {
+    long low = 0, high = 200;
+    switch(lane) {
+        case LANE_PITCH: high = INT32_MAX; break;
+        case LANE_RHYTHM: low = RHYTHM_TIE; high = ARP_MAX_RATCHETS; break;
+        case LANE_GATE: high = 400; break;
+        default: break;
+    }
+    return (int32_t) (value < low ? low : value > high ? high : value);
+}
+
+static bool parseLaneValue(enum lanetype lane, const char* word, int32_t* value) {
+    char* end;
+    if(lane == LANE_RHYTHM) {
+        if(!strcmp(word, "x")) *value = RHYTHM_PLAY;
+        else if(!strcmp(word, ".")) *value = RHYTHM_REST;
+        else if(!strcmp(word, "-")) *value = RHYTHM_TIE;
+        else {
+            // a ratchet of 2 or more hits
+            long hits = strtol(word, &end, 10);
+            if(*end || hits < 2 || hits > ARP_MAX_RATCHETS) return false;
+            *value = (int32_t) hits;
         }
+        return true;
+    }
+    long number = strtol(word, &end, 10);
+    if(*end) return false;
+    if(lane == LANE_PITCH) {
+        // 1 is the first step of the arpeggio
+        if(number < 1) return false;
+        --number;
+    }
+    *value = limitLaneValue(lane, number);
+    return true;
+}
+
+/* Reads a pattern from text. Each line names a lane and gives its
+   steps, e.g. "pitch 1 3 2", "rhythm x x . -", "gate 50 100" or
+   "velocity 100 70 85". Lines for the same lane add to it, up to
+   ARP_LANE_STEPS steps. Rhythm steps are x to play, . to rest, - to
+   hold the note before and 2 to ARP_MAX_RATCHETS to play that many
+   hits. Lanes that are not given follow the controls.
+   Empty lines and lines starting with # are skipped. Not real-time safe.
+   Returns false, leaving the pattern unchanged, on an unknown lane or
+   value, or if there are no steps at all. */
+bool parsePattern(const char* text, ArpPattern* pattern) {
+    ArpPattern parsed;
+    uint32_t steps = 0;
+    patternClear(&parsed);
+    while(*text) {
+        char line[512];
+        const char* end = strchr(text, '\n');
+        if(!end) end = text + strlen(text);
+        size_t length = (size_t) (end - text);
+        if(length >= sizeof(line)) length = sizeof(line) - 1;
+        memcpy(line, text, length);
+        line[length] = 0;
+        text = *end ? end + 1 : end;
 
+        char* save;
+        char* word = strtok_r(line, " \t\r", &save);
+        if(!word || word[0] == '#') continue;
+        int lane;
+        for(lane = 0; lane < ARP_LANE_TYPES; lane++) {
+            if(!strcmp(word, lane_names[lane])) break;
+        }
+        if(lane == ARP_LANE_TYPES) return false;
+        while((word = strtok_r(NULL, " \t\r", &save))) {
+            if(parsed.length[lane] == ARP_LANE_STEPS) return false;
+            if(!parseLaneValue(lane, word, &parsed.values[lane][parsed.length[lane]])) {
+                return false;
+            }
+            ++parsed.length[lane];
+            ++steps;
+        }
+    }
+    if(steps == 0) return false;
+    *pattern = parsed;
+    return true;
+}
+
+void savePattern(const ArpPattern* pattern, ArpPatternState* state) {
+    memset(state, 0, sizeof(ArpPatternState));
+    state->magic = ARP_PATTERN_MAGIC;
+    state->version = ARP_PATTERN_VERSION;
+    state->pattern = *pattern;
+}
+
+/* Restores a pattern saved by savePattern(). Returns false, leaving the
+   pattern unchanged, if the header or a lane length is wrong. The values
+   are limited to the ranges the parser gives them. */
+bool restorePattern(ArpPattern* pattern, const void* data, uint32_t size) {
+    const ArpPatternState* state = (const ArpPatternState*) data;
+    if(size != sizeof(ArpPatternState) ||
+            state->magic != ARP_PATTERN_MAGIC ||
+            state->version != ARP_PATTERN_VERSION) {
+        return false;
+    }
+    for(uint32_t lane = 0; lane < ARP_LANE_TYPES; lane++) {
+        if(state->pattern.length[lane] > ARP_LANE_STEPS) return false;
+    }
+    *pattern = state->pattern;
+    for(uint32_t lane = 0; lane < ARP_LANE_TYPES; lane++) {
+        for(uint32_t i = 0; i < ARP_LANE_STEPS; i++) {
+            pattern->values[lane][i] = limitLaneValue(lane, pattern->values[lane][i]);
+        }
     }
+    return true;
+}
 
-    if(arp_state.dir == DIR_UPDOWN) {
-        for(i = 0; i < arp_state.arpeggio_length; i++) {
-            arp_state.arpeggio_notes[2 * arp_state.arpeggio_length - i] = 
-                arp_state.arpeggio_notes[i];
+/* Loads the pattern into the lanes first to first + ARP_LANE_TYPES - 1,
+   in enum lanetype order, and starts them from their first step. A lane
+   the pattern doesn't use gets one step that leaves the controls alone. */
+void patternLanes(const ArpPattern* pattern, ArpLanes* lanes, uint32_t first) {
+    static const int32_t unused[ARP_LANE_TYPES] = { -1, RHYTHM_PLAY, -1, 100 };
+    for(uint32_t lane = 0; lane < ARP_LANE_TYPES; lane++) {
+        uint32_t i = first + lane;
+        lanes->index[i] = 0;
+        if(pattern->length[lane]) {
+            lanes->length[i] = pattern->length[lane];
+            memcpy(lanes->values[i], pattern->values[lane],
+                    pattern->length[lane] * sizeof(int32_t));
+        } else {
+            lanes->length[i] = 1;
+            lanes->values[i][0] = unused[lane];
         }
-        arp_state.arpeggio_length = 2 * arp_state.arpeggio_length;
     }
-    resetArpeggio();
 }
 
-void resetArpeggio() {
-    srandom(time(NULL));
-    arp_state.note_index = 0;
+/* How many tie steps come next in a rhythm lane, after lanesStep() has
+   moved it on. The note of the step just played is held through them.
+   Ties that go all the way round stop at the lane's length. */
+uint32_t patternTies(const ArpLanes* lanes, uint32_t rhythm_lane) {
+    const uint32_t length = lanes->length[rhythm_lane];
+    const int32_t* values = lanes->values[rhythm_lane];
+    uint32_t index = lanes->index[rhythm_lane], ties = 0;
+    while(ties < length && values[index] == RHYTHM_TIE) {
+        ++ties;
+        if(++index >= length) index = 0;
+    }
+    return ties;
+}
+
+/* E(pulses, steps), with step i a pulse when i * pulses wraps around
+   steps, so the cycle starts on a pulse. rotate moves the start of the
+   cycle that many steps on. */
+uint64_t euclidMask(uint32_t pulses, uint32_t steps, uint32_t rotate) {
+    if(steps == 0) return 0;
+    if(steps > ARP_RHYTHM_STEPS) steps = ARP_RHYTHM_STEPS;
+    uint64_t mask = 0;
+    rotate %= steps;
+    for(uint32_t i = 0; i < steps; i++) {
+        uint32_t step = (i + rotate) % steps;
+        if((uint64_t) step * pulses % steps < pulses) mask |= (uint64_t) 1 << i;
+    }
+    return mask;
+}
+
+// a chance in percent as a threshold for the xorshift32 numbers, which
+// are never 0
+static uint32_t rhythmChance(float percent) {
+    if(percent <= 0) return 0;
+    if(percent >= 100) return ARP_RHYTHM_ALWAYS;
+    return (uint32_t) (percent / 100.0 * ARP_RHYTHM_ALWAYS);
+}
+
+/* The pulses of E(pulses, steps) play with pulse_chance and the steps
+   between them with fill_chance, both in percent. steps 0 turns the
+   rhythm off. */
+void buildRhythm(ArpRhythm* rhythm, uint32_t pulses, uint32_t steps,
+        uint32_t rotate, float pulse_chance, float fill_chance) {
+    if(steps > ARP_RHYTHM_STEPS) steps = ARP_RHYTHM_STEPS;
+    const uint64_t pulse_mask = euclidMask(pulses, steps, rotate);
+    const uint32_t pulse = rhythmChance(pulse_chance);
+    const uint32_t fill = rhythmChance(fill_chance);
+    rhythm->steps = steps;
+    rhythm->mask = 0;
+    for(uint32_t i = 0; i < ARP_RHYTHM_STEPS; i++) {
+        uint32_t chance = 0;
+        if(i < steps) chance = (pulse_mask >> i & 1) ? pulse : fill;
+        rhythm->chance[i] = chance;
+        if(chance) rhythm->mask |= (uint64_t) 1 << i;
+    }
 }
 
-uint8_t nextNote(uint8_t base_note) {
-    uint8_t note =  base_note + arp_state.arpeggio_notes[
-        arp_state.note_index % arp_state.arpeggio_length];
+/* Tells whether the step at *index plays, and moves *index on to the
+   next step of the cycle. random is a xorshift32 state, like the one of
+   an engine or a lane. Steps outside the mask use no random number. */
+bool rhythmStep(const ArpRhythm* rhythm, uint32_t* index, uint32_t* random) {
+    // the cycle can have been shortened since the last step
+    uint32_t i = *index < rhythm->steps ? *index : 0;
+    *index = i + 1 < rhythm->steps ? i + 1 : 0;
+    if(!(rhythm->mask >> i & 1)) return false;
+    *random = xorshift32(*random);
+    return *random <= rhythm->chance[i];
+}
+
+const ArpGroove arp_grooves[GROOVE_USER] = {
+    [GROOVE_NONE] = {
+        { 0 },
+        { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 }
+    },
+    // every second step late by a third, like triplets
+    [GROOVE_SHUFFLE] = {
+        { 0, .33, 0, .33, 0, .33, 0, .33, 0, .33, 0, .33, 0, .33, 0, .33 },
+        { 1, .8, .9, .8, 1, .8, .9, .8, 1, .8, .9, .8, 1, .8, .9, .8 }
+    },
+    // behind the beat except on the downbeats
+    [GROOVE_LAID_BACK] = {
+        { 0, .12, .08, .12, 0, .12, .08, .12, 0, .12, .08, .12, 0, .12, .08, .12 },
+        { 1, .75, .85, .75, .95, .75, .85, .75, 1, .75, .85, .75, .95, .75, .85, .75 }
+    },
+    // the off beats ahead of the beat
+    [GROOVE_PUSH] = {
+        { 0, -.06, -.1, -.06, 0, -.06, -.1, -.06, 0, -.06, -.1, -.06, 0, -.06, -.1, -.06 },
+        { 1, .85, 1, .85, 1, .85, 1, .85, 1, .85, 1, .85, 1, .85, 1, .85 }
+    },
+};
+
+void grooveClear(ArpGroove* groove) {
+    *groove = arp_grooves[GROOVE_NONE];
+}
+
+// Keeps a step in range. A NaN is a straight step at full velocity.
+static void limitGrooveStep(float* offset, float* velocity) {
+    if(isnan(*offset)) *offset = 0;
+    if(*offset < -ARP_GROOVE_MAX_OFFSET) *offset = -ARP_GROOVE_MAX_OFFSET;
+    if(*offset > ARP_GROOVE_MAX_OFFSET) *offset = ARP_GROOVE_MAX_OFFSET;
+    if(isnan(*velocity)) *velocity = 1;
+    if(*velocity < 0) *velocity = 0;
+    if(*velocity > 1) *velocity = 1;
+}
+
+/* Limits every step to the ranges parseGroove() reads, for grooves from
+   elsewhere, like a saved state */
+void grooveLimit(ArpGroove* groove) {
+    for(int i = 0; i < ARP_GROOVE_STEPS; i++) {
+        limitGrooveStep(&groove->offset[i], &groove->velocity[i]);
+    }
+}
 
-    if(arp_state.cycle > 0) {
-        if((arp_state.note_index % arp_state.arpeggio_length) ==
-                (arp_state.cycle % arp_state.arpeggio_length)) {
-            ++arp_state.note_index;
+/* Reads a groove template from text: one step per line, with the offset
+   in percent of a step and the velocity in percent, e.g. "33 80". Empty
+   lines and lines starting with # are skipped. Fewer than 16 steps are
+   repeated to fill the cycle. Not real-time safe. Returns false, leaving
+   the groove unchanged, if no step could be read. */
+bool parseGroove(const char* text, ArpGroove* groove) {
+    ArpGroove parsed;
+    uint32_t steps = 0, i;
+    while(*text && steps < ARP_GROOVE_STEPS) {
+        float offset, velocity;
+        char line[128];
+        const char* end = strchr(text, '\n');
+        if(!end) end = text + strlen(text);
+        // sscanf would read on into the next lines
+        size_t length = (size_t) (end - text);
+        if(length >= sizeof(line)) length = sizeof(line) - 1;
+        memcpy(line, text, length);
+        line[length] = 0;
+        if(line[0] != '#' && sscanf(line, "%f %f", &offset, &velocity) == 2) {
+            offset /= 100;
+            velocity /= 100;
+            limitGrooveStep(&offset, &velocity);
+            parsed.offset[steps] = offset;
+            parsed.velocity[steps] = velocity;
+            ++steps;
         }
+        text = *end ? end + 1 : end;
     }
+    if(steps == 0) return false;
+    for(i = steps; i < ARP_GROOVE_STEPS; i++) {
+        parsed.offset[i] = parsed.offset[i % steps];
+        parsed.velocity[i] = parsed.velocity[i % steps];
+    }
+    *groove = parsed;
+    return true;
+}
 
-    if((random() % 100) < arp_state.skip) {
-        note = 128; 
+/* The start offset of each step of the cycle, in steps. Swing (0-100 %)
+   delays every second step on top of the groove, at most by
+   ARP_GROOVE_MAX_OFFSET. */
+void grooveOffsets(const ArpGroove* groove, float swing, float* offsets) {
+    for(int i = 0; i < ARP_GROOVE_STEPS; i++) {
+        float offset = groove->offset[i];
+        if(i & 1) offset += swing / 100 * ARP_GROOVE_MAX_OFFSET;
+        if(offset > ARP_GROOVE_MAX_OFFSET) offset = ARP_GROOVE_MAX_OFFSET;
+        offsets[i] = offset;
     }
+}
 
-    ++arp_state.note_index;
-    return note;
+const uint16_t arp_accents[ACCENT_ERROR] = {
+    [ACCENT_NONE] = 0,
+    [ACCENT_DOWNBEATS] = 0x1111,
+    [ACCENT_OFFBEATS] = 0x4444,
+    [ACCENT_ALTERNATE] = 0x5555,
+    [ACCENT_3_3_2] = 0x4949,
+};
+
+/* Works out all 16 * 128 velocities, so it is only called when a setting
+   changes. The accent level (0-100 %) moves accented steps that far
+   towards full velocity. */
+void buildVelocityMap(ArpVelocityMap* map, enum velocitycurve curve,
+        enum accenttype accent, float accent_level, const ArpGroove* groove) {
+    float curved[128];
+    uint16_t accents = accent > ACCENT_NONE && accent < ACCENT_ERROR ?
+        arp_accents[accent] : 0;
+    for(int v = 0; v < 128; v++) {
+        float x = v / 127.0f;
+        switch(curve) {
+            case VELOCITY_SOFT: x = sqrtf(x); break;
+            case VELOCITY_HARD: x = x * x; break;
+            case VELOCITY_FIXED: x = 1; break;
+            default: break;
+        }
+        curved[v] = 127 * x;
+    }
+    for(int i = 0; i < ARP_GROOVE_STEPS; i++) {
+        bool accented = (accents >> i) & 1;
+        for(int v = 0; v < 128; v++) {
+            float out = curved[v] * groove->velocity[i];
+            if(accented) out += (127 - out) * accent_level / 100;
+            long n = lrintf(out);
+            // 0 would be a note off
+            map->step[i][v] = n < 1 ? 1 : n > 127 ? 127 : n;
+        }
+    }
 }
 
-float note_as_fraction_of_bar(int beat_unit, int beats_per_bar) {
+void buildScaleMap(uint8_t* map, int key, uint16_t scale) {
+    scale &= ARP_INTERVALS_ALL;
+    for(int note = 0; note < 128; note++) {
+        map[note] = note;
+        if(!scale) continue;
+        // a scale note is never more than 6 semitones away
+        for(int d = 0; d <= 6; d++) {
+            int down = note - d, up = note + d;
+            if(down >= 0 && (scale >> ((down - key + 120) % 12) & 1)) {
+                map[note] = down;
+                break;
+            }
+            if(up < 128 && (scale >> ((up - key + 120) % 12) & 1)) {
+                map[note] = up;
+                break;
+            }
+        }
+    }
+}
+
+float note_as_fraction_of_bar(Arpeggiator* arp, int beat_unit, int beats_per_bar) {
     // return the arpeggiator step as a fraction of a bar
     float note_length[] = { 1, 2, 4, 8, 16, 32 };
-    return beats_per_bar / (note_length[arp_state.time] * beat_unit);
+    return beats_per_bar / (note_length[arp->time] * beat_unit);
+}
+
+double note_as_beats(Arpeggiator* arp, int beat_unit) {
+    // return the arpeggiator step in beats (a beat is a 1/beat_unit note)
+    double note_length[] = { 1, 2, 4, 8, 16, 32 };
+    return beat_unit / note_length[arp->time];
+}
+
+void noteOffClear(NoteOffQueue* queue) {
+    queue->count = 0;
+}
+
+static bool queuePush(NoteOffQueue* queue, const NoteOff* item) {
+    if(queue->count == ARP_MAX_NOTE_OFFS) return false;
+    // sift up from the end
+    uint32_t i = queue->count++;
+    while(i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if(queue->items[parent].frame <= item->frame) break;
+        queue->items[i] = queue->items[parent];
+        i = parent;
+    }
+    queue->items[i] = *item;
+    return true;
+}
+
+/* Returns false if the queue is full */
+bool noteOffPush(NoteOffQueue* queue, uint64_t frame, uint8_t note, uint8_t channel) {
+    NoteOff off = { frame, 0, note, channel, 0 };
+    return queuePush(queue, &off);
+}
+
+/* Queues a note on, which ends length frames after frame. Returns false
+   if the queue is full */
+bool noteOnPush(NoteOffQueue* queue, uint64_t frame, uint8_t note, uint8_t channel,
+        uint8_t velocity, uint32_t length) {
+    NoteOff on = { frame, length, note, channel, velocity };
+    return queuePush(queue, &on);
+}
+
+/* The earliest note off, or NULL if the queue is empty */
+const NoteOff* noteOffPeek(const NoteOffQueue* queue) {
+    return queue->count ? &queue->items[0] : NULL;
+}
+
+/* Removes and returns the earliest note off. The queue must not be empty */
+NoteOff noteOffPop(NoteOffQueue* queue) {
+    NoteOff top = queue->items[0];
+    NoteOff last = queue->items[--queue->count];
+    // sift the last item down from the top
+    uint32_t i = 0;
+    for(;;) {
+        uint32_t child = 2 * i + 1;
+        if(child >= queue->count) break;
+        if(child + 1 < queue->count &&
+                queue->items[child + 1].frame < queue->items[child].frame) {
+            ++child;
+        }
+        if(last.frame <= queue->items[child].frame) break;
+        queue->items[i] = queue->items[child];
+        i = child;
+    }
+    if(queue->count) queue->items[i] = last;
+    return top;
+}
+
+void clockInit(ArpClock* clk, double rate, double bpm) {
+    clk->rolling = false;
+    clk->frames_per_beat = 60.0 / bpm * rate;
+    clk->anchor_beat = 0;
+    clk->anchor_frame = 0;
+    clk->step_beats = 1;
+    clk->next_step = 0;
+}
+
+double clockBeatAt(const ArpClock* clk, uint64_t frame) {
+    if(!clk->rolling) return clk->anchor_beat;
+    return clk->anchor_beat +
+        ((double) frame - (double) clk->anchor_frame) / clk->frames_per_beat;
+}
+
+static int64_t clockFrameAtSigned(const ArpClock* clk, double beat) {
+    // first frame at or after the beat position. The epsilon keeps
+    // positions that are exact in theory from being pushed one frame late
+    // by rounding errors
+    double frames = (double) clk->anchor_frame +
+        (beat - clk->anchor_beat) * clk->frames_per_beat;
+    return (int64_t) ceil(frames - 1e-6);
+}
+
+uint64_t clockFrameAt(const ArpClock* clk, double beat) {
+    int64_t frame = clockFrameAtSigned(clk, beat);
+    return frame < 0 ? 0 : (uint64_t) frame;
+}
+
+uint64_t clockStepFrame(const ArpClock* clk, int64_t step) {
+    return clockFrameAt(clk, step * clk->step_beats);
+}
+
+int64_t clockFirstStep(const ArpClock* clk, uint64_t frame) {
+    // the first step that starts at or after frame
+    int64_t step = (int64_t) ceil(clockBeatAt(clk, frame) / clk->step_beats - 1e-9);
+    while(clockFrameAtSigned(clk, step * clk->step_beats) < (int64_t) frame) ++step;
+    while(clockFrameAtSigned(clk, (step - 1) * clk->step_beats) >= (int64_t) frame) --step;
+    return step;
+}
+
+static void clockAnchor(ArpClock* clk, uint64_t frame) {
+    // move the anchor to frame without changing the beat position
+    clk->anchor_beat = clockBeatAt(clk, frame);
+    clk->anchor_frame = frame;
+}
+
+void clockSetTempo(ArpClock* clk, double rate, double bpm, uint64_t frame) {
+    clockAnchor(clk, frame);
+    clk->frames_per_beat = 60.0 / bpm * rate;
+}
+
+void clockSetRolling(ArpClock* clk, bool rolling, uint64_t frame) {
+    clockAnchor(clk, frame);
+    clk->rolling = rolling;
+    if(rolling) clk->next_step = clockFirstStep(clk, frame);
+}
+
+void clockSetStep(ArpClock* clk, double step_beats, uint64_t frame) {
+    if(clk->step_beats == step_beats) return;
+    clk->step_beats = step_beats;
+    clk->next_step = clockFirstStep(clk, frame);
+}
+
+bool clockLocate(ArpClock* clk, double beat, uint64_t frame) {
+    // Re-anchor on a host position. Returns true if the position was a
+    // jump rather than a small correction of the running position.
+    double error = beat - clockBeatAt(clk, frame);
+    bool jump = !clk->rolling || fabs(error) > clk->step_beats / 4;
+    // Hosts send the position as a float, so it is usually a fraction of
+    // a frame off. Keeping the own anchor then makes the step frames
+    // independent of where the host's blocks start.
+    if(!jump && fabs(error) * clk->frames_per_beat < 1) return false;
+    clk->anchor_beat = beat;
+    clk->anchor_frame = frame;
+    if(jump) {
+        clk->next_step = clockFirstStep(clk, frame);
+    }
+    return jump;
+}
+
+// loop gains of the phase and tempo corrections, per tick
+#define MIDI_CLOCK_PHASE_GAIN 0.125
+#define MIDI_CLOCK_TEMPO_GAIN 0.008
+
+void midiClockInit(ArpMidiClock* mc, double rate, double bpm) {
+    mc->frames_per_tick = 60.0 / bpm * rate / ARP_MIDI_PPQN;
+    mc->tick_frame = 0;
+    mc->last_frame = 0;
+    mc->tick = -1;
+    mc->ticks_seen = 0;
+    mc->outliers = 0;
+    mc->running = false;
 }
 
+/* Start from the beginning of the song: the next tick is beat 0 */
+void midiClockStart(ArpMidiClock* mc) {
+    mc->tick = -1;
+    mc->running = true;
+}
+
+void midiClockContinue(ArpMidiClock* mc) {
+    mc->running = true;
+}
+
+void midiClockStop(ArpMidiClock* mc) {
+    mc->running = false;
+}
+
+/* Song position pointer, in 16th notes. The next tick is at the position */
+void midiClockSongPosition(ArpMidiClock* mc, uint32_t sixteenths) {
+    mc->tick = (int64_t) sixteenths * (ARP_MIDI_PPQN / 4) - 1;
+}
+
+void midiClockTick(ArpMidiClock* mc, uint64_t frame) {
+    double f = (double) frame;
+    ++mc->tick;
+    if(mc->ticks_seen > 0 && f - mc->last_frame > 4 * mc->frames_per_tick) {
+        // the clock paused, lock on again keeping the tempo
+        mc->ticks_seen = 0;
+    }
+    if(mc->ticks_seen < 2) {
+        // the first period is measured directly
+        if(mc->ticks_seen == 1 && f - mc->last_frame >= 1) {
+            mc->frames_per_tick = f - mc->last_frame;
+        }
+        mc->tick_frame = f;
+        mc->last_frame = frame;
+        mc->outliers = 0;
+        ++mc->ticks_seen;
+        return;
+    }
+
+    double predicted = mc->tick_frame + mc->frames_per_tick;
+    double error = f - predicted;
+    if(fabs(error) > mc->frames_per_tick / 2) {
+        // A late or early tick far outside the jitter is ignored, but if
+        // it happens a few times in a row the tempo has jumped and the
+        // loop starts over from the last period
+        if(++mc->outliers >= 3 && f - mc->last_frame >= 1) {
+            mc->frames_per_tick = f - mc->last_frame;
+            mc->tick_frame = f;
+            mc->outliers = 0;
+        } else {
+            mc->tick_frame = predicted;
+        }
+    } else {
+        mc->outliers = 0;
+        mc->tick_frame = predicted + MIDI_CLOCK_PHASE_GAIN * error;
+        mc->frames_per_tick += MIDI_CLOCK_TEMPO_GAIN * error;
+    }
+    mc->last_frame = frame;
+    ++mc->ticks_seen;
+}
+
+/* The song position in beats (quarter notes) at frame, interpolated from
+   the last tick */
+double midiClockBeatAt(const ArpMidiClock* mc, uint64_t frame) {
+    return (mc->tick + ((double) frame - mc->tick_frame) / mc->frames_per_tick)
+        / ARP_MIDI_PPQN;
+}
+
+double midiClockBpm(const ArpMidiClock* mc, double rate) {
+    return 60.0 * rate / (mc->frames_per_tick * ARP_MIDI_PPQN);
+}
@@ -15,13 +15,60 @@
    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
    */
 
+#ifndef ARPEGGIATOR_H
+#define ARPEGGIATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Chords and scales are sets of intervals within an octave, kept as
+   bitmasks with bit n set for n semitones above the root */
 enum chordtype {
     OCTAVE = 0,
     MAJOR = 1,
     MINOR = 2,
+    MAJOR_7 = 3,
+    MINOR_7 = 4,
+    DOMINANT_7 = 5,
+    SUS_2 = 6,
+    SUS_4 = 7,
+    DIMINISHED = 8,
+    AUGMENTED = 9,
+    POWER = 10,
+    CHORD_USER = 11,   // the intervals in user_chord
     CHORD_ERROR
 };
 
+enum scaletype {
+    SCALE_CHROMATIC = 0, // all notes, nothing is quantized
+    SCALE_MAJOR = 1,
+    SCALE_MINOR = 2,
+    SCALE_HARMONIC_MINOR = 3,
+    SCALE_DORIAN = 4,
+    SCALE_PHRYGIAN = 5,
+    SCALE_LYDIAN = 6,
+    SCALE_MIXOLYDIAN = 7,
+    SCALE_LOCRIAN = 8,
+    SCALE_MAJOR_PENTATONIC = 9,
+    SCALE_MINOR_PENTATONIC = 10,
+    SCALE_BLUES = 11,
+    SCALE_USER = 12,     // a mask given by the user
+    SCALE_ERROR
+};
+
+#define ARP_INTERVALS_ALL 0xfff
+
+extern const uint16_t arp_chords[CHORD_USER];
+extern const uint16_t arp_scales[SCALE_USER];
+
+enum modetype {
+    MODE_TRANSPOSE = 0, // chord pattern transposed to the first held key
+    MODE_SORTED = 1,    // all held keys, lowest to highest
+    MODE_AS_PLAYED = 2, // all held keys, in the order they were pressed
+    MODE_CHORD = 3,     // all held keys together on every step
+    MODE_ERROR
+};
+
 enum timetype {
     NOTE_1_1 = 0,
     NOTE_1_2 = 1,
@@ -39,21 +86,409 @@ enum dirtype {
     DIR_ERROR
 };
 
-float getGate();
+#define ARP_MAX_NOTES 512 // size of the expanded note table
+
+/* Keys held down on the input. The bitmap gives cheap pitch ordered
+   iteration, the order array remembers the order the keys were pressed */
+typedef struct {
+    uint64_t         bits[2];     // one bit per held pitch
+    uint8_t          order[128];  // held pitches, first pressed first
+    uint8_t          count;
+} HeldNotes;
+
+void heldClear(HeldNotes* held);
+bool heldContains(const HeldNotes* held, uint8_t note);
+bool heldAdd(HeldNotes* held, uint8_t note);
+bool heldRemove(HeldNotes* held, uint8_t note);
+uint32_t heldSorted(const HeldNotes* held, uint8_t* notes);
+
+/* Per-step flags of a compiled table */
+#define ARP_STEP_SILENT 1 // no note of the step can sound
+
+/* The compiled arpeggio. Chord, range, direction and cycle are expanded
+   into the steps in playing order, so playback only walks the table and
+   goes back to loop_step after the last step. */
+typedef struct {
+    uint32_t         length; // number of arpeggio notes, steps * step_size
+    uint32_t         step_size; // notes played together on each step
+    uint32_t         steps;
+    uint32_t         loop_step; // where playback continues after the last step
+    // Intervals from the first held key in MODE_TRANSPOSE, otherwise
+    // absolute notes. 128 marks a silent note in a chord step.
+    uint8_t          notes[ARP_MAX_NOTES];
+    uint8_t          flags[ARP_MAX_NOTES]; // ARP_STEP_* for each step
+} ArpTable;
+
+typedef struct Arpeggiator {
+    enum chordtype   chord;
+    uint16_t         user_chord; // intervals of CHORD_USER
+    int              range;
+    enum timetype    time;
+    float            gate;
+    int              cycle;
+    float            skip;
+    enum dirtype     dir;
+    enum modetype    mode;
+    uint32_t         seed;  // 0 = free running random sequence
+
+    HeldNotes        held;
+    uint8_t          key_velocity[128]; // note on velocity of each held key
+
+    uint32_t         note_index; // next step of the table
+    uint32_t         random_state; // xorshift32 state, never 0
+    // The table being played, either table_buffer or a compiled preset.
+    // It points into the struct, so an Arpeggiator must not be copied.
+    // Set with setArpeggioTable(), which also picks the step and notes
+    // functions specialised for the table and the features in use.
+    const ArpTable*  table;
+    uint32_t         (*step)(struct Arpeggiator* arp, uint8_t base_note, uint8_t* notes);
+    uint32_t         (*notes)(const ArpTable* table, uint32_t step, uint8_t base_note,
+                             uint8_t* notes);
+    ArpTable         table_buffer;
+} Arpeggiator;
+
+float getGate(Arpeggiator* arp);
+
+int setChord(Arpeggiator* arp, enum chordtype chord);
+int setUserChord(Arpeggiator* arp, uint16_t intervals);
+uint16_t chordIntervals(const Arpeggiator* arp);
+int setRange(Arpeggiator* arp, int range);
+int setTime(Arpeggiator* arp, enum timetype time);
+int setGate(Arpeggiator* arp, float gate);
+int setCycle(Arpeggiator* arp, int range);
+int setSkip(Arpeggiator* arp, float gate);
+int setDir(Arpeggiator* arp, enum dirtype time);
+int setMode(Arpeggiator* arp, enum modetype mode);
+int setSeed(Arpeggiator* arp, uint32_t seed);
+void seedRandom(Arpeggiator* arp, uint32_t seed);
+uint32_t nextRandom(Arpeggiator* arp);
+
+
+int addHeldNote(Arpeggiator* arp, uint8_t note);
+int removeHeldNote(Arpeggiator* arp, uint8_t note);
+void setKeyVelocity(Arpeggiator* arp, uint8_t note, uint8_t velocity);
+uint8_t noteVelocity(const Arpeggiator* arp, uint8_t note);
+
+void copySettings(Arpeggiator* dst, const Arpeggiator* src);
+void resetArpeggio(Arpeggiator* arp);
+void buildArpeggioTable(const Arpeggiator* arp, ArpTable* table);
+void buildArpeggioNotes(Arpeggiator* arp);
+void setArpeggioTable(Arpeggiator* arp, const ArpTable* table);
+void updateArpeggioNotes(Arpeggiator* arp);
+uint8_t nextNote(Arpeggiator* arp, uint8_t base_note);
+uint32_t nextStep(Arpeggiator* arp, uint8_t* notes);
+uint32_t stepNotes(const Arpeggiator* arp, uint32_t step, uint8_t* notes);
+void seekStep(Arpeggiator* arp, uint32_t step);
+
+/* Lanes: independent step sequences of up to ARP_LANE_STEPS values,
+   advanced together one step per call. The state is kept in arrays
+   indexed by the lane, so that lanesStep() can work on several lanes at
+   once: 8 when the CPU has AVX2 and 4 with SSE2. lanesStepScalar() does
+   the same one lane at a time, with the same results.
+   Besides the values, each step of a lane draws its skip random number,
+   compares it with the lane's threshold, and works out where its gate
+   ends. A lane can be longer than ARP_LANE_STEPS when only its position
+   is used, like the arpeggio lanes of the plugin's channel engines. */
+#define ARP_MAX_LANES 64
+#define ARP_LANE_STEPS 64
+
+typedef struct {
+    uint32_t         count;  // lanes in use
+    uint32_t         index[ARP_MAX_LANES];  // next step of each lane
+    uint32_t         length[ARP_MAX_LANES]; // at least 1
+    uint32_t         loop[ARP_MAX_LANES];   // where a lane goes after its last step
+    uint32_t         random[ARP_MAX_LANES]; // xorshift32 state, never 0
+    uint32_t         skip[ARP_MAX_LANES];   // silent when random <= skip, 0 = off
+    uint32_t         hits[ARP_MAX_LANES];   // a step is this many hits, at least 1
+    double           gate[ARP_MAX_LANES];   // note length, in hits
+    int32_t          values[ARP_MAX_LANES][ARP_LANE_STEPS];
+} ArpLanes;
+
+/* One step of the lanes that were due */
+typedef struct {
+    int32_t          value[ARP_MAX_LANES];
+    uint32_t         step[ARP_MAX_LANES]; // the position the value is from
+    double           off[ARP_MAX_LANES];  // end of the gate after a hit starts
+    uint64_t         play; // bit per lane, clear when the step is skipped
+} ArpLaneStep;
+
+void lanesInit(ArpLanes* lanes, uint32_t count);
+void lanesReset(ArpLanes* lanes);
+void lanesSeed(ArpLanes* lanes, uint32_t lane, uint32_t seed);
+void lanesSetSkip(ArpLanes* lanes, uint32_t lane, float skip);
+void lanesStep(ArpLanes* lanes, uint64_t due, double step_length, ArpLaneStep* out);
+void lanesStepScalar(ArpLanes* lanes, uint64_t due, double step_length, ArpLaneStep* out);
+
+/* Polymetric patterns: separate lanes for the pitch order, the rhythm, the
+   gate and the velocity. Every lane has its own length and moves on one
+   step per arpeggio step, so lanes of 3, 4 and 5 steps only repeat
+   together after 60 steps, without the combined pattern ever being
+   expanded. Each pattern lane is played by one lane of an ArpLanes. */
+enum lanetype {
+    LANE_PITCH = 0,    // step of the arpeggio to play, -1 to walk on
+    LANE_RHYTHM = 1,   // enum rhythmtype
+    LANE_GATE = 2,     // gate in percent, -1 for the gate control
+    LANE_VELOCITY = 3, // velocity scale in percent
+    ARP_LANE_TYPES
+};
+
+/* Rhythm lane values from 2 to ARP_MAX_RATCHETS play the step as that
+   many hits, a ratchet */
+enum rhythmtype {
+    RHYTHM_TIE = -1,   // no new note, the note before is held on
+    RHYTHM_REST = 0,
+    RHYTHM_PLAY = 1    // as many hits as the ratchet control
+};
+
+#define ARP_MAX_RATCHETS 8
+
+typedef struct {
+    uint32_t         length[ARP_LANE_TYPES]; // 0 when the lane is not used
+    int32_t          values[ARP_LANE_TYPES][ARP_LANE_STEPS];
+} ArpPattern;
+
+/* A pattern for the LV2 state interface, stored as one POD blob. Bump
+   ARP_PATTERN_VERSION whenever the layout changes. */
+#define ARP_PATTERN_MAGIC 0x54415053 // "SPAT"
+#define ARP_PATTERN_VERSION 1
+
+typedef struct {
+    uint32_t         magic;
+    uint32_t         version;
+    ArpPattern       pattern;
+} ArpPatternState;
+
+void patternClear(ArpPattern* pattern);
+bool parsePattern(const char* text, ArpPattern* pattern);
+void savePattern(const ArpPattern* pattern, ArpPatternState* state);
+bool restorePattern(ArpPattern* pattern, const void* data, uint32_t size);
+void patternLanes(const ArpPattern* pattern, ArpLanes* lanes, uint32_t first);
+uint32_t patternTies(const ArpLanes* lanes, uint32_t rhythm_lane);
+
+/* Euclidean rhythms: E(pulses, steps) spreads the pulses as evenly as
+   possible over a cycle of up to 64 steps, kept as a bitmask with bit i
+   for step i. A chance for each step sits on top of the mask, so the
+   pulses and the steps between them can play with their own
+   probabilities. Both are built when the controls change, and playing a
+   step is a bit test and, for the steps in the mask, one random number
+   compared to the step's chance. */
+#define ARP_RHYTHM_STEPS 64
+#define ARP_RHYTHM_ALWAYS UINT32_MAX // a chance that always plays
+
+typedef struct {
+    uint32_t         steps;  // length of the cycle, 0 when the rhythm is off
+    uint64_t         mask;   // steps with a chance to play
+    uint32_t         chance[ARP_RHYTHM_STEPS]; // plays when random <= chance
+} ArpRhythm;
+
+uint64_t euclidMask(uint32_t pulses, uint32_t steps, uint32_t rotate);
+void buildRhythm(ArpRhythm* rhythm, uint32_t pulses, uint32_t steps,
+        uint32_t rotate, float pulse_chance, float fill_chance);
+bool rhythmStep(const ArpRhythm* rhythm, uint32_t* index, uint32_t* random);
+
+/* A preset compiled ahead of time, outside of the audio thread. In
+   MODE_TRANSPOSE the table doesn't depend on the held keys, so applying
+   the preset only points the engine at the compiled table. In the other
+   modes the table is built from the held keys, and applying the preset
+   leaves that to the caller, so that it can be built off the audio
+   thread. */
+typedef struct {
+    enum chordtype   chord;
+    int              range;
+    enum timetype    time;
+    float            gate;
+    int              cycle;
+    float            skip;
+    enum dirtype     dir;
+    enum modetype    mode;
+
+    ArpTable         table;
+} ArpPreset;
+
+void compilePreset(ArpPreset* preset);
+void applyPreset(Arpeggiator* arp, const ArpPreset* preset);
+
+/* The presets of Simple_Apreggiator_presets.lv2, selected with MIDI
+   program changes. Program n is entry n. */
+#define ARP_PRESETS 3
+extern const ArpPreset arp_presets[ARP_PRESETS];
+
+/* A snapshot of the engine for the LV2 state interface, stored as one
+   POD blob. All fields have fixed sizes, so a snapshot is restored by a
+   plain copy after checking the header. Bump ARP_SNAPSHOT_VERSION
+   whenever the layout changes; older snapshots are then rejected and the
+   host's control port values are used instead */
+#define ARP_SNAPSHOT_MAGIC 0x50524153 // "SARP"
+#define ARP_SNAPSHOT_VERSION 3
+
+typedef struct {
+    uint32_t         magic;
+    uint32_t         version;
+    uint32_t         size;  // sizeof(ArpSnapshot)
+    // parameters
+    int32_t          chord;
+    uint32_t         user_chord;
+    int32_t          range;
+    int32_t          time;
+    float            gate;
+    int32_t          cycle;
+    float            skip;
+    int32_t          dir;
+    int32_t          mode;
+    uint32_t         seed;
+    // playback state
+    uint32_t         note_index;
+    uint32_t         random_state;
+    uint32_t         arpeggio_length;
+    uint32_t         step_size;
+    uint32_t         steps;
+    uint32_t         loop_step;
+    uint8_t          arpeggio_notes[ARP_MAX_NOTES];
+    uint8_t          step_flags[ARP_MAX_NOTES];
+} ArpSnapshot;
+
+void saveSnapshot(const Arpeggiator* arp, ArpSnapshot* snapshot);
+void saveSnapshotState(const Arpeggiator* arp, uint32_t note_index,
+        uint32_t random_state, ArpSnapshot* snapshot);
+bool restoreSnapshot(Arpeggiator* arp, const void* data, uint32_t size);
+
+/* Groove templates: a start offset and a velocity scale for each step of
+   a 16 step cycle. Offsets are fractions of a step, so a template works
+   at any note length and tempo. */
+#define ARP_GROOVE_STEPS 16
+#define ARP_GROOVE_MAX_OFFSET 0.45 // keeps the steps in order
+
+enum groovetype {
+    GROOVE_NONE = 0,
+    GROOVE_SHUFFLE = 1,
+    GROOVE_LAID_BACK = 2,
+    GROOVE_PUSH = 3,
+    GROOVE_USER = 4,   // loaded from a file
+    GROOVE_ERROR
+};
+
+typedef struct {
+    float            offset[ARP_GROOVE_STEPS];   // -0.45 to 0.45 of a step
+    float            velocity[ARP_GROOVE_STEPS]; // 0 to 1
+} ArpGroove;
+
+extern const ArpGroove arp_grooves[GROOVE_USER];
+
+void grooveClear(ArpGroove* groove);
+bool parseGroove(const char* text, ArpGroove* groove);
+void grooveLimit(ArpGroove* groove);
+void grooveOffsets(const ArpGroove* groove, float swing, float* offsets);
+
+/* Output velocities. The curve, the groove's velocity scale and the
+   accents are folded into one 128 entry table for each step of the
+   cycle, rebuilt when one of them changes, so playing a note is a single
+   lookup: map->step[step % ARP_GROOVE_STEPS][input velocity]. */
+enum velocitycurve {
+    VELOCITY_LINEAR = 0, // the key velocity as it is
+    VELOCITY_SOFT = 1,   // louder at low velocities
+    VELOCITY_HARD = 2,   // quieter at low velocities
+    VELOCITY_FIXED = 3,  // always full velocity
+    VELOCITY_ERROR
+};
+
+enum accenttype {
+    ACCENT_NONE = 0,
+    ACCENT_DOWNBEATS = 1, // every 4th step
+    ACCENT_OFFBEATS = 2,  // between the downbeats
+    ACCENT_ALTERNATE = 3, // every 2nd step
+    ACCENT_3_3_2 = 4,     // steps 1, 4 and 7 of each 8
+    ACCENT_ERROR
+};
+
+extern const uint16_t arp_accents[ACCENT_ERROR]; // one bit per accented step
+
+typedef struct {
+    uint8_t          step[ARP_GROOVE_STEPS][128];
+} ArpVelocityMap;
+
+void buildVelocityMap(ArpVelocityMap* map, enum velocitycurve curve,
+        enum accenttype accent, float accent_level, const ArpGroove* groove);
+
+/* Snaps notes to a scale in a key (0 = C to 11 = B): map[note] is the
+   nearest note of the scale, the lower one when two are as near */
+void buildScaleMap(uint8_t* map, int key, uint16_t scale);
+
+float note_as_fraction_of_bar(Arpeggiator* arp, int beat_unit, int beats_per_bar);
+double note_as_beats(Arpeggiator* arp, int beat_unit);
+
+/* Scheduled note offs, a binary min-heap ordered by frame so that only
+   the offs that are due have to be looked at. The same heap holds the
+   note ons of ratchets and strums that are still to come, which also
+   know their velocity and how long they play. There is room for every
+   hit of a step of 128 notes, and for those of the step before it. */
+#define ARP_MAX_NOTE_OFFS (2 * 128 * ARP_MAX_RATCHETS)
+
+typedef struct {
+    uint64_t         frame;
+    uint32_t         length;   // note ons: frames until the note off
+    uint8_t          note;
+    uint8_t          channel;  // MIDI channel, 0 - 15
+    uint8_t          velocity; // note ons only
+} NoteOff;
+
+typedef struct {
+    uint32_t         count;
+    NoteOff          items[ARP_MAX_NOTE_OFFS];
+} NoteOffQueue;
+
+void noteOffClear(NoteOffQueue* queue);
+bool noteOffPush(NoteOffQueue* queue, uint64_t frame, uint8_t note, uint8_t channel);
+bool noteOnPush(NoteOffQueue* queue, uint64_t frame, uint8_t note, uint8_t channel,
+        uint8_t velocity, uint32_t length);
+const NoteOff* noteOffPeek(const NoteOffQueue* queue);
+NoteOff noteOffPop(NoteOffQueue* queue);
 
-int setChord(enum chordtype chord);
-int setRange(int range);
-int setTime(enum timetype time);
-int setGate(float gate);
-int setCycle(int range);
-int setSkip(float gate);
-int setDir(enum dirtype time);
+/* Timing core. Positions are kept in the beat domain and always derived
+   from the last anchor (a frame with a known beat position), so rounding
+   errors never accumulate between host position updates. */
+typedef struct {
+    bool             rolling;         // transport running
+    double           frames_per_beat;
+    double           anchor_beat;     // beat position at anchor_frame
+    uint64_t         anchor_frame;
+    double           step_beats;      // arpeggio step length in beats
+    int64_t          next_step;       // index of the next step to play
+} ArpClock;
 
+void clockInit(ArpClock* clk, double rate, double bpm);
+double clockBeatAt(const ArpClock* clk, uint64_t frame);
+uint64_t clockFrameAt(const ArpClock* clk, double beat);
+uint64_t clockStepFrame(const ArpClock* clk, int64_t step);
+int64_t clockFirstStep(const ArpClock* clk, uint64_t frame);
+void clockSetTempo(ArpClock* clk, double rate, double bpm, uint64_t frame);
+void clockSetRolling(ArpClock* clk, bool rolling, uint64_t frame);
+void clockSetStep(ArpClock* clk, double step_beats, uint64_t frame);
+bool clockLocate(ArpClock* clk, double beat, uint64_t frame);
 
-void resetArpeggio();
-void updateArpeggioNotes();
-uint8_t nextNote(uint8_t base_note);
+/* MIDI clock input. The 24 ticks per quarter note arrive with the jitter
+   of the sending device and the host's MIDI timestamps, so the tick frames
+   are tracked with a second order phase-locked loop: tick_frame follows
+   the ticks, and frames_per_tick the tempo. Positions between ticks are
+   interpolated from the filtered estimate. */
+#define ARP_MIDI_PPQN 24
 
-float note_as_fraction_of_bar(int beat_unit, int beats_per_bar);
+typedef struct {
+    double           frames_per_tick; // tempo estimate
+    double           tick_frame;      // filtered frame of the last tick
+    uint64_t         last_frame;      // unfiltered frame of the last tick
+    int64_t          tick;            // ticks since the song start
+    uint32_t         ticks_seen;      // since the loop was last (re)started
+    uint32_t         outliers;        // ticks in a row far from the estimate
+    bool             running;         // between start/continue and stop
+} ArpMidiClock;
 
+void midiClockInit(ArpMidiClock* mc, double rate, double bpm);
+void midiClockStart(ArpMidiClock* mc);
+void midiClockContinue(ArpMidiClock* mc);
+void midiClockStop(ArpMidiClock* mc);
+void midiClockSongPosition(ArpMidiClock* mc, uint32_t sixteenths);
+void midiClockTick(ArpMidiClock* mc, uint64_t frame);
+double midiClockBeatAt(const ArpMidiClock* mc, uint64_t frame);
+double midiClockBpm(const ArpMidiClock* mc, double rate);
 
+#endif
@@ -0,0 +1,153 @@
+/*
+   SimpleArpeggiator LV2 Plugin
+   Copyright 2017 Johan Berntsson
+
+   Permission to use, copy, modify, and/or distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+
+   THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+   */
+
+/* Offline throughput benchmark for the plugin's run() callback.
+
+   Every configuration renders the same synthetic session: a rolling
+   transport with a position update at the start of each block (as most
+   hosts send it), and a three note chord that changes every half second.
+   The result is printed as CSV on stdout:
+
+   block_size,sample_rate,time,instances,blocks,ns_per_block,events,events_per_sec
+
+   ns_per_block is the mean cost of one run() call of one instance, and
+   events_per_sec the number of MIDI events emitted per second of wall
+   clock time */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lv2/lv2plug.in/ns/ext/atom/util.h"
+
+#include "arpeggiator.h"
+#include "simplearpeggiator.h"
+#include "minihost.h"
+
+#define MAX_INSTANCES 64
+
+static const uint32_t block_sizes[] = { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+static const double sample_rates[] = { 44100, 48000, 96000 };
+static const enum timetype times[] = { NOTE_1_4, NOTE_1_8, NOTE_1_16, NOTE_1_32 };
+static const char* time_names[] = { "1/1", "1/2", "1/4", "1/8", "1/16", "1/32" };
+static const uint32_t instance_counts[] = { 1, 8, 64 };
+
+static const uint8_t chords[4][3] = {
+    { 60, 64, 67 }, { 57, 60, 64 }, { 53, 57, 60 }, { 55, 59, 62 }
+};
+
+#define N_ELEMENTS(a) (sizeof(a) / sizeof((a)[0]))
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void add_input(MiniHost* host, uint64_t position, uint32_t block_size,
+        double rate, float bpm) {
+    const uint64_t chord_frames = (uint64_t) (rate / 2);
+    double beat = position * bpm / (60.0 * rate);
+    int64_t bar = (int64_t) (beat / 4);
+
+    minihost_add_position(host, 0, bpm, 1, bar, beat - bar * 4, 4, 4);
+
+    // change the chord when a half second boundary falls into this block
+    uint64_t change = (position + chord_frames - 1) / chord_frames * chord_frames;
+    if(change < position + block_size) {
+        uint32_t frame = (uint32_t) (change - position);
+        uint64_t n = change / chord_frames;
+        if(n > 0) {
+            const uint8_t* old = chords[(n - 1) % 4];
+            for(int i = 0; i < 3; i++) minihost_add_midi(host, frame, 0x80, old[i], 0);
+        }
+        const uint8_t* new = chords[n % 4];
+        for(int i = 0; i < 3; i++) minihost_add_midi(host, frame, 0x90, new[i], 100);
+    }
+}
+
+static uint32_t count_events(const MiniHost* host) {
+    uint32_t count = 0;
+    LV2_ATOM_SEQUENCE_FOREACH(minihost_output(host), ev) {
+        ++count;
+    }
+    return count;
+}
+
+static int bench(const char* plugin, uint32_t block_size, double rate,
+        enum timetype time, uint32_t n_instances, double seconds) {
+    MiniHost* hosts[MAX_INSTANCES];
+    const float bpm = 120;
+    const uint64_t blocks = (uint64_t) (seconds * rate / block_size);
+    uint64_t events = 0;
+    double elapsed = 0;
+
+    for(uint32_t i = 0; i < n_instances; i++) {
+        hosts[i] = minihost_new(plugin, rate);
+        if(!hosts[i]) return 1;
+        minihost_set_quiet(hosts[i], 1);
+        minihost_set_control(hosts[i], SIMPLEARPEGGIATOR_TIME, time);
+        minihost_set_control(hosts[i], SIMPLEARPEGGIATOR_MODE, MODE_SORTED);
+    }
+
+    for(uint64_t b = 0; b < blocks; b++) {
+        uint64_t position = b * block_size;
+        // only run() is timed, not building the input
+        for(uint32_t i = 0; i < n_instances; i++) {
+            add_input(hosts[i], position, block_size, rate, bpm);
+        }
+        double start = now_ns();
+        for(uint32_t i = 0; i < n_instances; i++) {
+            minihost_run(hosts[i], block_size);
+        }
+        elapsed += now_ns() - start;
+        for(uint32_t i = 0; i < n_instances; i++) {
+            events += count_events(hosts[i]);
+        }
+    }
+
+    printf("%u,%.0f,%s,%u,%llu,%.1f,%llu,%.0f\n",
+            block_size, rate, time_names[time], n_instances,
+            (unsigned long long) blocks,
+            elapsed / (blocks * n_instances),
+            (unsigned long long) events,
+            events / (elapsed * 1e-9));
+    fflush(stdout);
+
+    for(uint32_t i = 0; i < n_instances; i++) minihost_free(hosts[i]);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char* plugin = argc > 1 ? argv[1] : "./simplearpeggiator.so";
+    double seconds = argc > 2 ? atof(argv[2]) : 10;
+
+    printf("block_size,sample_rate,time,instances,blocks,ns_per_block,events,events_per_sec\n");
+    for(size_t r = 0; r < N_ELEMENTS(sample_rates); r++) {
+        for(size_t t = 0; t < N_ELEMENTS(times); t++) {
+            for(size_t n = 0; n < N_ELEMENTS(instance_counts); n++) {
+                for(size_t b = 0; b < N_ELEMENTS(block_sizes); b++) {
+                    if(bench(plugin, block_sizes[b], sample_rates[r],
+                                times[t], instance_counts[n], seconds)) {
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
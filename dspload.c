@@ -0,0 +1,65 @@
+/*
+   SimpleArpeggiator LV2 Plugin
+   Copyright 2017 Johan Berntsson
+
+   Permission to use, copy, modify, and/or distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+
+   THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+   */
+
+#include <string.h>
+#include <time.h>
+
+#include "dspload.h"
+
+void dspload_clear(DSPLoad* load) {
+    memset(load, 0, sizeof(DSPLoad));
+}
+
+void dspload_clear_window(DSPLoad* load) {
+    load->window_calls = 0;
+    load->window_frames = 0;
+    load->window_ns = 0;
+    load->window_max_ns = 0;
+}
+
+/* Monotonic time in ns. clock_gettime is served by the vDSO on Linux,
+   so it doesn't enter the kernel and is safe in the audio thread */
+uint64_t dspload_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint32_t dspload_bucket(uint64_t ns) {
+    if(ns < (1ull << DSPLOAD_MIN_SHIFT)) return 0;
+    uint32_t bucket = 63 - __builtin_clzll(ns) - DSPLOAD_MIN_SHIFT + 1;
+    return bucket < DSPLOAD_BUCKETS ? bucket : DSPLOAD_BUCKETS - 1;
+}
+
+void dspload_record(DSPLoad* load, uint64_t ns, uint32_t frames,
+        uint32_t events, uint32_t overflows) {
+    ++load->calls;
+    load->events += events;
+    load->overflows += overflows;
+    ++load->histogram[dspload_bucket(ns)];
+
+    ++load->window_calls;
+    load->window_frames += frames;
+    load->window_ns += ns;
+    if(ns > load->window_max_ns) load->window_max_ns = ns;
+}
+
+/* Time spent in run() as a fraction of the audio time processed */
+double dspload_ratio(const DSPLoad* load, double rate) {
+    if(load->window_frames == 0) return 0;
+    return load->window_ns * 1e-9 * rate / load->window_frames;
+}
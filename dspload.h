@@ -0,0 +1,55 @@
+/*
+   SimpleArpeggiator LV2 Plugin
+   Copyright 2017 Johan Berntsson
+
+   Permission to use, copy, modify, and/or distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+
+   THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+   */
+
+#ifndef DSPLOAD_H
+#define DSPLOAD_H
+
+#include <stdint.h>
+
+/* Per-instance measurements of the time spent in run(). Counters are
+   kept since activate(), while the mean and maximum call time and the
+   DSP load are over the current reporting window only.
+
+   The histogram has fixed log2 buckets: bucket 0 counts calls shorter
+   than 512 ns, bucket i calls of 2^(i+8) to 2^(i+9) ns, and the last
+   bucket everything slower */
+
+#define DSPLOAD_BUCKETS 16
+#define DSPLOAD_MIN_SHIFT 9 // log2 of the upper limit of bucket 0
+
+typedef struct {
+    // since activate()
+    uint64_t calls;
+    uint64_t events;    // MIDI events written to the output
+    uint64_t overflows; // events lost because the output buffer was full
+    uint32_t histogram[DSPLOAD_BUCKETS];
+    // current window
+    uint64_t window_calls;
+    uint64_t window_frames;
+    uint64_t window_ns;
+    uint64_t window_max_ns;
+} DSPLoad;
+
+void dspload_clear(DSPLoad* load);
+void dspload_clear_window(DSPLoad* load);
+uint64_t dspload_now(void);
+uint32_t dspload_bucket(uint64_t ns);
+void dspload_record(DSPLoad* load, uint64_t ns, uint32_t frames,
+        uint32_t events, uint32_t overflows);
+double dspload_ratio(const DSPLoad* load, double rate);
+
+#endif
@@ -0,0 +1,431 @@
+/*
+   SimpleArpeggiator LV2 Plugin
+   Copyright 2017 Johan Berntsson
+
+   Permission to use, copy, modify, and/or distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+
+   THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+   */
+
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+#include "lv2/lv2plug.in/ns/ext/atom/forge.h"
+#include "lv2/lv2plug.in/ns/ext/atom/util.h"
+#include "lv2/lv2plug.in/ns/ext/time/time.h"
+#include "lv2/lv2plug.in/ns/ext/midi/midi.h"
+#include "lv2/lv2plug.in/ns/ext/patch/patch.h"
+#include "lv2/lv2plug.in/ns/ext/log/log.h"
+#include "lv2/lv2plug.in/ns/ext/worker/worker.h"
+#include "lv2/lv2plug.in/ns/ext/state/state.h"
+
+#include "simplearpeggiator.h"
+#include "minihost.h"
+
+#define MINIHOST_BUFFER_SIZE 65536
+#define MINIHOST_MAX_URIS 256
+#define MINIHOST_MAX_WORK 64
+#define MINIHOST_MAX_WORK_SIZE 2048
+#define MINIHOST_MAX_STATE 16
+
+/* Control port defaults, as in simplearpeggiator.ttl */
+static const float control_defaults[SIMPLEARPEGGIATOR_N_PORTS] = {
+    [SIMPLEARPEGGIATOR_CHORD] = 0,
+    [SIMPLEARPEGGIATOR_RANGE] = 2,
+    [SIMPLEARPEGGIATOR_TIME]  = 3,
+    [SIMPLEARPEGGIATOR_GATE]  = 100,
+    [SIMPLEARPEGGIATOR_CYCLE] = 0,
+    [SIMPLEARPEGGIATOR_SKIP]  = 0,
+    [SIMPLEARPEGGIATOR_DIR]   = 0,
+    [SIMPLEARPEGGIATOR_SEED]  = 0,
+    [SIMPLEARPEGGIATOR_MODE]  = 0,
+    [SIMPLEARPEGGIATOR_SYNC]  = 0,
+    [SIMPLEARPEGGIATOR_TEMPO] = 120,
+    [SIMPLEARPEGGIATOR_SWING] = 0,
+    [SIMPLEARPEGGIATOR_GROOVE] = 0,
+    [SIMPLEARPEGGIATOR_VELOCITY] = 0,
+    [SIMPLEARPEGGIATOR_ACCENT] = 0,
+    [SIMPLEARPEGGIATOR_ACCENT_LEVEL] = 50,
+    [SIMPLEARPEGGIATOR_KEY] = 0,
+    [SIMPLEARPEGGIATOR_SCALE] = 0,
+    [SIMPLEARPEGGIATOR_USER_CHORD] = 145,
+    [SIMPLEARPEGGIATOR_USER_SCALE] = 2741,
+    [SIMPLEARPEGGIATOR_CHANNELS] = 0,
+    [SIMPLEARPEGGIATOR_POLYMETER] = 1,
+    [SIMPLEARPEGGIATOR_EUCLID_STEPS] = 0,
+    [SIMPLEARPEGGIATOR_EUCLID_PULSES] = 5,
+    [SIMPLEARPEGGIATOR_EUCLID_ROTATE] = 0,
+    [SIMPLEARPEGGIATOR_PULSE_CHANCE] = 100,
+    [SIMPLEARPEGGIATOR_FILL_CHANCE] = 0,
+    [SIMPLEARPEGGIATOR_RATCHET] = 1,
+    [SIMPLEARPEGGIATOR_STRUM] = 0,
+};
+
+typedef struct {
+    uint32_t size;
+    uint32_t blocks; // responses: blocks left before it is delivered
+    uint8_t  data[MINIHOST_MAX_WORK_SIZE];
+} WorkItem;
+
+typedef struct {
+    uint32_t count;
+    WorkItem items[MINIHOST_MAX_WORK];
+} WorkQueue;
+
+/* The saved values of a plugin state, in memory */
+typedef struct {
+    uint32_t key;
+    uint32_t type;
+    uint32_t flags;
+    size_t   size;
+    void*    value;
+} StateItem;
+
+struct MiniHostState {
+    uint32_t  count;
+    StateItem items[MINIHOST_MAX_STATE];
+};
+
+struct MiniHost {
+    void*                        library;
+    const LV2_Descriptor*        descriptor;
+    LV2_Handle                   instance;
+    const LV2_Worker_Interface*  worker;
+    const LV2_State_Interface*   state;
+    int                          quiet;
+    uint32_t                     work_delay; // in blocks
+
+    // features
+    LV2_URID_Map                 map;
+    LV2_Log_Log                  log;
+    LV2_Worker_Schedule          schedule;
+
+    WorkQueue                    work;      // scheduled by run()
+    WorkQueue                    responses; // from work()
+
+    LV2_Atom_Forge               forge;
+    LV2_Atom_Forge_Frame         in_frame;
+    float                        controls[SIMPLEARPEGGIATOR_N_PORTS];
+    // atom buffers are 64-bit aligned
+    uint64_t                     in_buffer[MINIHOST_BUFFER_SIZE / 8];
+    uint64_t                     out_buffer[MINIHOST_BUFFER_SIZE / 8];
+    uint64_t                     notify_buffer[MINIHOST_BUFFER_SIZE / 8];
+};
+
+/* One URI table for the whole process, so that instances agree */
+static char*    uris[MINIHOST_MAX_URIS];
+static uint32_t n_uris = 0;
+
+static LV2_URID map_uri(LV2_URID_Map_Handle handle, const char* uri) {
+    for(uint32_t i = 0; i < n_uris; i++) {
+        if(!strcmp(uris[i], uri)) return i + 1;
+    }
+    if(n_uris == MINIHOST_MAX_URIS) return 0;
+    uris[n_uris] = strdup(uri);
+    return ++n_uris;
+}
+
+static int log_vprintf(LV2_Log_Handle handle, LV2_URID type,
+        const char* fmt, va_list ap) {
+    MiniHost* host = (MiniHost*) handle;
+    if(host->quiet) return 0;
+    return vfprintf(stderr, fmt, ap);
+}
+
+static int log_printf(LV2_Log_Handle handle, LV2_URID type,
+        const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = log_vprintf(handle, type, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+static LV2_Worker_Status queue_work(WorkQueue* queue, uint32_t size,
+        const void* data) {
+    if(queue->count == MINIHOST_MAX_WORK || size > MINIHOST_MAX_WORK_SIZE) {
+        return LV2_WORKER_ERR_NO_SPACE;
+    }
+    queue->items[queue->count].size = size;
+    queue->items[queue->count].blocks = 0;
+    memcpy(queue->items[queue->count].data, data, size);
+    ++queue->count;
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status schedule_work(LV2_Worker_Schedule_Handle handle,
+        uint32_t size, const void* data) {
+    return queue_work(&((MiniHost*) handle)->work, size, data);
+}
+
+static LV2_Worker_Status respond(LV2_Worker_Respond_Handle handle,
+        uint32_t size, const void* data) {
+    MiniHost* host = (MiniHost*) handle;
+    LV2_Worker_Status status = queue_work(&host->responses, size, data);
+    if(status == LV2_WORKER_SUCCESS) {
+        host->responses.items[host->responses.count - 1].blocks = host->work_delay;
+    }
+    return status;
+}
+
+static LV2_State_Status store_value(LV2_State_Handle handle, uint32_t key,
+        const void* value, size_t size, uint32_t type, uint32_t flags) {
+    MiniHostState* state = (MiniHostState*) handle;
+    if(state->count == MINIHOST_MAX_STATE) return LV2_STATE_ERR_NO_SPACE;
+    StateItem* item = &state->items[state->count];
+    item->value = malloc(size);
+    if(!item->value) return LV2_STATE_ERR_NO_SPACE;
+    memcpy(item->value, value, size);
+    item->key = key;
+    item->type = type;
+    item->flags = flags;
+    item->size = size;
+    ++state->count;
+    return LV2_STATE_SUCCESS;
+}
+
+static const void* retrieve_value(LV2_State_Handle handle, uint32_t key,
+        size_t* size, uint32_t* type, uint32_t* flags) {
+    const MiniHostState* state = (const MiniHostState*) handle;
+    for(uint32_t i = 0; i < state->count; i++) {
+        const StateItem* item = &state->items[i];
+        if(item->key != key) continue;
+        *size = item->size;
+        *type = item->type;
+        *flags = item->flags;
+        return item->value;
+    }
+    return NULL;
+}
+
+MiniHost* minihost_new(const char* plugin_path, double rate) {
+    MiniHost* host = (MiniHost*) calloc(1, sizeof(MiniHost));
+    if(!host) return NULL;
+
+    host->library = dlopen(plugin_path, RTLD_NOW | RTLD_LOCAL);
+    if(!host->library) {
+        fprintf(stderr, "%s\n", dlerror());
+        free(host);
+        return NULL;
+    }
+    LV2_Descriptor_Function get_descriptor = (LV2_Descriptor_Function)
+        dlsym(host->library, "lv2_descriptor");
+    host->descriptor = get_descriptor ? get_descriptor(0) : NULL;
+    if(!host->descriptor ||
+            strcmp(host->descriptor->URI, SIMPLEARPEGGIATOR_URI)) {
+        fprintf(stderr, "%s is not the arpeggiator plugin\n", plugin_path);
+        dlclose(host->library);
+        free(host);
+        return NULL;
+    }
+
+    host->map.handle = host;
+    host->map.map = map_uri;
+    host->log.handle = host;
+    host->log.printf = log_printf;
+    host->log.vprintf = log_vprintf;
+    host->schedule.handle = host;
+    host->schedule.schedule_work = schedule_work;
+    const LV2_Feature map_feature = { LV2_URID__map, &host->map };
+    const LV2_Feature log_feature = { LV2_LOG__log, &host->log };
+    const LV2_Feature schedule_feature = { LV2_WORKER__schedule, &host->schedule };
+    const LV2_Feature* features[] = {
+        &map_feature, &log_feature, &schedule_feature, NULL
+    };
+
+    host->instance = host->descriptor->instantiate(
+            host->descriptor, rate, "", features);
+    if(!host->instance) {
+        dlclose(host->library);
+        free(host);
+        return NULL;
+    }
+    if(host->descriptor->extension_data) {
+        host->worker = (const LV2_Worker_Interface*)
+            host->descriptor->extension_data(LV2_WORKER__interface);
+        host->state = (const LV2_State_Interface*)
+            host->descriptor->extension_data(LV2_STATE__interface);
+    }
+
+    lv2_atom_forge_init(&host->forge, &host->map);
+    memcpy(host->controls, control_defaults, sizeof(host->controls));
+    host->descriptor->connect_port(host->instance,
+            SIMPLEARPEGGIATOR_IN, host->in_buffer);
+    host->descriptor->connect_port(host->instance,
+            SIMPLEARPEGGIATOR_OUT, host->out_buffer);
+    host->descriptor->connect_port(host->instance,
+            SIMPLEARPEGGIATOR_NOTIFY, host->notify_buffer);
+    for(uint32_t port = 0; port < SIMPLEARPEGGIATOR_N_PORTS; port++) {
+        if(port == SIMPLEARPEGGIATOR_IN || port == SIMPLEARPEGGIATOR_OUT ||
+                port == SIMPLEARPEGGIATOR_NOTIFY) continue;
+        host->descriptor->connect_port(host->instance, port, &host->controls[port]);
+    }
+    host->descriptor->activate(host->instance);
+    minihost_begin_block(host);
+    return host;
+}
+
+void minihost_free(MiniHost* host) {
+    if(!host) return;
+    if(host->descriptor->deactivate) host->descriptor->deactivate(host->instance);
+    host->descriptor->cleanup(host->instance);
+    dlclose(host->library);
+    free(host);
+}
+
+void minihost_set_control(MiniHost* host, uint32_t port, float value) {
+    if(port < SIMPLEARPEGGIATOR_N_PORTS) host->controls[port] = value;
+}
+
+void minihost_set_quiet(MiniHost* host, int quiet) {
+    host->quiet = quiet;
+}
+
+void minihost_set_work_delay(MiniHost* host, uint32_t blocks) {
+    host->work_delay = blocks;
+}
+
+void minihost_begin_block(MiniHost* host) {
+    lv2_atom_forge_set_buffer(&host->forge,
+            (uint8_t*) host->in_buffer, sizeof(host->in_buffer));
+    lv2_atom_forge_sequence_head(&host->forge, &host->in_frame, 0);
+}
+
+void minihost_add_position(MiniHost* host, uint32_t frame, float bpm,
+        float speed, int64_t bar, float bar_beat,
+        float beats_per_bar, int32_t beat_unit) {
+    LV2_Atom_Forge* forge = &host->forge;
+    LV2_URID_Map* map = &host->map;
+    LV2_Atom_Forge_Frame frame_object;
+
+    lv2_atom_forge_frame_time(forge, frame);
+    lv2_atom_forge_object(forge, &frame_object, 0,
+            map->map(map->handle, LV2_TIME__Position));
+    lv2_atom_forge_key(forge, map->map(map->handle, LV2_TIME__speed));
+    lv2_atom_forge_float(forge, speed);
+    lv2_atom_forge_key(forge, map->map(map->handle, LV2_TIME__beatsPerMinute));
+    lv2_atom_forge_float(forge, bpm);
+    lv2_atom_forge_key(forge, map->map(map->handle, LV2_TIME__beatsPerBar));
+    lv2_atom_forge_float(forge, beats_per_bar);
+    lv2_atom_forge_key(forge, map->map(map->handle, LV2_TIME__beatUnit));
+    lv2_atom_forge_int(forge, beat_unit);
+    lv2_atom_forge_key(forge, map->map(map->handle, LV2_TIME__bar));
+    lv2_atom_forge_long(forge, bar);
+    lv2_atom_forge_key(forge, map->map(map->handle, LV2_TIME__barBeat));
+    lv2_atom_forge_float(forge, bar_beat);
+    lv2_atom_forge_pop(forge, &frame_object);
+}
+
+void minihost_add_midi(MiniHost* host, uint32_t frame,
+        uint8_t status, uint8_t data1, uint8_t data2) {
+    LV2_Atom_Forge* forge = &host->forge;
+    const uint8_t msg[3] = { status, data1, data2 };
+    uint32_t size = 3;
+    if((status & 0xE0) == 0xC0) size = 2; // program change, channel pressure
+    if(status >= 0xF8) size = 1; // real-time messages have no data
+
+    lv2_atom_forge_frame_time(forge, frame);
+    lv2_atom_forge_atom(forge, size,
+            host->map.map(host->map.handle, LV2_MIDI__MidiEvent));
+    lv2_atom_forge_write(forge, msg, size);
+}
+
+void minihost_add_path(MiniHost* host, uint32_t frame,
+        const char* property, const char* path) {
+    LV2_Atom_Forge* forge = &host->forge;
+    LV2_URID_Map* map = &host->map;
+    LV2_Atom_Forge_Frame frame_object;
+
+    lv2_atom_forge_frame_time(forge, frame);
+    lv2_atom_forge_object(forge, &frame_object, 0,
+            map->map(map->handle, LV2_PATCH__Set));
+    lv2_atom_forge_key(forge, map->map(map->handle, LV2_PATCH__property));
+    lv2_atom_forge_urid(forge, map->map(map->handle, property));
+    lv2_atom_forge_key(forge, map->map(map->handle, LV2_PATCH__value));
+    lv2_atom_forge_path(forge, path, strlen(path));
+    lv2_atom_forge_pop(forge, &frame_object);
+}
+
+void minihost_run(MiniHost* host, uint32_t n_frames) {
+    LV2_Atom_Sequence* out = (LV2_Atom_Sequence*) host->out_buffer;
+    LV2_Atom_Sequence* notify = (LV2_Atom_Sequence*) host->notify_buffer;
+    lv2_atom_forge_pop(&host->forge, &host->in_frame);
+    out->atom.type = 0;
+    out->atom.size = sizeof(host->out_buffer) - sizeof(LV2_Atom);
+    notify->atom.type = 0;
+    notify->atom.size = sizeof(host->notify_buffer) - sizeof(LV2_Atom);
+
+    host->descriptor->run(host->instance, n_frames);
+
+    // a real host runs the worker in another thread, here it is simply
+    // done between two blocks. The responses can be held back for a few
+    // blocks, like from a busy worker thread.
+    if(host->worker) {
+        for(uint32_t i = 0; i < host->work.count; i++) {
+            host->worker->work(host->instance, respond, host,
+                    host->work.items[i].size, host->work.items[i].data);
+        }
+        uint32_t due = 0;
+        while(due < host->responses.count && host->responses.items[due].blocks == 0) {
+            host->worker->work_response(host->instance,
+                    host->responses.items[due].size, host->responses.items[due].data);
+            ++due;
+        }
+        if(host->worker->end_run) host->worker->end_run(host->instance);
+        // the rest are delivered in order, after the later blocks
+        host->responses.count -= due;
+        memmove(host->responses.items, host->responses.items + due,
+                host->responses.count * sizeof(WorkItem));
+        for(uint32_t i = 0; i < host->responses.count; i++) {
+            if(host->responses.items[i].blocks) --host->responses.items[i].blocks;
+        }
+    } else {
+        host->responses.count = 0;
+    }
+    host->work.count = 0;
+    minihost_begin_block(host);
+}
+
+const LV2_Atom_Sequence* minihost_output(const MiniHost* host) {
+    return (const LV2_Atom_Sequence*) host->out_buffer;
+}
+
+const LV2_Atom_Sequence* minihost_notify(const MiniHost* host) {
+    return (const LV2_Atom_Sequence*) host->notify_buffer;
+}
+
+MiniHostState* minihost_save_state(MiniHost* host) {
+    if(!host->state) return NULL;
+    MiniHostState* state = (MiniHostState*) calloc(1, sizeof(MiniHostState));
+    if(!state) return NULL;
+    if(host->state->save(host->instance, store_value, state,
+                LV2_STATE_IS_POD, NULL) != LV2_STATE_SUCCESS) {
+        minihost_free_state(state);
+        return NULL;
+    }
+    return state;
+}
+
+int minihost_restore_state(MiniHost* host, const MiniHostState* state) {
+    if(!host->state) return -1;
+    return host->state->restore(host->instance, retrieve_value,
+            (LV2_State_Handle) state, 0, NULL) == LV2_STATE_SUCCESS ? 0 : -1;
+}
+
+void minihost_free_state(MiniHostState* state) {
+    if(!state) return;
+    for(uint32_t i = 0; i < state->count; i++) free(state->items[i].value);
+    free(state);
+}
@@ -0,0 +1,63 @@
+/*
+   SimpleArpeggiator LV2 Plugin
+   Copyright 2017 Johan Berntsson
+
+   Permission to use, copy, modify, and/or distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+
+   THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+   */
+
+#ifndef MINIHOST_H
+#define MINIHOST_H
+
+#include <stdint.h>
+
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+
+/* A minimal in-process LV2 host for offline rendering, tests and
+   benchmarks. It loads the plugin binary, provides urid:map, log:log and
+   work:schedule, runs the worker synchronously after each run(), and
+   can save and restore the plugin state */
+
+typedef struct MiniHost MiniHost;
+
+MiniHost* minihost_new(const char* plugin_path, double rate);
+void minihost_free(MiniHost* host);
+
+void minihost_set_control(MiniHost* host, uint32_t port, float value);
+void minihost_set_quiet(MiniHost* host, int quiet); // drop plugin log output
+// hold the worker responses back until after this many more blocks
+void minihost_set_work_delay(MiniHost* host, uint32_t blocks);
+
+/* Input for the next block. Events must be added in frame order */
+void minihost_begin_block(MiniHost* host);
+void minihost_add_position(MiniHost* host, uint32_t frame, float bpm,
+        float speed, int64_t bar, float bar_beat,
+        float beats_per_bar, int32_t beat_unit);
+void minihost_add_midi(MiniHost* host, uint32_t frame,
+        uint8_t status, uint8_t data1, uint8_t data2);
+// patch:Set of a path parameter, like a groove or pattern file
+void minihost_add_path(MiniHost* host, uint32_t frame,
+        const char* property, const char* path);
+
+void minihost_run(MiniHost* host, uint32_t n_frames);
+const LV2_Atom_Sequence* minihost_output(const MiniHost* host);
+const LV2_Atom_Sequence* minihost_notify(const MiniHost* host);
+
+/* The plugin state, saved in memory between two blocks, can be restored
+   into another instance */
+typedef struct MiniHostState MiniHostState;
+
+MiniHostState* minihost_save_state(MiniHost* host);
+int minihost_restore_state(MiniHost* host, const MiniHostState* state);
+void minihost_free_state(MiniHostState* state);
+
+#endif
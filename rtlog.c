@@ -0,0 +1,62 @@
+/*
+   SimpleArpeggiator LV2 Plugin
+   Copyright 2017 Johan Berntsson
+
+   Permission to use, copy, modify, and/or distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+
+   THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+   */
+
+#include "rtlog.h"
+
+void rtlog_init(RTLog* log) {
+    atomic_init(&log->write_index, 0);
+    atomic_init(&log->read_index, 0);
+    atomic_init(&log->dropped, 0);
+}
+
+/* Called from the audio thread only. Never blocks, returns false if
+   the record was dropped because the ring was full */
+bool rtlog_push(RTLog* log, enum rtloglevel level, const char* format,
+        double a, double b, double c) {
+    unsigned w = atomic_load_explicit(&log->write_index, memory_order_relaxed);
+    unsigned r = atomic_load_explicit(&log->read_index, memory_order_acquire);
+    if(w - r >= RTLOG_SIZE) {
+        atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    RTLogRecord* record = &log->records[w & (RTLOG_SIZE - 1)];
+    record->level = level;
+    record->format = format;
+    record->args[0] = a;
+    record->args[1] = b;
+    record->args[2] = c;
+    atomic_store_explicit(&log->write_index, w + 1, memory_order_release);
+    return true;
+}
+
+bool rtlog_pending(RTLog* log) {
+    return atomic_load_explicit(&log->write_index, memory_order_acquire) !=
+        atomic_load_explicit(&log->read_index, memory_order_relaxed);
+}
+
+/* Called from the consumer thread only. Hands every queued record to
+   sink and returns the number of records drained */
+uint32_t rtlog_drain(RTLog* log, RTLogSink sink, void* handle) {
+    unsigned r = atomic_load_explicit(&log->read_index, memory_order_relaxed);
+    unsigned w = atomic_load_explicit(&log->write_index, memory_order_acquire);
+    uint32_t n = 0;
+    for(; r != w; ++r, ++n) {
+        sink(handle, &log->records[r & (RTLOG_SIZE - 1)]);
+        atomic_store_explicit(&log->read_index, r + 1, memory_order_release);
+    }
+    return n;
+}
@@ -0,0 +1,75 @@
+/*
+   SimpleArpeggiator LV2 Plugin
+   Copyright 2017 Johan Berntsson
+
+   Permission to use, copy, modify, and/or distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+
+   THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+   */
+
+#ifndef RTLOG_H
+#define RTLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* Real-time safe logging. The audio thread pushes fixed-size records
+   into a single producer/single consumer ring buffer, and another thread
+   drains them and does the actual formatting and output.
+
+   The format string is not copied, so it must be a string literal. All
+   arguments are passed as doubles, so only floating point conversions
+   (%f, %g, %.0f etc.) may be used in the format. */
+
+#define RTLOG_SIZE 64 // number of records, must be a power of 2
+#define RTLOG_MAX_ARGS 3
+
+enum rtloglevel {
+    RTLOG_ERROR = 0,
+    RTLOG_WARNING = 1,
+    RTLOG_NOTE = 2,
+    RTLOG_TRACE = 3
+};
+
+typedef struct {
+    enum rtloglevel  level;
+    const char*      format;
+    double           args[RTLOG_MAX_ARGS];
+} RTLogRecord;
+
+typedef struct {
+    RTLogRecord      records[RTLOG_SIZE];
+    // written by the producer and consumer respectively, kept on
+    // separate cache lines
+    _Alignas(64) atomic_uint write_index;
+    _Alignas(64) atomic_uint read_index;
+    atomic_uint      dropped; // records lost because the ring was full
+} RTLog;
+
+typedef void (*RTLogSink)(void* handle, const RTLogRecord* record);
+
+void rtlog_init(RTLog* log);
+bool rtlog_push(RTLog* log, enum rtloglevel level, const char* format,
+        double a, double b, double c);
+bool rtlog_pending(RTLog* log);
+uint32_t rtlog_drain(RTLog* log, RTLogSink sink, void* handle);
+
+/* Debug messages are compiled away completely unless the plugin is built
+   with SIMPLEARPEGGIATOR_DEBUG defined (make DEBUG=1) */
+#ifdef SIMPLEARPEGGIATOR_DEBUG
+#define rtlog_debug(log, format, a, b, c) \
+    rtlog_push((log), RTLOG_TRACE, (format), (a), (b), (c))
+#else
+#define rtlog_debug(log, format, a, b, c) do {} while(0)
+#endif
+
+#endif
@@ -16,8 +16,12 @@
    */
 
 #include <math.h>
+#include <time.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #ifndef __cplusplus
 #include <stdbool.h>
 #endif
@@ -25,19 +29,25 @@
 
 #include "lv2/lv2plug.in/ns/lv2core/lv2.h"
 #include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/atom/forge.h"
 #include "lv2/lv2plug.in/ns/ext/atom/util.h"
 #include "lv2/lv2plug.in/ns/ext/time/time.h"
 #include "lv2/lv2plug.in/ns/ext/midi/midi.h"
+#include "lv2/lv2plug.in/ns/ext/patch/patch.h"
 #include "lv2/lv2plug.in/ns/ext/log/logger.h"
 #include "lv2/lv2plug.in/ns/ext/state/state.h"
+#include "lv2/lv2plug.in/ns/ext/worker/worker.h"
 
 #include "arpeggiator.h"
+#include "dspload.h"
+#include "rtlog.h"
 #include "simplearpeggiator.h"
 
 typedef struct {
     // Data types for communication with host
     LV2_URID atom_Blank;
     LV2_URID atom_Int;
+    LV2_URID atom_Long;
     LV2_URID atom_Float;
     LV2_URID atom_Object;
     LV2_URID atom_Path;
@@ -47,13 +57,36 @@ typedef struct {
     LV2_URID atom_eventTransfer;
     // Midi parameters
     LV2_URID midi_Event;
+    // Parameters set by the host or the GUI
+    LV2_URID patch_Set;
+    LV2_URID patch_property;
+    LV2_URID patch_value;
+    LV2_URID groove_file;
+    LV2_URID pattern_file;
     // Time parameters
     LV2_URID time_Position;
+    LV2_URID time_bar; // The bar number, starting from 0
     LV2_URID time_beatsPerBar; // top number in a time signature, usually 4 (for 4/4)
     LV2_URID time_beatUnit; // bottom number in a time signature, usually 4 (for 4/4)
     LV2_URID time_barBeat; // The beat number within the bar, from 0 to beatsPerBar
     LV2_URID time_beatsPerMinute; // Tempo in beats per minute.
     LV2_URID time_speed; // fraction of normal speed. 0.0 is stopped, 1.0 is normal speed
+    // DSP load report
+    LV2_URID load_DSPLoad;
+    LV2_URID load_calls;
+    LV2_URID load_events;
+    LV2_URID load_overflows;
+    LV2_URID load_meanTime;
+    LV2_URID load_maxTime;
+    LV2_URID load_load;
+    LV2_URID load_histogram;
+    // State
+    LV2_URID state_snapshot;
+    LV2_URID state_Snapshot;
+    LV2_URID state_groove;
+    LV2_URID state_Groove;
+    LV2_URID state_pattern;
+    LV2_URID state_Pattern;
 } SimpleArpeggiatorURIs;
 
 typedef struct {
@@ -61,10 +94,96 @@ typedef struct {
     uint8_t        msg[3];
 } MIDINoteEvent;
 
+/* Messages between run() and the worker thread */
+enum worktype {
+    WORK_DRAIN_LOG = 0,
+    WORK_BUILD_TABLE = 1,
+    WORK_LOAD_GROOVE = 2,
+    WORK_LOAD_PATTERN = 3
+};
+
+typedef struct {
+    enum worktype            type;
+} WorkMessage;
+
+/* The settings a note table was built for. The held keys only matter in
+   the held note modes, where held_generation counts their changes. */
+typedef struct {
+    enum chordtype           chord;
+    uint16_t                 user_chord;
+    int                      range;
+    int                      cycle;
+    enum dirtype             dir;
+    enum modetype            mode;
+    uint32_t                 held_generation;
+} TableKey;
+
+/* Asks the worker to build a table into tables[channel][table], and is
+   sent back unchanged when it is done */
+typedef struct {
+    enum worktype            type;
+    uint32_t                 channel;
+    uint32_t                 table;
+    TableKey                 key;
+    HeldNotes                held;
+} BuildTableMessage;
+
+#define N_CHANNELS 16
+
+/* One arpeggiator engine per MIDI channel, kept as arrays indexed by the
+   channel. Only engine 0 plays in omni mode. The uint16_t fields are
+   bitmasks with a bit per channel. */
+typedef struct {
+    Arpeggiator              arp[N_CHANNELS];
+    uint8_t                  sounding[N_CHANNELS][128]; // notes playing, per pitch
+    uint32_t                 held_generation[N_CHANNELS];
+    // Note tables built by the worker thread, see ensure_table()
+    ArpTable                 tables[N_CHANNELS][2];
+    TableKey                 table_key[N_CHANNELS];  // what arp.table was built for
+    TableKey                 ready_key[N_CHANNELS];  // a finished table not played yet
+    uint8_t                  ready_table[N_CHANNELS];
+    TableKey                 wanted_key[N_CHANNELS]; // requested during a build
+    TableKey                 staged_key[N_CHANNELS]; // for the current control ports
+    uint16_t                 ready;
+    uint16_t                 wanted;
+    uint16_t                 held;    // channels with keys held down
+    // the polymetric pattern lanes of each channel, channel c in the
+    // lanes c * ARP_LANE_TYPES on, in enum lanetype order
+    ArpLanes                 lanes;
+    uint32_t                 rhythm_index[N_CHANNELS]; // step of the Euclidean cycle
+    // What changes on every step of an engine, one lane per channel: the
+    // position in its table, its random sequence and skip threshold, and
+    // its gate. All channels are stepped with one lanesStep() call. The
+    // engines' own note_index and random_state only carry the position
+    // and random sequence in and out of snapshots.
+    ArpLanes                 steps;
+} ChannelEngines;
+
+/* Asks the worker to read a groove or pattern file, the path is NUL
+   terminated */
+typedef struct {
+    enum worktype            type;
+    char                     path[1024];
+} LoadFileMessage;
+
+/* The worker's reply to a LoadFileMessage tagged WORK_LOAD_GROOVE, if
+   the file could be read */
+typedef struct {
+    enum worktype            type;
+    ArpGroove                groove;
+} GrooveMessage;
+
+/* The worker's reply to a LoadFileMessage tagged WORK_LOAD_PATTERN */
+typedef struct {
+    enum worktype            type;
+    ArpPattern               pattern;
+} PatternMessage;
+
 typedef struct {
     // Features
     LV2_URID_Map*            map;
     LV2_Log_Log*             log;
+    LV2_Worker_Schedule*     schedule;
 
     // Ports
     const LV2_Atom_Sequence* in_port;
@@ -72,10 +191,33 @@ typedef struct {
     float*                   chord_ptr;
     float*                   range_ptr; /* 1 - 9 octaves */
     float*                   time_ptr;
-    float*                   gate_ptr; /* 0 - 100 % */
+    float*                   gate_ptr; /* 0 - 400 % */
     float*                   cycle_ptr;  /* 0 - 6 notes to skip */
     float*                   skip_ptr; /* 0 - 100 % */
     float*                   dir_ptr; 
+    float*                   seed_ptr; /* 0 = random, else fixed seed */
+    float*                   mode_ptr; /* which held keys are played */
+    LV2_Atom_Sequence*       notify_port; /* optional, DSP load reports */
+    float*                   sync_ptr; /* enum synctype */
+    float*                   tempo_ptr; /* internal tempo, bpm */
+    float*                   swing_ptr; /* 0 - 100 % */
+    float*                   groove_ptr; /* enum groovetype */
+    float*                   velocity_ptr; /* enum velocitycurve */
+    float*                   accent_ptr; /* enum accenttype */
+    float*                   accent_level_ptr; /* 0 - 100 % */
+    float*                   key_ptr; /* 0 = C to 11 = B */
+    float*                   scale_ptr; /* enum scaletype */
+    float*                   user_chord_ptr; /* interval bitmask */
+    float*                   user_scale_ptr; /* interval bitmask */
+    float*                   channels_ptr; /* enum channeltype */
+    float*                   polymeter_ptr; /* play the pattern lanes */
+    float*                   euclid_steps_ptr; /* 0 = off, 1 - 64 steps */
+    float*                   euclid_pulses_ptr; /* 0 - 64 pulses */
+    float*                   euclid_rotate_ptr; /* 0 - 63 steps */
+    float*                   pulse_chance_ptr; /* 0 - 100 % */
+    float*                   fill_chance_ptr; /* 0 - 100 % */
+    float*                   ratchet_ptr; /* 1 - 8 hits per step */
+    float*                   strum_ptr; /* 0 - 100 % of a hit */
 
     // Variables to keep track of the tempo information sent by the host
     double                   rate;   // Sample rate
@@ -83,16 +225,76 @@ typedef struct {
     float                    speed;  // Transport speed (usually 0=stop, 1=play)
     uint32_t                 beat_unit;  // bottom number in a time signature
     uint32_t                 beats_per_bar;  // top number in a time signature
-    uint32_t                 frames_per_beat; // number of frames in one beat
-    uint32_t                 elapsed_frames;  // Frames since the start of the last click
+    uint64_t                 frame;  // Frames processed since activate()
+    ArpClock                 clock;  // beat position and step timing
+    // Without host sync the clock runs on the tempo port or MIDI clock,
+    // and the control ports are read at the start of each of its own bars
+    enum synctype            sync;       // the sync port value in use
+    bool                     host_sync;  // following the host's time:Position
+    int64_t                  next_bar;   // next bar of the internal clock
+    ArpMidiClock             midi_clock; // MIDI clock input, always tracked
+
+    // arpeggio info. The engines share the settings, and the notes of
+    // all of them end through the one note off queue.
+    enum channeltype         channels;  // the channels port value in use
+    ChannelEngines           ch;
+    NoteOffQueue             note_offs; // scheduled note offs
+    NoteOffQueue             hits; // ratchet and strum note ons still to come
+
+    // Groove: the start offset of each step of the 16 step cycle, with the
+    // swing included, worked out whenever the groove or swing changes
+    const ArpGroove*         groove;
+    enum groovetype          groove_type;
+    float                    swing;
+    float                    step_offsets[ARP_GROOVE_STEPS];
+    ArpGroove                user_groove; // loaded from a file
+
+    // Output velocity for each step of the cycle and input velocity, with
+    // the curve, groove and accents applied
+    enum velocitycurve       velocity_curve;
+    enum accenttype          accent;
+    float                    accent_level;
+    ArpVelocityMap           velocity_map;
 
-    // arpeggio info
-    uint8_t                  base_note; // base note of the current arpeggio
-    MIDINoteEvent            arpeggiator_note; // the currently played apreggio note
-    uint32_t                 arpeggiator_note_last_frame; // scheduled note off (frames)
+    // Polymetric pattern, loaded from a file. Its lanes are stepped for
+    // all channels at once, in ch.lanes.
+    ArpPattern               pattern;
+    bool                     polymeter;
 
-    // Logger convenience API
+    // Euclidean rhythm with the chance of each step, built whenever one
+    // of its controls changes
+    ArpRhythm                rhythm;
+
+    // Ratchets: each step is played as this many hits, and the notes of
+    // a chord are spread over the strum, a fraction of a hit
+    uint32_t                 ratchet;
+    float                    strum;
+
+    // every note played is snapped to the key and scale with this table
+    uint8_t                  scale_map[128];
+    float                    port_values[SIMPLEARPEGGIATOR_N_PORTS]; // last read
+    uint32_t                 port_changes; // counts the ports that changed
+
+    // preset bank, compiled at instantiate()
+    ArpPreset                presets[ARP_PRESETS];
+    const ArpPreset*         pending_preset; // switched to on the next step
+
+    // the table build in the worker, there is one at a time
+    TableKey                 building_key;
+    uint32_t                 building_channel;
+    bool                     table_in_flight;
+
+    // Logger convenience API, only used outside the audio thread
     LV2_Log_Logger           logger;
+    // Log messages from the audio thread, written out by the worker
+    RTLog                    rtlog;
+    bool                     rtlog_drain_scheduled;
+
+    // run() timing, only measured when the notify port is connected
+    LV2_Atom_Forge           forge;
+    DSPLoad                  load;
+    uint32_t                 run_events;    // output events in this run()
+    uint32_t                 run_overflows; // events that didn't fit
 
     // URIs
     SimpleArpeggiatorURIs    uris;
@@ -132,36 +334,386 @@ static void connect_port(
         case SIMPLEARPEGGIATOR_DIR:
             self->dir_ptr = (float*)data;
             break;
+        case SIMPLEARPEGGIATOR_SEED:
+            self->seed_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_MODE:
+            self->mode_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_NOTIFY:
+            self->notify_port = (LV2_Atom_Sequence*)data;
+            break;
+        case SIMPLEARPEGGIATOR_SYNC:
+            self->sync_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_TEMPO:
+            self->tempo_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_SWING:
+            self->swing_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_GROOVE:
+            self->groove_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_VELOCITY:
+            self->velocity_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_ACCENT:
+            self->accent_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_ACCENT_LEVEL:
+            self->accent_level_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_KEY:
+            self->key_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_SCALE:
+            self->scale_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_USER_CHORD:
+            self->user_chord_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_USER_SCALE:
+            self->user_scale_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_CHANNELS:
+            self->channels_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_POLYMETER:
+            self->polymeter_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_EUCLID_STEPS:
+            self->euclid_steps_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_EUCLID_PULSES:
+            self->euclid_pulses_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_EUCLID_ROTATE:
+            self->euclid_rotate_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_PULSE_CHANCE:
+            self->pulse_chance_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_FILL_CHANCE:
+            self->fill_chance_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_RATCHET:
+            self->ratchet_ptr = (float*)data;
+            break;
+        case SIMPLEARPEGGIATOR_STRUM:
+            self->strum_ptr = (float*)data;
+            break;
         default:
             break;
     }
 }
 
-static void updateParameters(SimpleArpeggiator* self) {
+static TableKey table_key(
+        const SimpleArpeggiator* self,
+        uint32_t                 channel,
+        enum chordtype           chord,
+        uint16_t                 user_chord,
+        int                      range,
+        int                      cycle,
+        enum dirtype             dir,
+        enum modetype            mode) {
+    // the user chord only matters when it is played
+    if(chord != CHORD_USER) user_chord = 0;
+    TableKey key = { chord, user_chord, range, cycle, dir, mode, 0 };
+    if(mode != MODE_TRANSPOSE) key.held_generation = self->ch.held_generation[channel];
+    return key;
+}
+
+static TableKey active_table_key(const SimpleArpeggiator* self, uint32_t channel) {
+    const Arpeggiator* arp = &self->ch.arp[channel];
+    return table_key(self, channel, arp->chord, arp->user_chord, arp->range, arp->cycle, arp->dir, arp->mode);
+}
+
+static bool same_key(const TableKey* a, const TableKey* b) {
+    return a->chord == b->chord && a->user_chord == b->user_chord && a->range == b->range &&
+        a->cycle == b->cycle && a->dir == b->dir && a->mode == b->mode && a->held_generation == b->held_generation;
+}
+
+static void schedule_table(SimpleArpeggiator* self, uint32_t channel, const TableKey* key) {
+    ChannelEngines* ch = &self->ch;
+    BuildTableMessage msg;
+    msg.type = WORK_BUILD_TABLE;
+    msg.channel = channel;
+    // never the table being played
+    msg.table = ch->arp[channel].table == &ch->tables[channel][0] ? 1 : 0;
+    msg.key = *key;
+    msg.held = ch->arp[channel].held;
+    if(key->mode != MODE_TRANSPOSE) msg.key.held_generation = ch->held_generation[channel];
+    if(self->schedule->schedule_work(self->schedule->handle,
+                sizeof(msg), &msg) == LV2_WORKER_SUCCESS) {
+        // the ready table, if any, is in the slot that is overwritten
+        ch->ready &= ~(1u << channel);
+        self->table_in_flight = true;
+        self->building_key = msg.key;
+        self->building_channel = channel;
+    }
+}
+
+/* Asks the worker thread to build a table that is likely to be needed
+   soon. Only one build is in flight at a time, and only the latest
+   request made meanwhile is kept for each channel. Without a worker this
+   does nothing, and ensure_table() builds the table when it is needed. */
+static void request_table(SimpleArpeggiator* self, uint32_t channel, const TableKey* key) {
+    ChannelEngines* ch = &self->ch;
+    const uint16_t bit = 1u << channel;
+    if(!self->schedule) return;
+    if(ch->arp[channel].table && same_key(key, &ch->table_key[channel])) return;
+    if((ch->ready & bit) && same_key(key, &ch->ready_key[channel])) return;
+    if(self->table_in_flight) {
+        if(channel != self->building_channel || !same_key(key, &self->building_key)) {
+            ch->wanted_key[channel] = *key;
+            ch->wanted |= bit;
+        } else {
+            ch->wanted &= ~bit;
+        }
+        return;
+    }
+    schedule_table(self, channel, key);
+}
+
+/* Makes sure that the table for the current settings and held keys is
+   played. Called before every step, and normally only compares the keys
+   or switches to a table the worker has built. If the worker is late, or
+   missing, the table is built here, so the notes played never depend on
+   the worker's timing. In the held note modes a key pressed or released
+   in the block of a step always lands here, as the worker only runs
+   after the block. */
+static void ensure_table(SimpleArpeggiator* self, uint32_t channel) {
+    ChannelEngines* ch = &self->ch;
+    Arpeggiator* arp = &ch->arp[channel];
+    const uint16_t bit = 1u << channel;
+    TableKey want = active_table_key(self, channel);
+    if(arp->table && same_key(&ch->table_key[channel], &want)) return;
+    if((ch->ready & bit) && same_key(&ch->ready_key[channel], &want)) {
+        setArpeggioTable(arp, &ch->tables[channel][ch->ready_table[channel]]);
+        ch->ready &= ~bit;
+    } else {
+        rtlog_debug(&self->rtlog, "note table built without the worker\n", 0, 0, 0);
+        buildArpeggioNotes(arp);
+    }
+    ch->table_key[channel] = want;
+}
+
+/* Control port changes are only applied at the start of a bar, but the
+   new tables can be built as soon as a control is moved. Only the
+   channels with keys held need one. */
+static void stage_parameters(SimpleArpeggiator* self) {
+    ChannelEngines* ch = &self->ch;
+    uint16_t channels = ch->held ? ch->held : 1;
+    for(uint32_t c = 0; channels; c++, channels >>= 1) {
+        if(!(channels & 1)) continue;
+        TableKey key = table_key(self, c,
+                (enum chordtype) *self->chord_ptr,
+                (uint16_t) *self->user_chord_ptr & ARP_INTERVALS_ALL, (int) *self->range_ptr,
+                (int) *self->cycle_ptr, (enum dirtype) *self->dir_ptr, (enum modetype) *self->mode_ptr);
+        if(same_key(&key, &ch->staged_key[c])) continue;
+        ch->staged_key[c] = key;
+        request_table(self, c, &key);
+    }
+}
+
+/* Starts the arpeggio of a channel from the beginning, after the engine
+   has been reset. A fixed seed restarts the same random sequence. */
+static void reset_steps(SimpleArpeggiator* self, uint32_t channel) {
+    const Arpeggiator* arp = &self->ch.arp[channel];
+    self->ch.steps.index[channel] = 0;
+    if(arp->seed) lanesSeed(&self->ch.steps, channel, arp->seed);
+    lanesSetSkip(&self->ch.steps, channel, arp->skip);
+}
+
+// Starts every engine's arpeggio and pattern from the beginning
+static void reset_arpeggios(SimpleArpeggiator* self) {
+    for(uint32_t c = 0; c < N_CHANNELS; c++) {
+        resetArpeggio(&self->ch.arp[c]);
+        reset_steps(self, c);
+    }
+    lanesReset(&self->ch.lanes);
+    memset(self->ch.rhythm_index, 0, sizeof(self->ch.rhythm_index));
+}
+
+// Loads the pattern into the lanes of every channel
+static void update_pattern(SimpleArpeggiator* self) {
+    for(uint32_t c = 0; c < N_CHANNELS; c++) {
+        patternLanes(&self->pattern, &self->ch.lanes, c * ARP_LANE_TYPES);
+    }
+}
+
+// Only the lanes of the channels that can play are stepped
+static void update_lane_count(SimpleArpeggiator* self) {
+    self->ch.lanes.count = ARP_LANE_TYPES *
+        (self->channels == CHANNELS_MULTI ? N_CHANNELS : 1);
+}
+
+static void update_scale(SimpleArpeggiator* self) {
+    int scale = (int) *self->scale_ptr;
+    uint16_t intervals = ARP_INTERVALS_ALL;
+    if(scale == SCALE_USER) {
+        intervals = (uint16_t) *self->user_scale_ptr;
+    } else if(scale > SCALE_CHROMATIC && scale < SCALE_USER) {
+        intervals = arp_scales[scale];
+    }
+    buildScaleMap(self->scale_map, ((int) *self->key_ptr % 12 + 12) % 12, intervals);
+}
+
+static void update_rhythm(SimpleArpeggiator* self) {
+    float steps = *self->euclid_steps_ptr, pulses = *self->euclid_pulses_ptr;
+    float rotate = *self->euclid_rotate_ptr;
+    buildRhythm(&self->rhythm, pulses > 0 ? (uint32_t) pulses : 0,
+            steps > 0 ? (uint32_t) steps : 0, rotate > 0 ? (uint32_t) rotate : 0,
+            *self->pulse_chance_ptr, *self->fill_chance_ptr);
+}
+
+static void update_velocity_map(SimpleArpeggiator* self) {
+    buildVelocityMap(&self->velocity_map, self->velocity_curve,
+            self->accent, self->accent_level, self->groove);
+}
+
+static void update_groove(SimpleArpeggiator* self) {
+    if(self->groove_type == GROOVE_USER) {
+        self->groove = &self->user_groove;
+    } else if(self->groove_type > GROOVE_NONE && self->groove_type < GROOVE_USER) {
+        self->groove = &arp_grooves[self->groove_type];
+    } else {
+        self->groove = &arp_grooves[GROOVE_NONE];
+    }
+    grooveOffsets(self->groove, self->swing, self->step_offsets);
+    update_velocity_map(self);
+}
+
+// A control port only overrides the engine when it has been moved since
+// it was last read, so that a program change isn't undone at the next bar
+static bool port_changed(SimpleArpeggiator* self, uint32_t port, float value) {
+    if(self->port_values[port] == value) return false;
+    self->port_values[port] = value;
+    ++self->port_changes;
+    return true;
+}
+
+// returns true if the arpeggio changed
+static bool updateParameters(SimpleArpeggiator* self, uint64_t frame) {
     bool updateArpeggiato = false;
 
-    if(setChord((enum chordtype) *self->chord_ptr)) updateArpeggiato = true;
-    if(setRange((int)            *self->range_ptr)) updateArpeggiato = true;
-    if(setTime((enum timetype)   *self->time_ptr))  updateArpeggiato = true;
-    if(setGate(                  *self->gate_ptr))  updateArpeggiato = true;
-    if(setCycle((int)            *self->cycle_ptr)) updateArpeggiato = true;
-    if(setSkip(                  *self->skip_ptr))  updateArpeggiato = true;
-    if(setDir((enum dirtype)     *self->dir_ptr))   updateArpeggiato = true;
+    // the ports are applied to engine 0, and the others follow it
+    Arpeggiator* arp = &self->ch.arp[0];
+    const uint32_t port_changes = self->port_changes;
+
+    if(port_changed(self, SIMPLEARPEGGIATOR_CHORD, *self->chord_ptr) &&
+            setChord(arp, (enum chordtype) *self->chord_ptr)) updateArpeggiato = true;
+    if(port_changed(self, SIMPLEARPEGGIATOR_USER_CHORD, *self->user_chord_ptr) &&
+            setUserChord(arp, (uint16_t)   *self->user_chord_ptr) &&
+            arp->chord == CHORD_USER) updateArpeggiato = true;
+    if(port_changed(self, SIMPLEARPEGGIATOR_RANGE, *self->range_ptr) &&
+            setRange(arp, (int)            *self->range_ptr)) updateArpeggiato = true;
+    if(port_changed(self, SIMPLEARPEGGIATOR_TIME, *self->time_ptr) &&
+            setTime(arp, (enum timetype)   *self->time_ptr))  updateArpeggiato = true;
+    if(port_changed(self, SIMPLEARPEGGIATOR_GATE, *self->gate_ptr) &&
+            setGate(arp,                   *self->gate_ptr))  updateArpeggiato = true;
+    if(port_changed(self, SIMPLEARPEGGIATOR_CYCLE, *self->cycle_ptr) &&
+            setCycle(arp, (int)            *self->cycle_ptr)) updateArpeggiato = true;
+    if(port_changed(self, SIMPLEARPEGGIATOR_SKIP, *self->skip_ptr) &&
+            setSkip(arp,                   *self->skip_ptr))  updateArpeggiato = true;
+    if(port_changed(self, SIMPLEARPEGGIATOR_DIR, *self->dir_ptr) &&
+            setDir(arp, (enum dirtype)     *self->dir_ptr))   updateArpeggiato = true;
+    if(port_changed(self, SIMPLEARPEGGIATOR_MODE, *self->mode_ptr) &&
+            setMode(arp, (enum modetype)   *self->mode_ptr))  updateArpeggiato = true;
+    if(port_changed(self, SIMPLEARPEGGIATOR_SEED, *self->seed_ptr) &&
+            setSeed(arp, (uint32_t)        *self->seed_ptr) && arp->seed) {
+        // every channel restarts the random sequence of the new seed
+        for(uint32_t c = 0; c < N_CHANNELS; c++) lanesSeed(&self->ch.steps, c, arp->seed);
+    }
+    if(self->port_changes != port_changes) {
+        for(uint32_t c = 1; c < N_CHANNELS; c++) copySettings(&self->ch.arp[c], arp);
+    }
+
+    // the groove changes the timing but doesn't restart the arpeggio
+    bool swing_changed = port_changed(self, SIMPLEARPEGGIATOR_SWING, *self->swing_ptr);
+    bool groove_changed = port_changed(self, SIMPLEARPEGGIATOR_GROOVE, *self->groove_ptr);
+    if(swing_changed || groove_changed) {
+        self->swing = *self->swing_ptr;
+        self->groove_type = (enum groovetype) *self->groove_ptr;
+        update_groove(self);
+    }
+    bool curve_changed = port_changed(self, SIMPLEARPEGGIATOR_VELOCITY, *self->velocity_ptr);
+    bool accent_changed = port_changed(self, SIMPLEARPEGGIATOR_ACCENT, *self->accent_ptr);
+    bool level_changed = port_changed(self, SIMPLEARPEGGIATOR_ACCENT_LEVEL, *self->accent_level_ptr);
+    if(curve_changed || accent_changed || level_changed) {
+        self->velocity_curve = (enum velocitycurve) *self->velocity_ptr;
+        self->accent = (enum accenttype) *self->accent_ptr;
+        self->accent_level = *self->accent_level_ptr;
+        update_velocity_map(self);
+    }
+
+    bool key_changed = port_changed(self, SIMPLEARPEGGIATOR_KEY, *self->key_ptr);
+    bool scale_changed = port_changed(self, SIMPLEARPEGGIATOR_SCALE, *self->scale_ptr);
+    bool user_scale_changed = port_changed(self, SIMPLEARPEGGIATOR_USER_SCALE, *self->user_scale_ptr);
+    if(key_changed || scale_changed || user_scale_changed) {
+        update_scale(self);
+    }
+    if(port_changed(self, SIMPLEARPEGGIATOR_POLYMETER, *self->polymeter_ptr)) {
+        self->polymeter = *self->polymeter_ptr > 0.5;
+        lanesReset(&self->ch.lanes);
+    }
+    bool steps_changed = port_changed(self, SIMPLEARPEGGIATOR_EUCLID_STEPS, *self->euclid_steps_ptr);
+    bool pulses_changed = port_changed(self, SIMPLEARPEGGIATOR_EUCLID_PULSES, *self->euclid_pulses_ptr);
+    bool rotate_changed = port_changed(self, SIMPLEARPEGGIATOR_EUCLID_ROTATE, *self->euclid_rotate_ptr);
+    bool pulse_changed = port_changed(self, SIMPLEARPEGGIATOR_PULSE_CHANCE, *self->pulse_chance_ptr);
+    bool fill_changed = port_changed(self, SIMPLEARPEGGIATOR_FILL_CHANCE, *self->fill_chance_ptr);
+    if(steps_changed || pulses_changed || rotate_changed || pulse_changed || fill_changed) {
+        update_rhythm(self);
+    }
+    bool ratchet_changed = port_changed(self, SIMPLEARPEGGIATOR_RATCHET, *self->ratchet_ptr);
+    bool strum_changed = port_changed(self, SIMPLEARPEGGIATOR_STRUM, *self->strum_ptr);
+    if(ratchet_changed || strum_changed) {
+        float ratchet = *self->ratchet_ptr, strum = *self->strum_ptr;
+        self->ratchet = ratchet >= ARP_MAX_RATCHETS ? ARP_MAX_RATCHETS :
+            ratchet > 1 ? (uint32_t) ratchet : 1;
+        self->strum = strum >= 100 ? 1 : strum > 0 ? strum / 100 : 0;
+    }
 
     if(updateArpeggiato) {
-        lv2_log_error(&self->logger, "updating arpeggio\n");
-        updateArpeggioNotes();
+        rtlog_debug(&self->rtlog, "updating arpeggio\n", 0, 0, 0);
+        // the table is switched before the next step
+        reset_arpeggios(self);
     }
+    clockSetStep(&self->clock, note_as_beats(arp, self->beat_unit), frame);
+    return updateArpeggiato;
 }
 
 // The activate() method resets the state completely
 static void activate(LV2_Handle instance) {
     SimpleArpeggiator* self = (SimpleArpeggiator*)instance;
     //fprintf(stderr, "activate\n");
-    self->elapsed_frames = 0;
-    self->base_note = 128;
+    self->frame = 0;
+    for(uint32_t c = 0; c < N_CHANNELS; c++) heldClear(&self->ch.arp[c].held);
+    self->ch.held = 0;
+    memset(self->ch.sounding, 0, sizeof(self->ch.sounding));
+    noteOffClear(&self->note_offs);
+    noteOffClear(&self->hits);
+    dspload_clear(&self->load);
+    self->pending_preset = NULL;
+    // read every control port again
+    for(int i = 0; i < SIMPLEARPEGGIATOR_N_PORTS; i++) self->port_values[i] = NAN;
+    // free running until the host sends its transport, or waiting for a
+    // MIDI clock start
+    self->sync = (enum synctype) *self->sync_ptr;
+    self->port_values[SIMPLEARPEGGIATOR_SYNC] = *self->sync_ptr;
+    self->channels = (enum channeltype) *self->channels_ptr;
+    update_lane_count(self);
+    lanesReset(&self->ch.lanes);
+    self->host_sync = false;
+    self->next_bar = 0;
+    clockInit(&self->clock, self->rate, *self->tempo_ptr);
+    clockSetRolling(&self->clock, self->sync != SYNC_MIDI, 0);
+    midiClockInit(&self->midi_clock, self->rate, *self->tempo_ptr);
+    update_scale(self);
 
-    updateParameters(self);
+    updateParameters(self, 0);
+    for(uint32_t c = 0; c < N_CHANNELS; c++) ensure_table(self, c);
 }
 
 static LV2_Handle instantiate(
@@ -170,8 +722,10 @@ static LV2_Handle instantiate(
         const char*               path,
         const LV2_Feature* const* features) {
     // Allocate and initialise instance structure.
-    SimpleArpeggiator* self = (SimpleArpeggiator*)malloc(sizeof(SimpleArpeggiator));
-    if (!self) {
+    // Cache line aligned so that instances running on different cores
+    // never share a line
+    SimpleArpeggiator* self = NULL;
+    if (posix_memalign((void**)&self, 64, sizeof(SimpleArpeggiator))) {
         return NULL;
     }
     memset(self, 0, sizeof(SimpleArpeggiator));
@@ -182,6 +736,8 @@ static LV2_Handle instantiate(
             self->map = (LV2_URID_Map*)features[i]->data;
         } else if (!strcmp(features[i]->URI, LV2_LOG__log)) {
             self->log = (LV2_Log_Log*)features[i]->data;
+        } else if (!strcmp(features[i]->URI, LV2_WORKER__schedule)) {
+            self->schedule = (LV2_Worker_Schedule*)features[i]->data;
         }
     }
     if (!self->map) {
@@ -195,6 +751,7 @@ static LV2_Handle instantiate(
     LV2_URID_Map* const map  = self->map;
     uris->atom_Blank         = map->map(map->handle, LV2_ATOM__Blank);
     uris->atom_Int           = map->map(map->handle, LV2_ATOM__Int);
+    uris->atom_Long          = map->map(map->handle, LV2_ATOM__Long);
     uris->atom_Float         = map->map(map->handle, LV2_ATOM__Float);
     uris->atom_Object        = map->map(map->handle, LV2_ATOM__Object);
     uris->atom_Path          = map->map(map->handle, LV2_ATOM__Path);
@@ -204,24 +761,71 @@ static LV2_Handle instantiate(
     uris->atom_eventTransfer = map->map(map->handle, LV2_ATOM__eventTransfer);
     uris->midi_Event         = map->map(map->handle, LV2_MIDI__MidiEvent);
     uris->time_Position      = map->map(map->handle, LV2_TIME__Position);
+    uris->time_bar           = map->map(map->handle, LV2_TIME__bar);
     uris->time_beatsPerBar   = map->map(map->handle, LV2_TIME__beatsPerBar);
     uris->time_beatUnit      = map->map(map->handle, LV2_TIME__beatUnit);
     uris->time_barBeat       = map->map(map->handle, LV2_TIME__barBeat);
     uris->time_beatsPerMinute= map->map(map->handle, LV2_TIME__beatsPerMinute);
     uris->time_speed         = map->map(map->handle, LV2_TIME__speed);
+    uris->load_DSPLoad       = map->map(map->handle, SIMPLEARPEGGIATOR__DSPLoad);
+    uris->load_calls         = map->map(map->handle, SIMPLEARPEGGIATOR__calls);
+    uris->load_events        = map->map(map->handle, SIMPLEARPEGGIATOR__events);
+    uris->load_overflows     = map->map(map->handle, SIMPLEARPEGGIATOR__overflows);
+    uris->load_meanTime      = map->map(map->handle, SIMPLEARPEGGIATOR__meanTime);
+    uris->load_maxTime       = map->map(map->handle, SIMPLEARPEGGIATOR__maxTime);
+    uris->load_load          = map->map(map->handle, SIMPLEARPEGGIATOR__load);
+    uris->load_histogram     = map->map(map->handle, SIMPLEARPEGGIATOR__histogram);
+    uris->state_snapshot     = map->map(map->handle, SIMPLEARPEGGIATOR__snapshot);
+    uris->state_Snapshot     = map->map(map->handle, SIMPLEARPEGGIATOR__Snapshot);
+    uris->state_groove       = map->map(map->handle, SIMPLEARPEGGIATOR__groove);
+    uris->state_Groove       = map->map(map->handle, SIMPLEARPEGGIATOR__Groove);
+    uris->patch_Set          = map->map(map->handle, LV2_PATCH__Set);
+    uris->patch_property     = map->map(map->handle, LV2_PATCH__property);
+    uris->patch_value        = map->map(map->handle, LV2_PATCH__value);
+    uris->groove_file        = map->map(map->handle, SIMPLEARPEGGIATOR__grooveFile);
+    uris->pattern_file       = map->map(map->handle, SIMPLEARPEGGIATOR__patternFile);
+    uris->state_pattern      = map->map(map->handle, SIMPLEARPEGGIATOR__pattern);
+    uris->state_Pattern      = map->map(map->handle, SIMPLEARPEGGIATOR__Pattern);
 
     // initialise forge/logger
+    lv2_atom_forge_init(&self->forge, self->map);
     lv2_log_logger_init(&self->logger, self->map, self->log);
+    rtlog_init(&self->rtlog);
 
     // Initialise instance fields
     self->rate       = rate;
     self->bpm        = 120.0f; // default (will be updated later)
-    self->frames_per_beat = 60.0f / self->bpm * self->rate;
+    self->beat_unit  = 4;
+    self->beats_per_bar = 4;
+    clockInit(&self->clock, self->rate, self->bpm);
 
     // setting parameter defaults to trigger updates in activate later()
-    setChord(CHORD_ERROR);
-    setTime(NOTE_ERROR);
-    setDir(DIR_ERROR);
+    for(uint32_t c = 0; c < N_CHANNELS; c++) {
+        setChord(&self->ch.arp[c], CHORD_ERROR);
+        setTime(&self->ch.arp[c], NOTE_ERROR);
+        setDir(&self->ch.arp[c], DIR_ERROR);
+        setMode(&self->ch.arp[c], MODE_ERROR);
+    }
+    // the preset tables are expanded here, so that switching is instant
+    for(uint32_t i = 0; i < ARP_PRESETS; i++) {
+        self->presets[i] = arp_presets[i];
+        compilePreset(&self->presets[i]);
+    }
+    grooveClear(&self->user_groove);
+    update_groove(self);
+    lanesInit(&self->ch.lanes, ARP_LANE_TYPES);
+    self->ratchet = 1;
+    patternClear(&self->pattern);
+    update_pattern(self);
+    buildScaleMap(self->scale_map, 0, ARP_INTERVALS_ALL);
+
+    // instances and channels without a fixed seed get their own random
+    // sequence
+    uint32_t seed = (uint32_t) time(NULL) ^ (uint32_t) (uintptr_t) self;
+    lanesInit(&self->ch.steps, N_CHANNELS);
+    for(uint32_t c = 0; c < N_CHANNELS; c++) {
+        lanesSeed(&self->ch.steps, c, seed + c * 0x9e3779b9u);
+    }
 
     return (LV2_Handle)self;
 }
@@ -230,17 +834,419 @@ static void cleanup(LV2_Handle instance) {
     free(instance);
 }
 
+static void append_event(
+        SimpleArpeggiator*    self,
+        const LV2_Atom_Event* event,
+        const uint32_t        out_capacity) {
+    if(lv2_atom_sequence_append_event(self->out_port, out_capacity, event)) {
+        ++self->run_events;
+    } else {
+        ++self->run_overflows;
+    }
+}
+
+static void send_midi(
+        SimpleArpeggiator*    self,
+        uint32_t              frame,
+        uint8_t               status,
+        uint8_t               note,
+        uint8_t               velocity,
+        const uint32_t        out_capacity) {
+    MIDINoteEvent ev;
+    ev.event.time.frames = frame;
+    ev.event.body.type   = self->uris.midi_Event;
+    ev.event.body.size   = 3;
+    ev.msg[0] = status;
+    ev.msg[1] = note;
+    ev.msg[2] = velocity;
+    append_event(self, &ev.event, out_capacity);
+}
+
+static void release_note(
+        SimpleArpeggiator*    self,
+        uint32_t              frame,
+        uint8_t               channel,
+        uint8_t               note,
+        const uint32_t        out_capacity) {
+    uint8_t* sounding = self->ch.sounding[channel];
+    // overlapping notes on the same pitch end with the last of them
+    if(sounding[note] && --sounding[note] == 0) {
+        send_midi(self, frame, 0x80 | channel, note, 0, out_capacity);
+    }
+}
+
+static void flush_notes(
+        SimpleArpeggiator*    self,
+        uint32_t              frame,
+        const uint32_t        out_capacity) {
+    // end all arpeggio notes now, and drop the hits still to come
+    noteOffClear(&self->note_offs);
+    noteOffClear(&self->hits);
+    for(uint8_t c = 0; c < N_CHANNELS; c++) {
+        for(uint32_t note = 0; note < 128; note++) {
+            if(self->ch.sounding[c][note]) {
+                send_midi(self, frame, 0x80 | c, note, 0, out_capacity);
+                self->ch.sounding[c][note] = 0;
+            }
+        }
+    }
+}
+
+// The beat where a step starts, moved by the groove
+static double step_beat(const SimpleArpeggiator* self, int64_t step) {
+    return (step + self->step_offsets[step & (ARP_GROOVE_STEPS - 1)]) *
+        self->clock.step_beats;
+}
+
+/* Starts a note at frame in the block, which ends at off_frame */
+static void start_note(
+        SimpleArpeggiator*    self,
+        uint8_t               channel,
+        uint32_t              frame,
+        uint8_t               note,
+        uint8_t               velocity,
+        uint64_t              off_frame,
+        const uint32_t        out_capacity) {
+    uint8_t* sounding = self->ch.sounding[channel];
+    if(sounding[note]) {
+        // still held from an earlier hit (gate over 100%), retrigger
+        send_midi(self, frame, 0x80 | channel, note, 0, out_capacity);
+    }
+    send_midi(self, frame, 0x90 | channel, note, velocity, out_capacity);
+    ++sounding[note];
+
+    if(off_frame <= self->frame + frame) {
+        // zero gate, the note ends where it starts
+        release_note(self, frame, channel, note, out_capacity);
+    } else if(!noteOffPush(&self->note_offs, off_frame, note, channel)) {
+        // queue full, end the oldest note early to make room
+        NoteOff oldest = noteOffPop(&self->note_offs);
+        release_note(self, frame, oldest.channel, oldest.note, out_capacity);
+        noteOffPush(&self->note_offs, off_frame, note, channel);
+    }
+}
+
+// The hits a step is played as, for the value of its rhythm lane
+static uint32_t step_hits(const SimpleArpeggiator* self, int32_t rhythm) {
+    return rhythm > RHYTHM_PLAY ?
+        (rhythm < ARP_MAX_RATCHETS ? (uint32_t) rhythm : ARP_MAX_RATCHETS) : self->ratchet;
+}
+
+/* Gets a channel ready for a step: picks its table, moves it to the step
+   of the pitch lane, and sets the hits and gate of its lane in ch.steps.
+   lanes is the step of the pattern lanes, or NULL when the pattern is
+   off. Returns false when the rhythm rests on the step, which still
+   moves the arpeggio on. */
+static bool prepare_step(
+        SimpleArpeggiator*    self,
+        uint8_t               channel,
+        const ArpLaneStep*    lanes) {
+    ChannelEngines* ch = &self->ch;
+    Arpeggiator* arp = &ch->arp[channel];
+    ArpLanes* steps = &ch->steps;
+    int32_t rhythm = RHYTHM_PLAY, gate = -1;
+    ensure_table(self, channel);
+    steps->length[channel] = arp->table->steps ? arp->table->steps : 1;
+    steps->loop[channel] = arp->table->loop_step;
+    if(lanes) {
+        const uint32_t lane = channel * ARP_LANE_TYPES;
+        int32_t pitch = lanes->value[lane + LANE_PITCH];
+        if(pitch >= 0) steps->index[channel] = (uint32_t) pitch % steps->length[channel];
+        rhythm = lanes->value[lane + LANE_RHYTHM];
+        gate = lanes->value[lane + LANE_GATE];
+    }
+    // the Euclidean rhythm can silence the step as well
+    if(self->rhythm.steps && !rhythmStep(&self->rhythm,
+                &ch->rhythm_index[channel], &steps->random[channel])) {
+        rhythm = RHYTHM_REST;
+    }
+    steps->hits[channel] = step_hits(self, rhythm);
+    steps->gate[channel] = (gate >= 0 ? gate : getGate(arp)) / 100.0;
+    return rhythm >= RHYTHM_PLAY;
+}
+
+/* Plays the step of one channel, after prepare_step() and lanesStep().
+   lanes is the step of the pattern lanes, or NULL when the pattern is
+   off, and stepped the step of the channel lanes in ch.steps. */
+static void send_note_on(
+        SimpleArpeggiator*    self,
+        uint8_t               channel,
+        uint32_t              frame,
+        int64_t               step,
+        const ArpLaneStep*    lanes,
+        const ArpLaneStep*    stepped,
+        const uint32_t        out_capacity) {
+    Arpeggiator* arp = &self->ch.arp[channel];
+    uint8_t notes[128];
+    int32_t rhythm = RHYTHM_PLAY, velocity = 100;
+    uint32_t ties = 0;
+    if(lanes) {
+        const uint32_t lane = channel * ARP_LANE_TYPES;
+        rhythm = lanes->value[lane + LANE_RHYTHM];
+        velocity = lanes->value[lane + LANE_VELOCITY];
+        ties = patternTies(&self->ch.lanes, lane + LANE_RHYTHM);
+    }
+    uint32_t n = stepNotes(arp, stepped->step[channel], notes);
+    if(n == 0) return; // a silent chord step
+
+    // snap the notes to the scale. Notes of a chord that snap to the same
+    // pitch are played once.
+    const uint8_t* velocities = self->velocity_map.step[step & (ARP_GROOVE_STEPS - 1)];
+    uint8_t play_notes[128], play_velocities[128];
+    uint64_t played[2] = { 0, 0 };
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < n; i++) {
+        uint8_t note = self->scale_map[notes[i]];
+        uint64_t bit = (uint64_t) 1 << (note & 63);
+        if(played[note >> 6] & bit) continue;
+        played[note >> 6] |= bit;
+        uint32_t out_velocity = velocities[noteVelocity(arp, notes[i])];
+        if(velocity != 100) {
+            out_velocity = out_velocity * velocity / 100;
+            // velocity 0 would be a note off
+            if(out_velocity < 1) out_velocity = 1;
+            if(out_velocity > 127) out_velocity = 127;
+        }
+        play_notes[count] = note;
+        play_velocities[count++] = out_velocity;
+    }
+
+    // The step is played as hits evenly spaced over the step, and the
+    // notes of each hit are spread over the strum. All positions,
+    // including the note offs, are worked out in the beat domain, so that
+    // they are exact, and turned into frames once here. Hits after this
+    // frame are queued, and played by update_arp() in this block or a
+    // later one. The last hit is held on through the ties after it.
+    const ArpClock* clk = &self->clock;
+    uint32_t hits = step_hits(self, rhythm);
+    double gate_beats = stepped->off[channel];
+    float strum = self->strum;
+    // Only the many channels of multi mode together can fill the queue.
+    // Rather than drop hits, the step then gets fewer, and with no room
+    // left at all it is played as one unstrummed hit, which is started
+    // now and not queued.
+    const uint32_t room = ARP_MAX_NOTE_OFFS - self->hits.count;
+    if(hits * count > room) {
+        hits = room / count;
+        if(hits == 0) {
+            hits = 1;
+            strum = 0;
+        }
+        gate_beats = self->ch.steps.gate[channel] * (clk->step_beats / hits);
+    }
+    const double start = step_beat(self, step);
+    const double hit_beats = clk->step_beats / hits;
+    const double strum_beats = count > 1 ? strum * hit_beats / (count - 1) : 0;
+    const uint64_t now = self->frame + frame;
+    for(uint32_t hit = 0; hit < hits; hit++) {
+        const double on_beat = start + hit * hit_beats;
+        const double off_beat = (hit + 1 == hits ? step_beat(self, step + ties) : start) +
+            hit * hit_beats + gate_beats;
+        for(uint32_t i = 0; i < count; i++) {
+            uint64_t on_frame = clockFrameAt(clk, on_beat + i * strum_beats);
+            uint64_t off_frame = clockFrameAt(clk, off_beat + i * strum_beats);
+            if(on_frame <= now) {
+                start_note(self, channel, frame, play_notes[i], play_velocities[i],
+                        off_frame, out_capacity);
+            } else {
+                noteOnPush(&self->hits, on_frame, play_notes[i], channel,
+                        play_velocities[i], (uint32_t) (off_frame - on_frame));
+            }
+        }
+    }
+}
+
+/* Leaves host sync and continues on the internal tempo from the current
+   beat position */
+static void start_free_running(SimpleArpeggiator* self, uint64_t frame) {
+    ArpClock* clk = &self->clock;
+    self->host_sync = false;
+    clockSetTempo(clk, self->rate, *self->tempo_ptr, frame);
+    if(!clk->rolling) clockSetRolling(clk, true, frame);
+    self->next_bar = (int64_t) ceil(clockBeatAt(clk, frame) / self->beats_per_bar - 1e-9);
+}
+
+/* Hands the clock to the MIDI clock input. If the MIDI clock isn't
+   running the arpeggio stops until a start or continue arrives */
+static void start_midi_clock(SimpleArpeggiator* self, const uint32_t out_capacity) {
+    self->host_sync = false;
+    if(!self->midi_clock.running && self->clock.rolling) {
+        clockSetRolling(&self->clock, false, self->frame);
+        flush_notes(self, 0, out_capacity);
+    }
+}
+
+// Applies the sync and tempo ports at the start of a block
+static void update_sync(SimpleArpeggiator* self, const uint32_t out_capacity) {
+    enum synctype sync = (enum synctype) *self->sync_ptr;
+    bool tempo_changed = port_changed(self, SIMPLEARPEGGIATOR_TEMPO, *self->tempo_ptr);
+    if(sync != self->sync) {
+        if(sync == SYNC_MIDI) {
+            start_midi_clock(self, out_capacity);
+        } else if(self->sync == SYNC_MIDI || (sync == SYNC_INTERNAL && self->host_sync)) {
+            start_free_running(self, self->frame);
+        }
+        self->sync = sync;
+    } else if(!self->host_sync && sync != SYNC_MIDI && tempo_changed) {
+        clockSetTempo(&self->clock, self->rate, *self->tempo_ptr, self->frame);
+    }
+}
+
+/* Applies the channels port at the start of a block. The held keys may
+   belong to another engine afterwards, so they are let go along with
+   the notes playing. */
+static void update_channels(SimpleArpeggiator* self, const uint32_t out_capacity) {
+    enum channeltype channels = (enum channeltype) *self->channels_ptr;
+    if(channels == self->channels) return;
+    flush_notes(self, 0, out_capacity);
+    for(uint32_t c = 0; c < N_CHANNELS; c++) {
+        heldClear(&self->ch.arp[c].held);
+        ++self->ch.held_generation[c];
+    }
+    self->ch.held = 0;
+    self->channels = channels;
+    update_lane_count(self);
+}
+
+static void update_arp(
+        SimpleArpeggiator*    self,
+        uint32_t              begin,
+        uint32_t              end,
+        const uint32_t        out_capacity) {
+    ArpClock* clk = &self->clock;
+    if(!clk->rolling) return;
+
+    // Jump directly from one scheduled event to the next instead of
+    // visiting every frame. All frames are absolute here.
+    const uint64_t block_start = self->frame;
+    const uint64_t stop = block_start + end;
+    uint64_t now = block_start + begin;
+    ChannelEngines* ch = &self->ch;
+    while(ch->held || self->note_offs.count > 0 || self->hits.count > 0 ||
+            !self->host_sync) {
+        uint64_t next = stop;
+        uint64_t step_frame = stop;
+        uint64_t bar_frame = stop;
+        const NoteOff* off;
+        const NoteOff* hit;
+        if(!self->host_sync) {
+            bar_frame = clockFrameAt(clk, (double) self->next_bar * self->beats_per_bar);
+            if(bar_frame < now) bar_frame = now;
+            if(bar_frame < next) next = bar_frame;
+        }
+        if(ch->held) {
+            step_frame = clockFrameAt(clk, step_beat(self, clk->next_step));
+            // a step made late by a position correction is played at once
+            if(step_frame < now) step_frame = now;
+            if(step_frame < next) next = step_frame;
+        }
+        off = noteOffPeek(&self->note_offs);
+        if(off && off->frame < next) {
+            next = off->frame < now ? now : off->frame;
+        }
+        hit = noteOffPeek(&self->hits);
+        if(hit && hit->frame < next) {
+            next = hit->frame < now ? now : hit->frame;
+        }
+        if(next >= stop) break;
+        now = next;
+
+        // note offs first, so that a new note on the same pitch is not cut
+        while((off = noteOffPeek(&self->note_offs)) && off->frame <= now) {
+            NoteOff due = noteOffPop(&self->note_offs);
+            release_note(self, now - block_start, due.channel, due.note, out_capacity);
+        }
+        // then the hits of earlier steps, which may have been queued in
+        // an earlier block
+        while((hit = noteOffPeek(&self->hits)) && hit->frame <= now) {
+            NoteOff due = noteOffPop(&self->hits);
+            start_note(self, due.channel, now - block_start, due.note, due.velocity,
+                    due.frame + due.length, out_capacity);
+        }
+        if(!self->host_sync && bar_frame == now) {
+            // a bar of the internal clock, where the host would have sent
+            // a position
+            ++self->next_bar;
+            if(updateParameters(self, now)) {
+                flush_notes(self, now - block_start, out_capacity);
+            }
+            // the step may have moved to another grid
+            continue;
+        }
+        if(ch->held && step_frame == now) {
+            // a program change takes effect on the next step, on every
+            // channel. In the held note modes the tables requested at
+            // the program change are picked up by ensure_table().
+            const ArpPreset* preset = self->pending_preset;
+            if(preset) {
+                double step_beats = clk->step_beats;
+                self->pending_preset = NULL;
+                for(uint32_t c = 0; c < N_CHANNELS; c++) {
+                    applyPreset(&ch->arp[c], preset);
+                    reset_steps(self, c);
+                    if(preset->mode == MODE_TRANSPOSE) {
+                        ch->table_key[c] = active_table_key(self, c);
+                    }
+                }
+                clockSetStep(clk, note_as_beats(&ch->arp[0], self->beat_unit), now);
+                // with another note length the first step is on the new grid
+                if(clk->step_beats != step_beats) continue;
+            }
+            // the pattern lanes of all channels are stepped together
+            ArpLaneStep lanes;
+            const ArpLaneStep* pattern = NULL;
+            if(self->polymeter) {
+                lanesStep(&ch->lanes, UINT64_MAX, 0, &lanes);
+                pattern = &lanes;
+            }
+            // and so are the channels with keys held. Those with an empty
+            // table have nothing to step, and those that rest don't play.
+            uint64_t due = 0, rests = 0;
+            uint16_t held = ch->held;
+            for(uint8_t c = 0; held; c++, held >>= 1) {
+                if(!(held & 1)) continue;
+                if(!prepare_step(self, c, pattern)) rests |= (uint64_t) 1 << c;
+                if(ch->arp[c].table->steps) due |= (uint64_t) 1 << c;
+            }
+            ArpLaneStep stepped;
+            lanesStep(&ch->steps, due, clk->step_beats, &stepped);
+            // the channels share the step, and play it in channel order
+            uint64_t play = stepped.play & ~rests;
+            for(uint8_t c = 0; play; c++, play >>= 1) {
+                if(play & 1) {
+                    send_note_on(self, c, now - block_start, clk->next_step,
+                            pattern, &stepped, out_capacity);
+                }
+            }
+            ++clk->next_step;
+        }
+    }
+}
 
 static void update_time(
         SimpleArpeggiator* self,
         const LV2_Atom_Object* obj,
-        const LV2_Atom_Event* ev) {
+        const LV2_Atom_Event* ev,
+        const uint32_t out_capacity) {
     const SimpleArpeggiatorURIs* uris = &self->uris;
+    const uint64_t frame = self->frame + ev->time.frames;
+
+    if(self->sync != SYNC_AUTO) return;
+    if(!self->host_sync) {
+        // The host takes over from the internal clock. The pattern and
+        // held notes carry on; the clock is rolling at the internal tempo
+        // until the position below moves it to the host's.
+        self->host_sync = true;
+        self->speed = 1;
+        self->bpm = *self->tempo_ptr;
+        rtlog_debug(&self->rtlog, "host sync\n", 0, 0, 0);
+    }
 
     // Received new transport position/speed
-    LV2_Atom *beat = NULL, *bpm = NULL, *speed = NULL;
+    LV2_Atom *beat = NULL, *bpm = NULL, *speed = NULL, *bar = NULL;
     LV2_Atom  *beatsperbar = NULL, *beatunit = NULL;
     lv2_atom_object_get(obj,
+            uris->time_bar, &bar,
             uris->time_barBeat, &beat,
             uris->time_beatsPerMinute, &bpm,
             uris->time_speed, &speed,
@@ -251,111 +1257,196 @@ static void update_time(
         if(self->bpm != ((LV2_Atom_Float*) bpm)->body) {
             // Tempo changed, update BPM
             self->bpm = ((LV2_Atom_Float*) bpm)->body;
-            self->frames_per_beat = 60.0f / self->bpm * self->rate;
-            //lv2_log_error(&self->logger, "bpm %f\n", self->bpm);
+            clockSetTempo(&self->clock, self->rate, self->bpm, frame);
+            rtlog_debug(&self->rtlog, "bpm %f\n", self->bpm, 0, 0);
         }
     }
     if (speed && speed->type == uris->atom_Float) {
         if(self->speed != ((LV2_Atom_Float*) speed)->body) {
             // Speed changed, e.g. 0 (stop) to 1 (play)
             self->speed = ((LV2_Atom_Float*) speed)->body;
-            //lv2_log_error(&self->logger, "speed %f\n", self->speed);
-            if(self->speed > 0) {
+            rtlog_debug(&self->rtlog, "speed %f\n", self->speed, 0, 0);
+            clockSetRolling(&self->clock, self->speed > 0, frame);
+            if(self->speed <= 0) {
+                // stopped, don't leave any notes hanging
+                flush_notes(self, ev->time.frames, out_capacity);
+            } else {
                 // restarted
-                resetArpeggio();
+                reset_arpeggios(self);
             }
         }
     }
     if (beatsperbar && beatsperbar->type == uris->atom_Float) {
-        if(self->beats_per_bar != (int32_t) ((LV2_Atom_Float*) beatsperbar)->body) {
+        const int32_t beats = (int32_t) ((LV2_Atom_Float*) beatsperbar)->body;
+        if(beats > 0 && self->beats_per_bar != (uint32_t) beats) {
             // Number of beats in a bar changed
-            self->beats_per_bar = (int32_t) ((LV2_Atom_Float*) beatsperbar)->body;
-            //lv2_log_error(&self->logger, "beats_per_bar %d\n", self->beats_per_bar);
+            self->beats_per_bar = (uint32_t) beats;
+            rtlog_debug(&self->rtlog, "beats_per_bar %.0f\n", self->beats_per_bar, 0, 0);
         }
     }
     if (beatunit && beatunit->type == uris->atom_Int) {
-        if(self->beat_unit != (int32_t) ((LV2_Atom_Int*) beatunit)->body) {
-            // Number of beats in a bar changed
-            self->beat_unit = (int32_t) ((LV2_Atom_Int*) beatunit)->body;
-            //lv2_log_error(&self->logger, "beat_unit %d\n", self->beat_unit);
+        const int32_t unit = ((LV2_Atom_Int*) beatunit)->body;
+        if(unit > 0 && self->beat_unit != (uint32_t) unit) {
+            // The note value of a beat changed
+            self->beat_unit = (uint32_t) unit;
+            rtlog_debug(&self->rtlog, "beat_unit %.0f\n", self->beat_unit, 0, 0);
+            clockSetStep(&self->clock,
+                    note_as_beats(&self->ch.arp[0], self->beat_unit), frame);
         }
     }
     if (beat && beat->type == uris->atom_Float) {
         // Received a beat position, synchronise
         const float bar_beats  = ((LV2_Atom_Float*)beat)->body; // eg. 2.031
-        const float beat_beats = bar_beats - floorf(bar_beats); // 0.031
+        double position = bar_beats;
+        if (bar && bar->type == uris->atom_Long) {
+            position += (double) ((LV2_Atom_Long*) bar)->body * self->beats_per_bar;
+        } else {
+            // no bar number, assume we are in the bar closest to our own
+            // running position
+            double running = clockBeatAt(&self->clock, frame);
+            position += self->beats_per_bar *
+                floor((running - position) / self->beats_per_bar + 0.5);
+        }
+        clockLocate(&self->clock, position, frame);
         if(bar_beats < 1) {
             // new bar
-            updateParameters(self);
-            //self->elapsed_frames = beat_beats * self->frames_per_beat; // already processed frames
-            //lv2_log_error(&self->logger, "beat %f %d/%d %d\n", beat_beats, self->beats_per_bar, self->beat_unit, self->elapsed_frames);
+            if(updateParameters(self, frame)) {
+                flush_notes(self, ev->time.frames, out_capacity);
+            }
+            rtlog_debug(&self->rtlog, "beat %f %.0f/%.0f\n", bar_beats, self->beats_per_bar, self->beat_unit);
         }
     }
 
 }
 
-static void update_arp(
+/* MIDI clock messages are always tracked, so that switching the sync port
+   to MIDI clock in the middle of a song picks up the running clock. They
+   only drive the beat clock when MIDI clock is selected. Each tick moves
+   the clock to the filtered tempo and position, and the steps in between
+   are placed by the beat clock. */
+static void update_midi_clock(
         SimpleArpeggiator*    self,
-        uint32_t              begin,
-        uint32_t              end,
+        const uint8_t* const  msg,
+        const uint64_t        frame,
         const uint32_t        out_capacity) {
-    if(self->speed < 1.0) return;
-
-    float step_ratio = note_as_fraction_of_bar(self->beat_unit, self->beats_per_bar);
-    uint32_t step_in_frames = (self->frames_per_beat * self->beats_per_bar) * step_ratio;
+    ArpMidiClock* mc = &self->midi_clock;
+    ArpClock* clk = &self->clock;
+    const bool follow = self->sync == SYNC_MIDI;
 
-    for (uint32_t i = begin; i < end; ++i) {
-        if(self->elapsed_frames == self->arpeggiator_note_last_frame) {
-            self->arpeggiator_note.msg[0] = 0x80;
-            lv2_atom_sequence_append_event(
-                    self->out_port, out_capacity, &self->arpeggiator_note.event);
-        }
-        if(self->elapsed_frames % step_in_frames == 0) {
-            if(self->base_note < 128) {
-                self->arpeggiator_note.event.time.frames = 0;
-                self->arpeggiator_note.event.body.type   = self->uris.midi_Event;
-                self->arpeggiator_note.event.body.size   = 3;
-                self->arpeggiator_note.msg[0] = 0x90;
-                self->arpeggiator_note.msg[1] = nextNote(self->base_note);
-                self->arpeggiator_note.msg[2] = 127;
-
-                if(self->arpeggiator_note.msg[1] < 128) {
-                    // calculate note off time
-                    self->arpeggiator_note_last_frame = self->elapsed_frames +
-                        (getGate() * step_in_frames) / 100;
-                    // send the note to the midi bus
-                    lv2_atom_sequence_append_event(
-                            self->out_port, out_capacity, &self->arpeggiator_note.event);
-                }
+    switch(msg[0]) {
+        case LV2_MIDI_MSG_CLOCK:
+            midiClockTick(mc, frame);
+            if(!follow || !mc->running) break;
+            clockSetTempo(clk, self->rate, midiClockBpm(mc, self->rate), frame);
+            clockLocate(clk, midiClockBeatAt(mc, frame), frame);
+            if(!clk->rolling) {
+                // the first tick after a start or continue
+                clockSetRolling(clk, true, frame);
+                self->next_bar = (int64_t) ceil(
+                        clockBeatAt(clk, frame) / self->beats_per_bar - 1e-9);
             }
-
-        }
-        ++self->elapsed_frames;
+            break;
+        case LV2_MIDI_MSG_START:
+            midiClockStart(mc);
+            if(follow) reset_arpeggios(self);
+            break;
+        case LV2_MIDI_MSG_CONTINUE:
+            midiClockContinue(mc);
+            break;
+        case LV2_MIDI_MSG_STOP:
+            midiClockStop(mc);
+            if(follow && clk->rolling) {
+                // stopped, don't leave any notes hanging
+                clockSetRolling(clk, false, frame);
+                flush_notes(self, frame - self->frame, out_capacity);
+            }
+            break;
+        case LV2_MIDI_MSG_SONG_POS:
+            midiClockSongPosition(mc, msg[1] | msg[2] << 7);
+            break;
+        default:
+            break;
     }
 }
 
 static int update_midi(
         SimpleArpeggiator*    self,
         const uint8_t* const  msg,
+        const uint64_t        frame,
         const uint32_t out_capacity
         ) {
     // return 0 if consumed by this filter
     //lv2_log_error(&self->logger, "midi command %x %d %d\n", msg[0], msg[1], msg[2]);
 
+    // in multi mode the keys go to the engine of their channel
+    ChannelEngines* ch = &self->ch;
+    const uint8_t c = self->channels == CHANNELS_MULTI ? msg[0] & 0x0f : 0;
+    Arpeggiator* arp = &ch->arp[c];
+
     switch (lv2_midi_message_type(msg)) {
         case LV2_MIDI_MSG_NOTE_ON:
-            // only allow one note at a time
-            if(self->base_note == 128) {
+            if(msg[2] > 0) {
                 //lv2_log_error(&self->logger, "note on %d\n", msg[1]);
-                self->base_note = msg[1];
+                if(!ch->held) {
+                    // start on the next step boundary
+                    self->clock.next_step = clockFirstStep(&self->clock, frame);
+                }
+                setKeyVelocity(arp, msg[1], msg[2]);
+                if(arp->held.count == 0) {
+                    // the pattern and rhythm start over with each phrase
+                    for(uint32_t lane = 0; lane < ARP_LANE_TYPES; lane++) {
+                        ch->lanes.index[c * ARP_LANE_TYPES + lane] = 0;
+                    }
+                    ch->rhythm_index[c] = 0;
+                }
+                if(heldAdd(&arp->held, msg[1])) {
+                    ch->held |= 1u << c;
+                    ++ch->held_generation[c];
+                    TableKey key = active_table_key(self, c);
+                    request_table(self, c, &key);
+                }
+                return 0;
             }
-            return 0;
+            // note on with zero velocity is a note off
+            /* fall through */
         case LV2_MIDI_MSG_NOTE_OFF:
-            if(self->base_note == msg[1]) {
-                //lv2_log_error(&self->logger, "note off %d\n", msg[1]);
-                self->base_note = 128;
+            //lv2_log_error(&self->logger, "note off %d\n", msg[1]);
+            if(heldRemove(&arp->held, msg[1])) {
+                ++ch->held_generation[c];
+                if(arp->held.count > 0) {
+                    TableKey key = active_table_key(self, c);
+                    request_table(self, c, &key);
+                } else {
+                    ch->held &= ~(1u << c);
+                }
             }
             return 0;
+        case LV2_MIDI_MSG_CLOCK:
+        case LV2_MIDI_MSG_START:
+        case LV2_MIDI_MSG_CONTINUE:
+        case LV2_MIDI_MSG_STOP:
+        case LV2_MIDI_MSG_SONG_POS:
+            // passed on, for instruments further down the chain
+            update_midi_clock(self, msg, frame, out_capacity);
+            return 1;
+        case LV2_MIDI_MSG_PGM_CHANGE:
+            if(msg[1] < ARP_PRESETS) {
+                const ArpPreset* preset = &self->presets[msg[1]];
+                self->pending_preset = preset;
+                // tables that depend on the held keys are built by the
+                // worker before the next step
+                if(preset->mode != MODE_TRANSPOSE) {
+                    uint16_t held = ch->held;
+                    for(uint32_t h = 0; held; h++, held >>= 1) {
+                        if(!(held & 1)) continue;
+                        TableKey key = table_key(self, h, preset->chord, 0,
+                                preset->range, preset->cycle, preset->dir, preset->mode);
+                        request_table(self, h, &key);
+                    }
+                }
+                return 0;
+            }
+            return 1;
         default:
             // Forward all other MIDI events directly
             return 1;
@@ -363,9 +1454,70 @@ static int update_midi(
     return 1;
 }
 
+// Sends the DSP load measurements to the notify port, and starts a new window
+static void send_load(SimpleArpeggiator* self) {
+    SimpleArpeggiatorURIs* uris = &self->uris;
+    LV2_Atom_Forge*        forge = &self->forge;
+    DSPLoad*               load = &self->load;
+    LV2_Atom_Forge_Frame   frame;
+
+    lv2_atom_forge_frame_time(forge, 0);
+    lv2_atom_forge_object(forge, &frame, 0, uris->load_DSPLoad);
+    lv2_atom_forge_key(forge, uris->load_calls);
+    lv2_atom_forge_long(forge, load->calls);
+    lv2_atom_forge_key(forge, uris->load_events);
+    lv2_atom_forge_long(forge, load->events);
+    lv2_atom_forge_key(forge, uris->load_overflows);
+    lv2_atom_forge_long(forge, load->overflows);
+    lv2_atom_forge_key(forge, uris->load_meanTime);
+    lv2_atom_forge_float(forge, (float) load->window_ns / load->window_calls);
+    lv2_atom_forge_key(forge, uris->load_maxTime);
+    lv2_atom_forge_float(forge, (float) load->window_max_ns);
+    lv2_atom_forge_key(forge, uris->load_load);
+    lv2_atom_forge_float(forge, (float) dspload_ratio(load, self->rate));
+    lv2_atom_forge_key(forge, uris->load_histogram);
+    lv2_atom_forge_vector(forge, sizeof(uint32_t), uris->atom_Int,
+            DSPLOAD_BUCKETS, load->histogram);
+    lv2_atom_forge_pop(forge, &frame);
+
+    dspload_clear_window(load);
+}
+
+/* Groove and pattern files set through patch:Set are read by the worker.
+   Without a worker they can't be loaded. */
+static void set_parameter(SimpleArpeggiator* self, const LV2_Atom_Object* obj) {
+    const SimpleArpeggiatorURIs* uris = &self->uris;
+    const LV2_Atom* property = NULL;
+    const LV2_Atom* value = NULL;
+    lv2_atom_object_get(obj,
+            uris->patch_property, &property,
+            uris->patch_value, &value,
+            0);
+    if(!property || property->type != uris->atom_URID) return;
+    LV2_URID key = ((const LV2_Atom_URID*) property)->body;
+    if(key != uris->groove_file && key != uris->pattern_file) return;
+    if(!value || value->type != uris->atom_Path || !self->schedule) return;
+
+    LoadFileMessage msg;
+    uint32_t length = value->size;
+    if(length == 0 || length > sizeof(msg.path)) {
+        rtlog_debug(&self->rtlog, "file path too long\n", 0, 0, 0);
+        return;
+    }
+    msg.type = key == uris->groove_file ? WORK_LOAD_GROOVE : WORK_LOAD_PATTERN;
+    memcpy(msg.path, LV2_ATOM_BODY_CONST(value), length);
+    msg.path[length - 1] = 0;
+    self->schedule->schedule_work(self->schedule->handle,
+            offsetof(LoadFileMessage, path) + length, &msg);
+}
+
 static void run(LV2_Handle instance, uint32_t   sample_count) {
     SimpleArpeggiator*     self = (SimpleArpeggiator*)instance;
     SimpleArpeggiatorURIs* uris = &self->uris;
+    const uint64_t         start_ns = self->notify_port ? dspload_now() : 0;
+
+    self->run_events = 0;
+    self->run_overflows = 0;
 
     // Initially self->out_port contains a Chunk with size set to capacity
     // Get the capacity
@@ -376,35 +1528,228 @@ static void run(LV2_Handle instance, uint32_t   sample_count) {
 
     uint32_t last_t = 0; // range [0,sample_count]
 
+    update_sync(self, out_capacity);
+    update_channels(self, out_capacity);
+
     // Read incoming events
     LV2_ATOM_SEQUENCE_FOREACH(self->in_port, ev) {
+        // play the arpeggio up to this event
+        update_arp(self, last_t, ev->time.frames, out_capacity);
+        last_t = ev->time.frames;
+
         //lv2_log_error(&self->logger, "event %d\n", ev->body.type);
         if (ev->body.type == uris->atom_Object ||
                 ev->body.type == uris->atom_Blank) {
             const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
             if (obj->body.otype == uris->time_Position) {
                 // Received position information (bar/beat/bpm changes)
-                update_time(self, obj, ev);
+                update_time(self, obj, ev, out_capacity);
+            } else if (obj->body.otype == uris->patch_Set) {
+                set_parameter(self, obj);
             }
         } else if (ev->body.type == uris->midi_Event) {
             const uint8_t* const msg = (const uint8_t*)(ev + 1);
-            if(update_midi(self, msg, out_capacity)) {
+            if(update_midi(self, msg, self->frame + ev->time.frames, out_capacity)) {
                 // check if midi note_on or note_off
-                lv2_atom_sequence_append_event(
-                        self->out_port, out_capacity, ev);
+                append_event(self, ev, out_capacity);
             }
         }
-
-        // update for this iteration
-        update_arp(self, last_t, ev->time.frames, out_capacity);
-        last_t = ev->time.frames;
     }
 
     // update for the remainder of the cycle
     update_arp(self, last_t, sample_count, out_capacity);
+    self->frame += sample_count;
+
+    // have the table ready in case the controls were moved
+    stage_parameters(self);
+
+    if(self->notify_port) {
+        dspload_record(&self->load, dspload_now() - start_ns, sample_count,
+                self->run_events, self->run_overflows);
+
+        LV2_Atom_Forge_Frame notify_frame;
+        lv2_atom_forge_set_buffer(&self->forge, (uint8_t*) self->notify_port,
+                self->notify_port->atom.size);
+        lv2_atom_forge_sequence_head(&self->forge, &notify_frame, 0);
+        // report about four times per second
+        if(self->load.window_frames >= self->rate / 4) send_load(self);
+        lv2_atom_forge_pop(&self->forge, &notify_frame);
+    }
+
+    // let the worker thread write out queued log messages
+    if(self->schedule && !self->rtlog_drain_scheduled &&
+            rtlog_pending(&self->rtlog)) {
+        WorkMessage msg = { WORK_DRAIN_LOG };
+        if(self->schedule->schedule_work(self->schedule->handle,
+                    sizeof(msg), &msg) == LV2_WORKER_SUCCESS) {
+            self->rtlog_drain_scheduled = true;
+        }
+    }
+}
+
+static void write_log_record(void* handle, const RTLogRecord* record) {
+    LV2_Log_Logger* logger = (LV2_Log_Logger*) handle;
+    const double* a = record->args;
+    switch(record->level) {
+        case RTLOG_ERROR:
+            lv2_log_error(logger, record->format, a[0], a[1], a[2]);
+            break;
+        case RTLOG_WARNING:
+            lv2_log_warning(logger, record->format, a[0], a[1], a[2]);
+            break;
+        case RTLOG_NOTE:
+            lv2_log_note(logger, record->format, a[0], a[1], a[2]);
+            break;
+        case RTLOG_TRACE:
+            lv2_log_trace(logger, record->format, a[0], a[1], a[2]);
+            break;
+    }
+}
+
+// Called by the host in a non real-time thread
+static LV2_Worker_Status work(
+        LV2_Handle                  instance,
+        LV2_Worker_Respond_Function respond,
+        LV2_Worker_Respond_Handle   handle,
+        uint32_t                    size,
+        const void*                 data) {
+    SimpleArpeggiator* self = (SimpleArpeggiator*) instance;
+    const WorkMessage* msg = (const WorkMessage*) data;
+    if(size < sizeof(WorkMessage)) return LV2_WORKER_ERR_UNKNOWN;
+
+    switch(msg->type) {
+        case WORK_DRAIN_LOG: {
+            rtlog_drain(&self->rtlog, write_log_record, &self->logger);
+            unsigned dropped = atomic_exchange(&self->rtlog.dropped, 0);
+            if(dropped) {
+                lv2_log_warning(&self->logger, "%u log messages lost\n", dropped);
+            }
+            break;
+        }
+        case WORK_BUILD_TABLE: {
+            // the host only aligns the message to 4 bytes, so it is
+            // copied rather than read in place
+            BuildTableMessage build;
+            if(size != sizeof(build)) return LV2_WORKER_ERR_UNKNOWN;
+            memcpy(&build, data, sizeof(build));
+            if(build.table > 1 || build.channel >= N_CHANNELS) {
+                return LV2_WORKER_ERR_UNKNOWN;
+            }
+            // the builder only reads the settings and held keys, so a
+            // scratch engine with a copy of them is enough
+            Arpeggiator arp;
+            memset(&arp, 0, sizeof(arp));
+            arp.chord = build.key.chord;
+            arp.user_chord = build.key.user_chord;
+            arp.range = build.key.range;
+            arp.cycle = build.key.cycle;
+            arp.dir = build.key.dir;
+            arp.mode = build.key.mode;
+            arp.held = build.held;
+            buildArpeggioTable(&arp, &self->ch.tables[build.channel][build.table]);
+            break;
+        }
+        case WORK_LOAD_GROOVE:
+        case WORK_LOAD_PATTERN: {
+            LoadFileMessage load;
+            if(size <= offsetof(LoadFileMessage, path) || size > sizeof(load)) {
+                return LV2_WORKER_ERR_UNKNOWN;
+            }
+            memcpy(&load, data, size);
+            if(load.path[size - offsetof(LoadFileMessage, path) - 1] != 0) {
+                return LV2_WORKER_ERR_UNKNOWN;
+            }
+            char text[4096];
+            FILE* file = fopen(load.path, "r");
+            if(!file) {
+                lv2_log_error(&self->logger, "Cannot open %s\n", load.path);
+                return LV2_WORKER_SUCCESS;
+            }
+            size_t n = fread(text, 1, sizeof(text) - 1, file);
+            bool too_long = n == sizeof(text) - 1 && fgetc(file) != EOF;
+            fclose(file);
+            if(too_long) {
+                lv2_log_error(&self->logger, "%s is longer than %u bytes\n",
+                        load.path, (unsigned) sizeof(text) - 1);
+                return LV2_WORKER_SUCCESS;
+            }
+            text[n] = 0;
+
+            if(msg->type == WORK_LOAD_PATTERN) {
+                PatternMessage reply;
+                reply.type = WORK_LOAD_PATTERN;
+                if(!parsePattern(text, &reply.pattern)) {
+                    lv2_log_error(&self->logger, "Not a pattern file: %s\n", load.path);
+                    return LV2_WORKER_SUCCESS;
+                }
+                return respond(handle, sizeof(reply), &reply);
+            }
+            GrooveMessage reply;
+            reply.type = WORK_LOAD_GROOVE;
+            grooveClear(&reply.groove);
+            if(!parseGroove(text, &reply.groove)) {
+                lv2_log_error(&self->logger, "No groove steps in %s\n", load.path);
+                return LV2_WORKER_SUCCESS;
+            }
+            return respond(handle, sizeof(reply), &reply);
+        }
+    }
+    return respond(handle, size, data);
+}
+
+// Called by the host in the audio thread, between run() calls
+static LV2_Worker_Status work_response(
+        LV2_Handle  instance,
+        uint32_t    size,
+        const void* data) {
+    SimpleArpeggiator* self = (SimpleArpeggiator*) instance;
+    const WorkMessage* msg = (const WorkMessage*) data;
+
+    switch(msg->type) {
+        case WORK_DRAIN_LOG:
+            self->rtlog_drain_scheduled = false;
+            break;
+        case WORK_BUILD_TABLE: {
+            BuildTableMessage build;
+            if(size != sizeof(build)) break;
+            memcpy(&build, data, sizeof(build));
+            ChannelEngines* ch = &self->ch;
+            self->table_in_flight = false;
+            ch->ready_key[build.channel] = build.key;
+            ch->ready_table[build.channel] = build.table;
+            ch->ready |= 1u << build.channel;
+            // then the next channel waiting for a table, lowest first
+            while(ch->wanted && !self->table_in_flight) {
+                uint32_t c = __builtin_ctz(ch->wanted);
+                ch->wanted &= ~(1u << c);
+                TableKey key = ch->wanted_key[c];
+                request_table(self, c, &key);
+            }
+            break;
+        }
+        case WORK_LOAD_GROOVE: {
+            if(size != sizeof(GrooveMessage)) break;
+            memcpy(&self->user_groove, (const char*) data +
+                    offsetof(GrooveMessage, groove), sizeof(self->user_groove));
+            update_groove(self);
+            break;
+        }
+        case WORK_LOAD_PATTERN: {
+            if(size != sizeof(PatternMessage)) break;
+            memcpy(&self->pattern, (const char*) data +
+                    offsetof(PatternMessage, pattern), sizeof(self->pattern));
+            update_pattern(self);
+            break;
+        }
+    }
+    return LV2_WORKER_SUCCESS;
 }
 
-/* Not needed for basic preset save/restore. What is this?
+/* The engines are saved as an array of ArpSnapshot blobs, so that
+   restoring large sessions is a copy per instance rather than parsing
+   properties. In multi mode every channel's engine is saved, so each
+   channel plays on from its own position, otherwise just engine 0. The
+   held keys are not saved. */
 static LV2_State_Status state_save(
         LV2_Handle                instance,
         LV2_State_Store_Function  store,
@@ -416,17 +1761,33 @@ static LV2_State_Status state_save(
         return LV2_STATE_SUCCESS;
     }
 
-    store(handle, self->uris.ui_spp,
-            (void*)&self->ui_spp, sizeof(uint32_t),
-            self->uris.atom_Int,
+    // save may run at the same time as run(), so the positions are read
+    // from the step lanes and nothing is written to the engines
+    ArpSnapshot snapshots[N_CHANNELS];
+    const uint32_t count = self->channels == CHANNELS_MULTI ? N_CHANNELS : 1;
+    for(uint32_t c = 0; c < count; c++) {
+        saveSnapshotState(&self->ch.arp[c], self->ch.steps.index[c],
+                self->ch.steps.random[c], &snapshots[c]);
+    }
+    // the blobs are in native byte order, so they are not portable
+    LV2_State_Status status = store(handle, self->uris.state_snapshot,
+            snapshots, count * sizeof(ArpSnapshot),
+            self->uris.state_Snapshot,
             LV2_STATE_IS_POD);
-
-    store(handle, self->uris.ui_amp,
-            (void*)&self->ui_amp, sizeof(float),
-            self->uris.atom_Float,
+    if(status != LV2_STATE_SUCCESS) return status;
+    // the loaded groove and pattern files are kept in the state, not
+    // their paths
+    status = store(handle, self->uris.state_groove,
+            &self->user_groove, sizeof(ArpGroove),
+            self->uris.state_Groove,
+            LV2_STATE_IS_POD);
+    if(status != LV2_STATE_SUCCESS) return status;
+    ArpPatternState pattern;
+    savePattern(&self->pattern, &pattern);
+    return store(handle, self->uris.state_pattern,
+            &pattern, sizeof(pattern),
+            self->uris.state_Pattern,
             LV2_STATE_IS_POD);
-
-    return LV2_STATE_SUCCESS;
 }
 
 static LV2_State_Status state_restore(
@@ -437,34 +1798,72 @@ static LV2_State_Status state_restore(
         const LV2_Feature* const*   features) {
     SimpleArpeggiator* self = (SimpleArpeggiator*) instance;
 
-
     size_t   size;
     uint32_t type;
     uint32_t valflags;
-    const void* spp = retrieve(
-            handle, self->uris.ui_spp, &size, &type, &valflags);
-    if (spp && size == sizeof(uint32_t) && type == self->uris.atom_Int) {
-        self->ui_spp              = *((const uint32_t*)spp);
+    const void* groove = retrieve(
+            handle, self->uris.state_groove, &size, &type, &valflags);
+    if (groove && type == self->uris.state_Groove && size == sizeof(ArpGroove)) {
+        memcpy(&self->user_groove, groove, sizeof(ArpGroove));
+        // the blob may come from anywhere, hold it to the parser's ranges
+        grooveLimit(&self->user_groove);
+        update_groove(self);
     }
-
-    const void* amp = retrieve(
-            handle, self->uris.ui_amp, &size, &type, &valflags);
-    if (amp && size == sizeof(float) && type == self->uris.atom_Float) {
-        self->ui_amp              = *((const float*)amp);
+    const void* pattern = retrieve(
+            handle, self->uris.state_pattern, &size, &type, &valflags);
+    if (pattern && type == self->uris.state_Pattern &&
+            restorePattern(&self->pattern, pattern, (uint32_t) size)) {
+        update_pattern(self);
     }
 
+    const void* snapshot = retrieve(
+            handle, self->uris.state_snapshot, &size, &type, &valflags);
+    if (!snapshot) {
+        return LV2_STATE_SUCCESS; // saved by an older version, nothing to do
+    }
+    // one snapshot per saved channel, the first one must be good
+    const uint32_t count = (uint32_t) (size / sizeof(ArpSnapshot));
+    if (type != self->uris.state_Snapshot ||
+            size % sizeof(ArpSnapshot) != 0 || count > N_CHANNELS ||
+            !restoreSnapshot(&self->ch.arp[0], snapshot, sizeof(ArpSnapshot))) {
+        lv2_log_warning(&self->logger, "Ignoring incompatible saved state\n");
+        return LV2_STATE_ERR_BAD_TYPE;
+    }
+    // the restored tables are played as they are, and the held keys are
+    // gone. The channels that weren't saved build theirs for engine 0's
+    // settings, and start from the beginning.
+    for(uint32_t c = 0; c < N_CHANNELS; c++) {
+        Arpeggiator* arp = &self->ch.arp[c];
+        const void* data = (const char*) snapshot + c * sizeof(ArpSnapshot);
+        if(c == 0 || (c < count && restoreSnapshot(arp, data, sizeof(ArpSnapshot)))) {
+            self->ch.steps.index[c] = arp->note_index;
+            self->ch.steps.random[c] = arp->random_state;
+            lanesSetSkip(&self->ch.steps, c, arp->skip);
+            self->ch.table_key[c] = active_table_key(self, c);
+        } else {
+            if(c < count) {
+                lv2_log_warning(&self->logger,
+                        "Ignoring the saved state of channel %u\n", c + 1);
+            }
+            copySettings(arp, &self->ch.arp[0]);
+            resetArpeggio(arp);
+            reset_steps(self, c);
+        }
+        ++self->ch.held_generation[c];
+    }
     return LV2_STATE_SUCCESS;
 }
-*/
 
 static const void* extension_data(const char* uri)
 {
-    /* Not needed for basic preset save/restore. What is this?
+    static const LV2_Worker_Interface worker = { work, work_response, NULL };
+    if (!strcmp(uri, LV2_WORKER__interface)) {
+        return &worker;
+    }
     static const LV2_State_Interface state = { state_save, state_restore };
     if (!strcmp(uri, LV2_STATE__interface)) {
         return &state;
     }
-    */
     return NULL;
 }
 
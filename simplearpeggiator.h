@@ -1,9 +1,32 @@
 #define SIMPLEARPEGGIATOR_URI            \
     "https://github.com/johanberntsson/simple-arpeggiator-lv2"
 
-#define SIMPLEARPEGGIATOR_N_PORTS 9
+/* DSP load report sent on the notify port */
+#define SIMPLEARPEGGIATOR__DSPLoad    SIMPLEARPEGGIATOR_URI "#DSPLoad"
+#define SIMPLEARPEGGIATOR__calls      SIMPLEARPEGGIATOR_URI "#calls"
+#define SIMPLEARPEGGIATOR__events     SIMPLEARPEGGIATOR_URI "#events"
+#define SIMPLEARPEGGIATOR__overflows  SIMPLEARPEGGIATOR_URI "#overflows"
+#define SIMPLEARPEGGIATOR__meanTime   SIMPLEARPEGGIATOR_URI "#meanTime"
+#define SIMPLEARPEGGIATOR__maxTime    SIMPLEARPEGGIATOR_URI "#maxTime"
+#define SIMPLEARPEGGIATOR__load       SIMPLEARPEGGIATOR_URI "#load"
+#define SIMPLEARPEGGIATOR__histogram  SIMPLEARPEGGIATOR_URI "#histogram"
+
+/* Saved state, an ArpSnapshot blob */
+#define SIMPLEARPEGGIATOR__snapshot   SIMPLEARPEGGIATOR_URI "#snapshot"
+#define SIMPLEARPEGGIATOR__Snapshot   SIMPLEARPEGGIATOR_URI "#Snapshot"
+#define SIMPLEARPEGGIATOR__groove     SIMPLEARPEGGIATOR_URI "#groove"
+#define SIMPLEARPEGGIATOR__Groove     SIMPLEARPEGGIATOR_URI "#Groove"
+#define SIMPLEARPEGGIATOR__pattern    SIMPLEARPEGGIATOR_URI "#pattern"
+#define SIMPLEARPEGGIATOR__Pattern    SIMPLEARPEGGIATOR_URI "#Pattern"
+
+/* Parameters set with patch:Set, the paths of a groove template file and
+   a polymetric pattern file */
+#define SIMPLEARPEGGIATOR__grooveFile SIMPLEARPEGGIATOR_URI "#grooveFile"
+#define SIMPLEARPEGGIATOR__patternFile SIMPLEARPEGGIATOR_URI "#patternFile"
+
+#define SIMPLEARPEGGIATOR_N_PORTS 32
 /* has to correspond to port index numbers in simplearpeggiator.ttl */
-enum {
+typedef enum {
     SIMPLEARPEGGIATOR_IN  = 0,
     SIMPLEARPEGGIATOR_OUT = 1,
     SIMPLEARPEGGIATOR_CHORD = 2,
@@ -12,6 +35,42 @@ enum {
     SIMPLEARPEGGIATOR_GATE = 5,
     SIMPLEARPEGGIATOR_CYCLE = 6,
     SIMPLEARPEGGIATOR_SKIP = 7,
-    SIMPLEARPEGGIATOR_DIR = 8
+    SIMPLEARPEGGIATOR_DIR = 8,
+    SIMPLEARPEGGIATOR_SEED = 9,
+    SIMPLEARPEGGIATOR_MODE = 10,
+    SIMPLEARPEGGIATOR_NOTIFY = 11,
+    SIMPLEARPEGGIATOR_SYNC = 12,
+    SIMPLEARPEGGIATOR_TEMPO = 13,
+    SIMPLEARPEGGIATOR_SWING = 14,
+    SIMPLEARPEGGIATOR_GROOVE = 15,
+    SIMPLEARPEGGIATOR_VELOCITY = 16,
+    SIMPLEARPEGGIATOR_ACCENT = 17,
+    SIMPLEARPEGGIATOR_ACCENT_LEVEL = 18,
+    SIMPLEARPEGGIATOR_KEY = 19,
+    SIMPLEARPEGGIATOR_SCALE = 20,
+    SIMPLEARPEGGIATOR_USER_CHORD = 21,
+    SIMPLEARPEGGIATOR_USER_SCALE = 22,
+    SIMPLEARPEGGIATOR_CHANNELS = 23,
+    SIMPLEARPEGGIATOR_POLYMETER = 24,
+    SIMPLEARPEGGIATOR_EUCLID_STEPS = 25,
+    SIMPLEARPEGGIATOR_EUCLID_PULSES = 26,
+    SIMPLEARPEGGIATOR_EUCLID_ROTATE = 27,
+    SIMPLEARPEGGIATOR_PULSE_CHANCE = 28,
+    SIMPLEARPEGGIATOR_FILL_CHANCE = 29,
+    SIMPLEARPEGGIATOR_RATCHET = 30,
+    SIMPLEARPEGGIATOR_STRUM = 31
 } PortIndex;
 
+/* values of the sync port */
+enum synctype {
+    SYNC_AUTO = 0,     // host transport if there is one, else internal tempo
+    SYNC_INTERNAL = 1, // always the internal tempo
+    SYNC_MIDI = 2      // MIDI clock on the input port
+};
+
+/* values of the channels port */
+enum channeltype {
+    CHANNELS_OMNI = 0, // every channel plays one arpeggio, sent on channel 1
+    CHANNELS_MULTI = 1 // an arpeggio per channel, sent on its own channel
+};
+
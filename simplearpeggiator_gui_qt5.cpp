@@ -1,14 +1,28 @@
 #include <stdio.h>
 
 #include <QDial>
+#include <QFont>
 #include <QLabel>
 #include <QGroupBox>
 #include <QVBoxLayout>
 #include <QRadioButton>
+#include <QPushButton>
+#include <QFileDialog>
+#include <QButtonGroup>
+#include <QCheckBox>
+#include <QComboBox>
+#include <QGridLayout>
 
 #include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/atom/util.h"
+#include "lv2/lv2plug.in/ns/ext/atom/forge.h"
+#include "lv2/lv2plug.in/ns/ext/patch/patch.h"
+#include "lv2/lv2plug.in/ns/ext/urid/urid.h"
 #include "lv2/lv2plug.in/ns/extensions/ui/ui.h"
 
+#include "dspload.h"
+
 #include "simplearpeggiator.h"
 
 class SimpleArpeggiatorGUI : public QWidget {
@@ -26,6 +40,17 @@ class SimpleArpeggiatorGUI : public QWidget {
         QRadioButton* chord_octave;
         QRadioButton* chord_major;
         QRadioButton* chord_minor;
+        QRadioButton* chord_major7;
+        QRadioButton* chord_minor7;
+        QRadioButton* chord_dominant7;
+        QRadioButton* chord_sus2;
+        QRadioButton* chord_sus4;
+        QRadioButton* chord_diminished;
+        QRadioButton* chord_augmented;
+        QRadioButton* chord_power;
+        QRadioButton* chord_user;
+        QCheckBox* user_chord[12];
+        QGridLayout* user_chord_layout;
         QGroupBox* chord_group;
         QVBoxLayout* chord_layout;
         QSpacerItem *chord_spacer;
@@ -38,6 +63,15 @@ class SimpleArpeggiatorGUI : public QWidget {
         QVBoxLayout* dir_layout;
         QSpacerItem *dir_spacer;
 
+        QLabel* mode_label;
+        QRadioButton* mode_transpose;
+        QRadioButton* mode_sorted;
+        QRadioButton* mode_asplayed;
+        QRadioButton* mode_chord;
+        QGroupBox* mode_group;
+        QVBoxLayout* mode_layout;
+        QSpacerItem *mode_spacer;
+
         QLabel* time_label;
         QRadioButton* time_1_1;
         QRadioButton* time_1_2;
@@ -73,8 +107,123 @@ class SimpleArpeggiatorGUI : public QWidget {
         QVBoxLayout* skip_layout;
         QSpacerItem *skip_spacer;
 
+        QLabel* euclid_steps_label;
+        QDial* euclid_steps_dial;
+        QLabel* euclid_pulses_label;
+        QDial* euclid_pulses_dial;
+        QLabel* euclid_rotate_label;
+        QDial* euclid_rotate_dial;
+        QLabel* pulse_chance_label;
+        QDial* pulse_chance_dial;
+        QLabel* fill_chance_label;
+        QDial* fill_chance_dial;
+        QGroupBox* euclid_group;
+        QGridLayout* euclid_layout;
+
+        QLabel* ratchet_label;
+        QDial* ratchet_dial;
+        QLabel* strum_label;
+        QDial* strum_dial;
+        QGroupBox* ratchet_group;
+        QGridLayout* ratchet_layout;
+
+        QLabel* sync_label;
+        QRadioButton* sync_auto;
+        QRadioButton* sync_internal;
+        QRadioButton* sync_midi;
+        QDial* tempo_dial;
+        QLabel* tempo_label;
+        QGroupBox* sync_group;
+        QVBoxLayout* sync_layout;
+        QSpacerItem *sync_spacer;
+
+        QLabel* channels_label;
+        QRadioButton* channels_omni;
+        QRadioButton* channels_multi;
+        QGroupBox* channels_group;
+        QVBoxLayout* channels_layout;
+
+        QLabel* pattern_label;
+        QCheckBox* pattern_polymeter;
+        QPushButton* pattern_load;
+        QGroupBox* pattern_group;
+        QVBoxLayout* pattern_layout;
+
+        QLabel* groove_label;
+        QRadioButton* groove_none;
+        QRadioButton* groove_shuffle;
+        QRadioButton* groove_laid_back;
+        QRadioButton* groove_push;
+        QRadioButton* groove_user;
+        QPushButton* groove_load;
+        QDial* swing_dial;
+        QLabel* swing_label;
+        QGroupBox* groove_group;
+        QVBoxLayout* groove_layout;
+        QSpacerItem *groove_spacer;
+
+        QLabel* velocity_label;
+        QRadioButton* velocity_linear;
+        QRadioButton* velocity_soft;
+        QRadioButton* velocity_hard;
+        QRadioButton* velocity_fixed;
+        QLabel* accent_label;
+        QRadioButton* accent_none;
+        QRadioButton* accent_downbeats;
+        QRadioButton* accent_offbeats;
+        QRadioButton* accent_alternate;
+        QRadioButton* accent_3_3_2;
+        QDial* accent_level_dial;
+        QLabel* accent_level_label;
+        QGroupBox* velocity_group;
+        QVBoxLayout* velocity_layout;
+        QSpacerItem *velocity_spacer;
+
+        QLabel* key_label;
+        QDial* key_dial;
+        QLabel* scale_label;
+        QComboBox* scale_box;
+        QCheckBox* user_scale[12];
+        QGridLayout* user_scale_layout;
+        QGroupBox* scale_group;
+        QVBoxLayout* scale_layout;
+        QSpacerItem *scale_spacer;
+
+        QLabel* load_label;
+        QLabel* load_info;
+        QLabel* load_histogram;
+        QGroupBox* load_group;
+        QVBoxLayout* load_layout;
+
         float gate;
 
+        // URIDs of the DSP load reports on the notify port
+        LV2_URID atom_eventTransfer;
+        LV2_URID atom_Object;
+        LV2_URID atom_Long;
+        LV2_URID atom_Float;
+        LV2_URID atom_Vector;
+        LV2_URID load_DSPLoad;
+        LV2_URID load_calls;
+        LV2_URID load_events;
+        LV2_URID load_overflows;
+        LV2_URID load_meanTime;
+        LV2_URID load_maxTime;
+        LV2_URID load_load;
+        LV2_URID load_histogram_urid;
+
+        // patch:Set messages for the groove and pattern files
+        LV2_Atom_Forge forge;
+        LV2_URID atom_Path;
+        LV2_URID patch_Set;
+        LV2_URID patch_property;
+        LV2_URID patch_value;
+        LV2_URID groove_file;
+        LV2_URID pattern_file;
+
+        void showLoad(const LV2_Atom_Object* obj);
+        bool sendPath(LV2_URID property, const QString& name);
+
         LV2UI_Controller controller;
         LV2UI_Write_Function write_function;
 
@@ -85,7 +234,30 @@ class SimpleArpeggiatorGUI : public QWidget {
         void gateChanged(int value);
         void cycleChanged(int value);
         void skipChanged(int value);
+        void euclidStepsChanged(int value);
+        void euclidPulsesChanged(int value);
+        void euclidRotateChanged(int value);
+        void pulseChanceChanged(int value);
+        void fillChanceChanged(int value);
+        void ratchetChanged(int value);
+        void strumChanged(int value);
         void dirChanged(bool checked);
+        void modeChanged(bool checked);
+        void syncChanged(bool checked);
+        void channelsChanged(bool checked);
+        void tempoChanged(int value);
+        void grooveChanged(bool checked);
+        void swingChanged(int value);
+        void loadGroove();
+        void polymeterChanged(bool checked);
+        void loadPattern();
+        void velocityChanged(bool checked);
+        void accentChanged(bool checked);
+        void accentLevelChanged(int value);
+        void userChordChanged(bool checked);
+        void keyChanged(int value);
+        void scaleChanged(int index);
+        void userScaleChanged(bool checked);
 
 };
 
@@ -99,12 +271,37 @@ SimpleArpeggiatorGUI::SimpleArpeggiatorGUI(QWidget* parent)
         chord_octave = new QRadioButton("Octave");
         chord_major = new QRadioButton("Major");
         chord_minor = new QRadioButton("Minor");
+        chord_major7 = new QRadioButton("Major 7th");
+        chord_minor7 = new QRadioButton("Minor 7th");
+        chord_dominant7 = new QRadioButton("Dominant 7th");
+        chord_sus2 = new QRadioButton("Sus 2");
+        chord_sus4 = new QRadioButton("Sus 4");
+        chord_diminished = new QRadioButton("Diminished");
+        chord_augmented = new QRadioButton("Augmented");
+        chord_power = new QRadioButton("Power");
+        chord_user = new QRadioButton("User");
+        // the user chord's intervals, in semitones above the root
+        user_chord_layout = new QGridLayout();
+        for(int i = 0; i < 12; i++) {
+            user_chord[i] = new QCheckBox(QString::number(i));
+            user_chord_layout->addWidget(user_chord[i], i / 6, i % 6);
+        }
         chord_spacer = new QSpacerItem(20,40,QSizePolicy::Minimum, QSizePolicy::Expanding);
         chord_layout = new QVBoxLayout();
         chord_layout->addWidget(chord_label);
         chord_layout->addWidget(chord_octave);
         chord_layout->addWidget(chord_major);
         chord_layout->addWidget(chord_minor);
+        chord_layout->addWidget(chord_major7);
+        chord_layout->addWidget(chord_minor7);
+        chord_layout->addWidget(chord_dominant7);
+        chord_layout->addWidget(chord_sus2);
+        chord_layout->addWidget(chord_sus4);
+        chord_layout->addWidget(chord_diminished);
+        chord_layout->addWidget(chord_augmented);
+        chord_layout->addWidget(chord_power);
+        chord_layout->addWidget(chord_user);
+        chord_layout->addLayout(user_chord_layout);
         chord_layout->addItem(chord_spacer);
         chord_group->setLayout(chord_layout);
 
@@ -122,6 +319,22 @@ SimpleArpeggiatorGUI::SimpleArpeggiatorGUI(QWidget* parent)
         dir_layout->addItem(dir_spacer);
         dir_group->setLayout(dir_layout);
 
+        mode_group = new QGroupBox();
+        mode_label = new QLabel("mode");
+        mode_transpose = new QRadioButton("transpose");
+        mode_sorted = new QRadioButton("sorted");
+        mode_asplayed = new QRadioButton("as played");
+        mode_chord = new QRadioButton("chord");
+        mode_spacer = new QSpacerItem(20,40,QSizePolicy::Minimum, QSizePolicy::Expanding);
+        mode_layout = new QVBoxLayout();
+        mode_layout->addWidget(mode_label);
+        mode_layout->addWidget(mode_transpose);
+        mode_layout->addWidget(mode_sorted);
+        mode_layout->addWidget(mode_asplayed);
+        mode_layout->addWidget(mode_chord);
+        mode_layout->addItem(mode_spacer);
+        mode_group->setLayout(mode_layout);
+
         time_group = new QGroupBox();
         time_label = new QLabel("Time");
         time_1_1 = new QRadioButton("whole");
@@ -158,7 +371,7 @@ SimpleArpeggiatorGUI::SimpleArpeggiatorGUI(QWidget* parent)
         gate_group = new QGroupBox();
         gate_label = new QLabel("Gate");
         gate_dial = new QDial();
-        gate_dial->setRange(0, 100);
+        gate_dial->setRange(0, 400);
         gate_dial->setNotchesVisible(true);
         gate_spacer = new QSpacerItem(20,40,QSizePolicy::Minimum, QSizePolicy::Expanding);
         gate_layout = new QVBoxLayout();
@@ -179,6 +392,58 @@ SimpleArpeggiatorGUI::SimpleArpeggiatorGUI(QWidget* parent)
         skip_layout->addItem(skip_spacer);
         skip_group->setLayout(skip_layout);
 
+        euclid_group = new QGroupBox();
+        euclid_steps_label = new QLabel("Euclid steps: off");
+        euclid_steps_dial = new QDial();
+        euclid_steps_dial->setRange(0, 64);
+        euclid_steps_dial->setNotchesVisible(true);
+        euclid_pulses_label = new QLabel("Pulses");
+        euclid_pulses_dial = new QDial();
+        euclid_pulses_dial->setRange(0, 64);
+        euclid_pulses_dial->setValue(5);
+        euclid_pulses_dial->setNotchesVisible(true);
+        euclid_rotate_label = new QLabel("Rotate");
+        euclid_rotate_dial = new QDial();
+        euclid_rotate_dial->setRange(0, 63);
+        euclid_rotate_dial->setNotchesVisible(true);
+        pulse_chance_label = new QLabel("Pulse chance");
+        pulse_chance_dial = new QDial();
+        pulse_chance_dial->setRange(0, 100);
+        pulse_chance_dial->setValue(100);
+        pulse_chance_dial->setNotchesVisible(true);
+        fill_chance_label = new QLabel("Fill chance");
+        fill_chance_dial = new QDial();
+        fill_chance_dial->setRange(0, 100);
+        fill_chance_dial->setNotchesVisible(true);
+        euclid_layout = new QGridLayout();
+        euclid_layout->addWidget(euclid_steps_label, 0, 0);
+        euclid_layout->addWidget(euclid_steps_dial, 1, 0);
+        euclid_layout->addWidget(euclid_pulses_label, 0, 1);
+        euclid_layout->addWidget(euclid_pulses_dial, 1, 1);
+        euclid_layout->addWidget(euclid_rotate_label, 0, 2);
+        euclid_layout->addWidget(euclid_rotate_dial, 1, 2);
+        euclid_layout->addWidget(pulse_chance_label, 2, 0);
+        euclid_layout->addWidget(pulse_chance_dial, 3, 0);
+        euclid_layout->addWidget(fill_chance_label, 2, 1);
+        euclid_layout->addWidget(fill_chance_dial, 3, 1);
+        euclid_group->setLayout(euclid_layout);
+
+        ratchet_group = new QGroupBox();
+        ratchet_label = new QLabel("Ratchet");
+        ratchet_dial = new QDial();
+        ratchet_dial->setRange(1, 8);
+        ratchet_dial->setNotchesVisible(true);
+        strum_label = new QLabel("Strum");
+        strum_dial = new QDial();
+        strum_dial->setRange(0, 100);
+        strum_dial->setNotchesVisible(true);
+        ratchet_layout = new QGridLayout();
+        ratchet_layout->addWidget(ratchet_label, 0, 0);
+        ratchet_layout->addWidget(ratchet_dial, 1, 0);
+        ratchet_layout->addWidget(strum_label, 0, 1);
+        ratchet_layout->addWidget(strum_dial, 1, 1);
+        ratchet_group->setLayout(ratchet_layout);
+
         cycle_group = new QGroupBox();
         cycle_label = new QLabel("cycle");
         cycle_dial = new QDial();
@@ -191,39 +456,232 @@ SimpleArpeggiatorGUI::SimpleArpeggiatorGUI(QWidget* parent)
         cycle_layout->addItem(cycle_spacer);
         cycle_group->setLayout(cycle_layout);
 
+        sync_group = new QGroupBox();
+        sync_label = new QLabel("sync");
+        sync_auto = new QRadioButton("auto");
+        sync_internal = new QRadioButton("internal");
+        sync_midi = new QRadioButton("MIDI clock");
+        tempo_label = new QLabel("Tempo");
+        tempo_dial = new QDial();
+        tempo_dial->setRange(20, 300);
+        tempo_dial->setValue(120);
+        tempo_dial->setNotchesVisible(true);
+        sync_spacer = new QSpacerItem(20,40,QSizePolicy::Minimum, QSizePolicy::Expanding);
+        sync_layout = new QVBoxLayout();
+        sync_layout->addWidget(sync_label);
+        sync_layout->addWidget(sync_auto);
+        sync_layout->addWidget(sync_internal);
+        sync_layout->addWidget(sync_midi);
+        sync_layout->addWidget(tempo_label);
+        sync_layout->addWidget(tempo_dial);
+        sync_layout->addItem(sync_spacer);
+        sync_group->setLayout(sync_layout);
+
+        channels_group = new QGroupBox();
+        channels_label = new QLabel("channels");
+        channels_omni = new QRadioButton("omni");
+        channels_multi = new QRadioButton("multi");
+        channels_layout = new QVBoxLayout();
+        channels_layout->addWidget(channels_label);
+        channels_layout->addWidget(channels_omni);
+        channels_layout->addWidget(channels_multi);
+        channels_group->setLayout(channels_layout);
+
+        pattern_group = new QGroupBox();
+        pattern_label = new QLabel("pattern");
+        pattern_polymeter = new QCheckBox("polymeter");
+        pattern_polymeter->setChecked(true);
+        pattern_load = new QPushButton("Load...");
+        pattern_layout = new QVBoxLayout();
+        pattern_layout->addWidget(pattern_label);
+        pattern_layout->addWidget(pattern_polymeter);
+        pattern_layout->addWidget(pattern_load);
+        pattern_group->setLayout(pattern_layout);
+
+        groove_group = new QGroupBox();
+        groove_label = new QLabel("groove");
+        groove_none = new QRadioButton("none");
+        groove_shuffle = new QRadioButton("shuffle");
+        groove_laid_back = new QRadioButton("laid back");
+        groove_push = new QRadioButton("push");
+        groove_user = new QRadioButton("user");
+        groove_load = new QPushButton("Load...");
+        swing_label = new QLabel("Swing");
+        swing_dial = new QDial();
+        swing_dial->setRange(0, 100);
+        swing_dial->setNotchesVisible(true);
+        groove_spacer = new QSpacerItem(20,40,QSizePolicy::Minimum, QSizePolicy::Expanding);
+        groove_layout = new QVBoxLayout();
+        groove_layout->addWidget(groove_label);
+        groove_layout->addWidget(groove_none);
+        groove_layout->addWidget(groove_shuffle);
+        groove_layout->addWidget(groove_laid_back);
+        groove_layout->addWidget(groove_push);
+        groove_layout->addWidget(groove_user);
+        groove_layout->addWidget(groove_load);
+        groove_layout->addWidget(swing_label);
+        groove_layout->addWidget(swing_dial);
+        groove_layout->addItem(groove_spacer);
+        groove_group->setLayout(groove_layout);
+
+        // the radio buttons are in two groups of their own, so that
+        // picking an accent doesn't clear the curve
+        velocity_group = new QGroupBox();
+        velocity_label = new QLabel("velocity");
+        velocity_linear = new QRadioButton("linear");
+        velocity_soft = new QRadioButton("soft");
+        velocity_hard = new QRadioButton("hard");
+        velocity_fixed = new QRadioButton("fixed");
+        QButtonGroup* curve_buttons = new QButtonGroup(velocity_group);
+        curve_buttons->addButton(velocity_linear);
+        curve_buttons->addButton(velocity_soft);
+        curve_buttons->addButton(velocity_hard);
+        curve_buttons->addButton(velocity_fixed);
+        accent_label = new QLabel("accent");
+        accent_none = new QRadioButton("none");
+        accent_downbeats = new QRadioButton("downbeats");
+        accent_offbeats = new QRadioButton("offbeats");
+        accent_alternate = new QRadioButton("alternate");
+        accent_3_3_2 = new QRadioButton("3-3-2");
+        QButtonGroup* accent_buttons = new QButtonGroup(velocity_group);
+        accent_buttons->addButton(accent_none);
+        accent_buttons->addButton(accent_downbeats);
+        accent_buttons->addButton(accent_offbeats);
+        accent_buttons->addButton(accent_alternate);
+        accent_buttons->addButton(accent_3_3_2);
+        accent_level_label = new QLabel("Accent level");
+        accent_level_dial = new QDial();
+        accent_level_dial->setRange(0, 100);
+        accent_level_dial->setValue(50);
+        accent_level_dial->setNotchesVisible(true);
+        velocity_spacer = new QSpacerItem(20,40,QSizePolicy::Minimum, QSizePolicy::Expanding);
+        velocity_layout = new QVBoxLayout();
+        velocity_layout->addWidget(velocity_label);
+        velocity_layout->addWidget(velocity_linear);
+        velocity_layout->addWidget(velocity_soft);
+        velocity_layout->addWidget(velocity_hard);
+        velocity_layout->addWidget(velocity_fixed);
+        velocity_layout->addWidget(accent_label);
+        velocity_layout->addWidget(accent_none);
+        velocity_layout->addWidget(accent_downbeats);
+        velocity_layout->addWidget(accent_offbeats);
+        velocity_layout->addWidget(accent_alternate);
+        velocity_layout->addWidget(accent_3_3_2);
+        velocity_layout->addWidget(accent_level_label);
+        velocity_layout->addWidget(accent_level_dial);
+        velocity_layout->addItem(velocity_spacer);
+        velocity_group->setLayout(velocity_layout);
+
+        scale_group = new QGroupBox();
+        key_label = new QLabel("Key");
+        key_dial = new QDial();
+        key_dial->setRange(0, 11);
+        key_dial->setNotchesVisible(true);
+        scale_label = new QLabel("scale");
+        scale_box = new QComboBox();
+        scale_box->addItem("chromatic");
+        scale_box->addItem("major");
+        scale_box->addItem("minor");
+        scale_box->addItem("harmonic minor");
+        scale_box->addItem("dorian");
+        scale_box->addItem("phrygian");
+        scale_box->addItem("lydian");
+        scale_box->addItem("mixolydian");
+        scale_box->addItem("locrian");
+        scale_box->addItem("major pentatonic");
+        scale_box->addItem("minor pentatonic");
+        scale_box->addItem("blues");
+        scale_box->addItem("user");
+        // the user scale's notes, in semitones above the key
+        user_scale_layout = new QGridLayout();
+        for(int i = 0; i < 12; i++) {
+            user_scale[i] = new QCheckBox(QString::number(i));
+            user_scale_layout->addWidget(user_scale[i], i / 6, i % 6);
+        }
+        scale_spacer = new QSpacerItem(20,40,QSizePolicy::Minimum, QSizePolicy::Expanding);
+        scale_layout = new QVBoxLayout();
+        scale_layout->addWidget(key_label);
+        scale_layout->addWidget(key_dial);
+        scale_layout->addWidget(scale_label);
+        scale_layout->addWidget(scale_box);
+        scale_layout->addLayout(user_scale_layout);
+        scale_layout->addItem(scale_spacer);
+        scale_group->setLayout(scale_layout);
+
+        load_group = new QGroupBox();
+        load_label = new QLabel("DSP load");
+        load_info = new QLabel("no data");
+        load_histogram = new QLabel();
+        load_histogram->setFont(QFont("Monospace", 7));
+        load_layout = new QVBoxLayout();
+        load_layout->addWidget(load_label);
+        load_layout->addWidget(load_info);
+        load_layout->addWidget(load_histogram);
+        load_group->setLayout(load_layout);
+
         layout = new QHBoxLayout();
         v1_layout = new QVBoxLayout();
         v2_layout = new QVBoxLayout();
         v3_layout = new QVBoxLayout();
         v1_layout->addWidget(chord_group);
         v1_layout->addWidget(dir_group);
+        v1_layout->addWidget(mode_group);
         v2_layout->addWidget(range_group);
         v2_layout->addWidget(cycle_group);
+        v2_layout->addWidget(sync_group);
+        v2_layout->addWidget(channels_group);
+        v2_layout->addWidget(scale_group);
         v3_layout->addWidget(gate_group);
+        v3_layout->addWidget(ratchet_group);
         v3_layout->addWidget(skip_group);
+        v3_layout->addWidget(euclid_group);
+        v3_layout->addWidget(pattern_group);
+        v3_layout->addWidget(load_group);
         layout->addLayout(v1_layout);
         layout->addWidget(time_group);
+        layout->addWidget(groove_group);
+        layout->addWidget(velocity_group);
         layout->addLayout(v2_layout);
         layout->addLayout(v3_layout);
         setLayout(layout);
 
 #ifndef QT_NO_TOOLTIP
-        chord_group->setToolTip("The chord defines what notes are played in each octave");
+        chord_group->setToolTip("The chord defines what notes are played in each octave. The boxes below set the intervals of the user chord, in semitones above the root.");
+        scale_group->setToolTip("Every note played is moved to the nearest note of the scale in this key. The boxes set the notes of the user scale, in semitones above the key.");
         dir_group->setToolTip("How the arpeggio is played");
+        mode_group->setToolTip("Transpose plays the chord from the first held key, the other modes arpeggiate all held keys");
         time_group->setToolTip("The length of each arpeggio note");
         range_group->setToolTip("The arpeggio range in octaves");
-        gate_group->setToolTip("The percentiage of a whole apreggio note that should be played. Seting it to less than 100% can create cool staccato effects.");
+        gate_group->setToolTip("The percentiage of a whole apreggio note that should be played. Seting it to less than 100% can create cool staccato effects, and more than 100% lets notes overlap.");
         cycle_group->setToolTip("Cycle will jump over the 1-6th step in the arpeggio");
         skip_group->setToolTip("Skip will cause the arpeggio to pause randomly if set to more than 0%");
+        ratchet_group->setToolTip("Ratchet plays every step as 1 to 8 hits, evenly spaced over the step, and the gate is then a percentage of a hit. Strum spreads the notes of a chord over a part of each hit. The rhythm lane of a pattern file can give steps their own number of hits.");
+        euclid_group->setToolTip("A Euclidean rhythm spreads the pulses as evenly as possible over a cycle of steps, and the other steps are silent. Rotate starts the cycle later in the rhythm. The chances set how often the pulses and the steps between them play. 0 steps turns the rhythm off.");
+        sync_group->setToolTip("Auto follows the host's transport, and runs on the tempo below when the host has none. Internal always uses the tempo below. MIDI clock follows the clock messages on the MIDI input.");
+        channels_group->setToolTip("Omni plays the keys of every MIDI channel as one arpeggio on channel 1. Multi plays an arpeggio for each channel, on that channel, all with the same settings.");
+        pattern_group->setToolTip("Load reads a pattern file with separate lanes for the pitch order, rhythm, gate and velocity, each with its own length. Polymeter switches the loaded pattern on and off.");
+        groove_group->setToolTip("Moves the steps off the grid and changes their velocity, repeating every 16 steps. Swing delays every second step. Load reads a user groove file, with one line per step giving the offset in percent of a step and the velocity in percent.");
+        velocity_group->setToolTip("The velocity curve is applied to the velocity of the held keys; fixed always plays at full velocity. Accented steps are moved towards full velocity by the accent level.");
+        load_group->setToolTip("Time spent in the plugin's run() callback, and events lost because the host's output buffer was full");
 #endif
 
         chord_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
         dir_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        mode_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
         time_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
         range_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
         gate_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
         cycle_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
         skip_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        euclid_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        ratchet_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        sync_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        channels_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        pattern_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        groove_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        velocity_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        scale_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
+        load_group->setStyleSheet("QGroupBox {  border: 1px solid gray;}");
     }
 
 SimpleArpeggiatorGUI::~SimpleArpeggiatorGUI() {
@@ -237,6 +695,15 @@ void SimpleArpeggiatorGUI::chordChanged(bool checked) {
     if(chord_octave->isChecked()) chord = 0;
     if(chord_major->isChecked()) chord = 1;
     if(chord_minor->isChecked()) chord = 2;
+    if(chord_major7->isChecked()) chord = 3;
+    if(chord_minor7->isChecked()) chord = 4;
+    if(chord_dominant7->isChecked()) chord = 5;
+    if(chord_sus2->isChecked()) chord = 6;
+    if(chord_sus4->isChecked()) chord = 7;
+    if(chord_diminished->isChecked()) chord = 8;
+    if(chord_augmented->isChecked()) chord = 9;
+    if(chord_power->isChecked()) chord = 10;
+    if(chord_user->isChecked()) chord = 11;
     write_function(controller, SIMPLEARPEGGIATOR_CHORD, sizeof(gate), 0, &chord);
 }
 
@@ -276,6 +743,52 @@ void SimpleArpeggiatorGUI::skipChanged(int value) {
     write_function(controller, SIMPLEARPEGGIATOR_SKIP, sizeof(skip), 0, &skip);
 }
 
+void SimpleArpeggiatorGUI::euclidStepsChanged(int value) {
+    float steps = euclid_steps_dial->value();
+    if(steps > 0) {
+        euclid_steps_label->setText(QString("Euclid steps: %1").arg(steps));
+    } else {
+        euclid_steps_label->setText("Euclid steps: off");
+    }
+    write_function(controller, SIMPLEARPEGGIATOR_EUCLID_STEPS, sizeof(steps), 0, &steps);
+}
+
+void SimpleArpeggiatorGUI::euclidPulsesChanged(int value) {
+    float pulses = euclid_pulses_dial->value();
+    euclid_pulses_label->setText(QString("Pulses: %1").arg(pulses));
+    write_function(controller, SIMPLEARPEGGIATOR_EUCLID_PULSES, sizeof(pulses), 0, &pulses);
+}
+
+void SimpleArpeggiatorGUI::euclidRotateChanged(int value) {
+    float rotate = euclid_rotate_dial->value();
+    euclid_rotate_label->setText(QString("Rotate: %1").arg(rotate));
+    write_function(controller, SIMPLEARPEGGIATOR_EUCLID_ROTATE, sizeof(rotate), 0, &rotate);
+}
+
+void SimpleArpeggiatorGUI::pulseChanceChanged(int value) {
+    float chance = pulse_chance_dial->value();
+    pulse_chance_label->setText(QString("Pulse chance: %1 %").arg(chance));
+    write_function(controller, SIMPLEARPEGGIATOR_PULSE_CHANCE, sizeof(chance), 0, &chance);
+}
+
+void SimpleArpeggiatorGUI::fillChanceChanged(int value) {
+    float chance = fill_chance_dial->value();
+    fill_chance_label->setText(QString("Fill chance: %1 %").arg(chance));
+    write_function(controller, SIMPLEARPEGGIATOR_FILL_CHANCE, sizeof(chance), 0, &chance);
+}
+
+void SimpleArpeggiatorGUI::ratchetChanged(int value) {
+    float ratchet = ratchet_dial->value();
+    ratchet_label->setText(QString("Ratchet: %1").arg(ratchet));
+    write_function(controller, SIMPLEARPEGGIATOR_RATCHET, sizeof(ratchet), 0, &ratchet);
+}
+
+void SimpleArpeggiatorGUI::strumChanged(int value) {
+    float strum = strum_dial->value();
+    strum_label->setText(QString("Strum: %1 %").arg(strum));
+    write_function(controller, SIMPLEARPEGGIATOR_STRUM, sizeof(strum), 0, &strum);
+}
+
 void SimpleArpeggiatorGUI::dirChanged(bool checked) {
     float dir = 0;
     if(!checked) return;
@@ -285,6 +798,204 @@ void SimpleArpeggiatorGUI::dirChanged(bool checked) {
     write_function(controller, SIMPLEARPEGGIATOR_DIR, sizeof(gate), 0, &dir);
 }
 
+void SimpleArpeggiatorGUI::modeChanged(bool checked) {
+    float mode = 0;
+    if(!checked) return;
+    if(mode_transpose->isChecked()) mode = 0;
+    if(mode_sorted->isChecked()) mode = 1;
+    if(mode_asplayed->isChecked()) mode = 2;
+    if(mode_chord->isChecked()) mode = 3;
+    write_function(controller, SIMPLEARPEGGIATOR_MODE, sizeof(mode), 0, &mode);
+}
+
+void SimpleArpeggiatorGUI::syncChanged(bool checked) {
+    float sync = 0;
+    if(!checked) return;
+    if(sync_auto->isChecked()) sync = SYNC_AUTO;
+    if(sync_internal->isChecked()) sync = SYNC_INTERNAL;
+    if(sync_midi->isChecked()) sync = SYNC_MIDI;
+    write_function(controller, SIMPLEARPEGGIATOR_SYNC, sizeof(sync), 0, &sync);
+}
+
+void SimpleArpeggiatorGUI::channelsChanged(bool checked) {
+    float channels = CHANNELS_OMNI;
+    if(!checked) return;
+    if(channels_multi->isChecked()) channels = CHANNELS_MULTI;
+    write_function(controller, SIMPLEARPEGGIATOR_CHANNELS, sizeof(channels), 0, &channels);
+}
+
+void SimpleArpeggiatorGUI::tempoChanged(int value) {
+    float tempo = tempo_dial->value();
+    tempo_label->setText(QString("Tempo: %1 bpm").arg(tempo));
+    write_function(controller, SIMPLEARPEGGIATOR_TEMPO, sizeof(tempo), 0, &tempo);
+}
+
+void SimpleArpeggiatorGUI::grooveChanged(bool checked) {
+    float groove = 0;
+    if(!checked) return;
+    if(groove_none->isChecked()) groove = 0;
+    if(groove_shuffle->isChecked()) groove = 1;
+    if(groove_laid_back->isChecked()) groove = 2;
+    if(groove_push->isChecked()) groove = 3;
+    if(groove_user->isChecked()) groove = 4;
+    write_function(controller, SIMPLEARPEGGIATOR_GROOVE, sizeof(groove), 0, &groove);
+}
+
+void SimpleArpeggiatorGUI::swingChanged(int value) {
+    float swing = swing_dial->value();
+    swing_label->setText(QString("Swing: %1 %").arg(swing));
+    write_function(controller, SIMPLEARPEGGIATOR_SWING, sizeof(swing), 0, &swing);
+}
+
+void SimpleArpeggiatorGUI::velocityChanged(bool checked) {
+    float velocity = 0;
+    if(!checked) return;
+    if(velocity_linear->isChecked()) velocity = 0;
+    if(velocity_soft->isChecked()) velocity = 1;
+    if(velocity_hard->isChecked()) velocity = 2;
+    if(velocity_fixed->isChecked()) velocity = 3;
+    write_function(controller, SIMPLEARPEGGIATOR_VELOCITY, sizeof(velocity), 0, &velocity);
+}
+
+void SimpleArpeggiatorGUI::accentChanged(bool checked) {
+    float accent = 0;
+    if(!checked) return;
+    if(accent_none->isChecked()) accent = 0;
+    if(accent_downbeats->isChecked()) accent = 1;
+    if(accent_offbeats->isChecked()) accent = 2;
+    if(accent_alternate->isChecked()) accent = 3;
+    if(accent_3_3_2->isChecked()) accent = 4;
+    write_function(controller, SIMPLEARPEGGIATOR_ACCENT, sizeof(accent), 0, &accent);
+}
+
+void SimpleArpeggiatorGUI::accentLevelChanged(int value) {
+    float level = accent_level_dial->value();
+    accent_level_label->setText(QString("Accent level: %1 %").arg(level));
+    write_function(controller, SIMPLEARPEGGIATOR_ACCENT_LEVEL, sizeof(level), 0, &level);
+}
+
+void SimpleArpeggiatorGUI::userChordChanged(bool checked) {
+    int mask = 0;
+    for(int i = 0; i < 12; i++) {
+        if(user_chord[i]->isChecked()) mask |= 1 << i;
+    }
+    float intervals = mask;
+    write_function(controller, SIMPLEARPEGGIATOR_USER_CHORD, sizeof(intervals), 0, &intervals);
+}
+
+void SimpleArpeggiatorGUI::keyChanged(int value) {
+    static const char* names[12] = {
+        "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"
+    };
+    float key = key_dial->value();
+    key_label->setText(QString("Key: %1").arg(names[key_dial->value()]));
+    write_function(controller, SIMPLEARPEGGIATOR_KEY, sizeof(key), 0, &key);
+}
+
+void SimpleArpeggiatorGUI::scaleChanged(int index) {
+    float scale = index;
+    write_function(controller, SIMPLEARPEGGIATOR_SCALE, sizeof(scale), 0, &scale);
+}
+
+void SimpleArpeggiatorGUI::userScaleChanged(bool checked) {
+    int mask = 0;
+    for(int i = 0; i < 12; i++) {
+        if(user_scale[i]->isChecked()) mask |= 1 << i;
+    }
+    float notes = mask;
+    write_function(controller, SIMPLEARPEGGIATOR_USER_SCALE, sizeof(notes), 0, &notes);
+}
+
+// Sends a file path to the plugin as a patch:Set of the property
+bool SimpleArpeggiatorGUI::sendPath(LV2_URID property, const QString& name) {
+    QByteArray path = name.toLocal8Bit();
+
+    uint8_t buffer[2048];
+    lv2_atom_forge_set_buffer(&forge, buffer, sizeof(buffer));
+    LV2_Atom_Forge_Frame frame;
+    LV2_Atom* set = (LV2_Atom*) lv2_atom_forge_object(&forge, &frame, 0, patch_Set);
+    lv2_atom_forge_key(&forge, patch_property);
+    lv2_atom_forge_urid(&forge, property);
+    lv2_atom_forge_key(&forge, patch_value);
+    lv2_atom_forge_path(&forge, path.constData(), path.size());
+    lv2_atom_forge_pop(&forge, &frame);
+    if(!set) return false; // path too long for the buffer
+
+    write_function(controller, SIMPLEARPEGGIATOR_IN,
+            lv2_atom_total_size(set), atom_eventTransfer, set);
+    return true;
+}
+
+void SimpleArpeggiatorGUI::loadGroove() {
+    QString name = QFileDialog::getOpenFileName(this, "Load groove", QString(),
+            "Groove files (*.groove);;All files (*)");
+    if(name.isEmpty()) return;
+    if(sendPath(groove_file, name)) groove_user->setChecked(true);
+}
+
+void SimpleArpeggiatorGUI::polymeterChanged(bool checked) {
+    float polymeter = checked ? 1 : 0;
+    write_function(controller, SIMPLEARPEGGIATOR_POLYMETER, sizeof(polymeter), 0, &polymeter);
+}
+
+void SimpleArpeggiatorGUI::loadPattern() {
+    QString name = QFileDialog::getOpenFileName(this, "Load pattern", QString(),
+            "Pattern files (*.pattern);;All files (*)");
+    if(name.isEmpty()) return;
+    if(sendPath(pattern_file, name)) pattern_polymeter->setChecked(true);
+}
+
+void SimpleArpeggiatorGUI::showLoad(const LV2_Atom_Object* obj) {
+    const LV2_Atom* calls = NULL;
+    const LV2_Atom* events = NULL;
+    const LV2_Atom* overflows = NULL;
+    const LV2_Atom* mean = NULL;
+    const LV2_Atom* max = NULL;
+    const LV2_Atom* load = NULL;
+    const LV2_Atom* histogram = NULL;
+    lv2_atom_object_get(obj,
+            load_calls, &calls,
+            load_events, &events,
+            load_overflows, &overflows,
+            load_meanTime, &mean,
+            load_maxTime, &max,
+            load_load, &load,
+            load_histogram_urid, &histogram,
+            0);
+    if(!calls || calls->type != atom_Long || !events || events->type != atom_Long ||
+            !overflows || overflows->type != atom_Long ||
+            !mean || mean->type != atom_Float || !max || max->type != atom_Float ||
+            !load || load->type != atom_Float) {
+        return;
+    }
+
+    load_info->setText(QString("load %1 %, mean %2 us, max %3 us\n"
+                "events %4, overflows %5")
+            .arg(((const LV2_Atom_Float*) load)->body * 100, 0, 'f', 2)
+            .arg(((const LV2_Atom_Float*) mean)->body / 1000, 0, 'f', 1)
+            .arg(((const LV2_Atom_Float*) max)->body / 1000, 0, 'f', 1)
+            .arg(((const LV2_Atom_Long*) events)->body)
+            .arg(((const LV2_Atom_Long*) overflows)->body));
+
+    // one row per non-empty bucket, with the share of all calls
+    if(!histogram || histogram->type != atom_Vector) return;
+    const LV2_Atom_Vector* vec = (const LV2_Atom_Vector*) histogram;
+    const uint32_t* counts = (const uint32_t*) (vec + 1);
+    uint32_t n = (vec->atom.size - sizeof(LV2_Atom_Vector_Body)) / sizeof(uint32_t);
+    int64_t total = ((const LV2_Atom_Long*) calls)->body;
+    QString text;
+    for(uint32_t i = 0; i < n && i < DSPLOAD_BUCKETS && total > 0; i++) {
+        if(counts[i] == 0) continue;
+        double limit_us = (1ull << (DSPLOAD_MIN_SHIFT + i)) / 1000.0;
+        int bar = (int) (20.0 * counts[i] / total + 0.5);
+        text += QString("%1%2 us %3\n")
+            .arg(i == DSPLOAD_BUCKETS - 1 ? ">" : "<")
+            .arg(i == DSPLOAD_BUCKETS - 1 ? limit_us / 2 : limit_us, 7, 'f', 1)
+            .arg(QString(bar, '#'));
+    }
+    load_histogram->setText(text);
+}
+
 LV2UI_Handle instantiate(const struct _LV2UI_Descriptor* descriptor,
         const char* plugin_uri, const char* bundle_path,
         LV2UI_Write_Function write_function,
@@ -296,11 +1007,43 @@ LV2UI_Handle instantiate(const struct _LV2UI_Descriptor* descriptor,
         return NULL;
     }
 
+    LV2_URID_Map* map = NULL;
+    for (int i = 0; features[i]; ++i) {
+        if (!strcmp(features[i]->URI, LV2_URID__map)) {
+            map = (LV2_URID_Map*)features[i]->data;
+        }
+    }
+    if (!map) {
+        fprintf(stderr, "AMP_UI error: host does not support urid:map\n");
+        return NULL;
+    }
+
     SimpleArpeggiatorGUI* pluginGui = new SimpleArpeggiatorGUI();
     *widget = pluginGui;
 
     if (pluginGui == NULL) return NULL;
 
+    pluginGui->atom_eventTransfer = map->map(map->handle, LV2_ATOM__eventTransfer);
+    pluginGui->atom_Object = map->map(map->handle, LV2_ATOM__Object);
+    pluginGui->atom_Long = map->map(map->handle, LV2_ATOM__Long);
+    pluginGui->atom_Float = map->map(map->handle, LV2_ATOM__Float);
+    pluginGui->atom_Vector = map->map(map->handle, LV2_ATOM__Vector);
+    pluginGui->load_DSPLoad = map->map(map->handle, SIMPLEARPEGGIATOR__DSPLoad);
+    pluginGui->load_calls = map->map(map->handle, SIMPLEARPEGGIATOR__calls);
+    pluginGui->load_events = map->map(map->handle, SIMPLEARPEGGIATOR__events);
+    pluginGui->load_overflows = map->map(map->handle, SIMPLEARPEGGIATOR__overflows);
+    pluginGui->load_meanTime = map->map(map->handle, SIMPLEARPEGGIATOR__meanTime);
+    pluginGui->load_maxTime = map->map(map->handle, SIMPLEARPEGGIATOR__maxTime);
+    pluginGui->load_load = map->map(map->handle, SIMPLEARPEGGIATOR__load);
+    pluginGui->load_histogram_urid = map->map(map->handle, SIMPLEARPEGGIATOR__histogram);
+    pluginGui->atom_Path = map->map(map->handle, LV2_ATOM__Path);
+    pluginGui->patch_Set = map->map(map->handle, LV2_PATCH__Set);
+    pluginGui->patch_property = map->map(map->handle, LV2_PATCH__property);
+    pluginGui->patch_value = map->map(map->handle, LV2_PATCH__value);
+    pluginGui->groove_file = map->map(map->handle, SIMPLEARPEGGIATOR__grooveFile);
+    pluginGui->pattern_file = map->map(map->handle, SIMPLEARPEGGIATOR__patternFile);
+    lv2_atom_forge_init(&pluginGui->forge, map);
+
     pluginGui->controller = controller;
     pluginGui->write_function = write_function;
 
@@ -310,6 +1053,34 @@ LV2UI_Handle instantiate(const struct _LV2UI_Descriptor* descriptor,
             pluginGui, SLOT(chordChanged(bool)));
     QObject::connect(pluginGui->chord_minor, SIGNAL(toggled(bool)),
             pluginGui, SLOT(chordChanged(bool)));
+    QObject::connect(pluginGui->chord_major7, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(chordChanged(bool)));
+    QObject::connect(pluginGui->chord_minor7, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(chordChanged(bool)));
+    QObject::connect(pluginGui->chord_dominant7, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(chordChanged(bool)));
+    QObject::connect(pluginGui->chord_sus2, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(chordChanged(bool)));
+    QObject::connect(pluginGui->chord_sus4, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(chordChanged(bool)));
+    QObject::connect(pluginGui->chord_diminished, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(chordChanged(bool)));
+    QObject::connect(pluginGui->chord_augmented, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(chordChanged(bool)));
+    QObject::connect(pluginGui->chord_power, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(chordChanged(bool)));
+    QObject::connect(pluginGui->chord_user, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(chordChanged(bool)));
+    for(int i = 0; i < 12; i++) {
+        QObject::connect(pluginGui->user_chord[i], SIGNAL(toggled(bool)),
+                pluginGui, SLOT(userChordChanged(bool)));
+        QObject::connect(pluginGui->user_scale[i], SIGNAL(toggled(bool)),
+                pluginGui, SLOT(userScaleChanged(bool)));
+    }
+    QObject::connect(pluginGui->key_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(keyChanged(int)));
+    QObject::connect(pluginGui->scale_box, SIGNAL(currentIndexChanged(int)),
+            pluginGui, SLOT(scaleChanged(int)));
     QObject::connect(pluginGui->time_1_1, SIGNAL(toggled(bool)),
             pluginGui, SLOT(timeChanged(bool)));
     QObject::connect(pluginGui->time_1_2, SIGNAL(toggled(bool)),
@@ -330,12 +1101,84 @@ LV2UI_Handle instantiate(const struct _LV2UI_Descriptor* descriptor,
             pluginGui, SLOT(cycleChanged(int)));
     QObject::connect(pluginGui->skip_dial, SIGNAL(valueChanged(int)),
             pluginGui, SLOT(skipChanged(int)));
+    QObject::connect(pluginGui->euclid_steps_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(euclidStepsChanged(int)));
+    QObject::connect(pluginGui->euclid_pulses_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(euclidPulsesChanged(int)));
+    QObject::connect(pluginGui->euclid_rotate_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(euclidRotateChanged(int)));
+    QObject::connect(pluginGui->pulse_chance_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(pulseChanceChanged(int)));
+    QObject::connect(pluginGui->fill_chance_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(fillChanceChanged(int)));
+    QObject::connect(pluginGui->ratchet_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(ratchetChanged(int)));
+    QObject::connect(pluginGui->strum_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(strumChanged(int)));
     QObject::connect(pluginGui->dir_up, SIGNAL(toggled(bool)),
             pluginGui, SLOT(dirChanged(bool)));
     QObject::connect(pluginGui->dir_down, SIGNAL(toggled(bool)),
             pluginGui, SLOT(dirChanged(bool)));
     QObject::connect(pluginGui->dir_updown, SIGNAL(toggled(bool)),
             pluginGui, SLOT(dirChanged(bool)));
+    QObject::connect(pluginGui->mode_transpose, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(modeChanged(bool)));
+    QObject::connect(pluginGui->mode_sorted, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(modeChanged(bool)));
+    QObject::connect(pluginGui->mode_asplayed, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(modeChanged(bool)));
+    QObject::connect(pluginGui->mode_chord, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(modeChanged(bool)));
+    QObject::connect(pluginGui->sync_auto, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(syncChanged(bool)));
+    QObject::connect(pluginGui->sync_internal, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(syncChanged(bool)));
+    QObject::connect(pluginGui->sync_midi, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(syncChanged(bool)));
+    QObject::connect(pluginGui->channels_omni, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(channelsChanged(bool)));
+    QObject::connect(pluginGui->channels_multi, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(channelsChanged(bool)));
+    QObject::connect(pluginGui->tempo_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(tempoChanged(int)));
+    QObject::connect(pluginGui->groove_none, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(grooveChanged(bool)));
+    QObject::connect(pluginGui->groove_shuffle, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(grooveChanged(bool)));
+    QObject::connect(pluginGui->groove_laid_back, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(grooveChanged(bool)));
+    QObject::connect(pluginGui->groove_push, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(grooveChanged(bool)));
+    QObject::connect(pluginGui->groove_user, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(grooveChanged(bool)));
+    QObject::connect(pluginGui->groove_load, SIGNAL(clicked()),
+            pluginGui, SLOT(loadGroove()));
+    QObject::connect(pluginGui->pattern_polymeter, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(polymeterChanged(bool)));
+    QObject::connect(pluginGui->pattern_load, SIGNAL(clicked()),
+            pluginGui, SLOT(loadPattern()));
+    QObject::connect(pluginGui->swing_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(swingChanged(int)));
+    QObject::connect(pluginGui->velocity_linear, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(velocityChanged(bool)));
+    QObject::connect(pluginGui->velocity_soft, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(velocityChanged(bool)));
+    QObject::connect(pluginGui->velocity_hard, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(velocityChanged(bool)));
+    QObject::connect(pluginGui->velocity_fixed, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(velocityChanged(bool)));
+    QObject::connect(pluginGui->accent_none, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(accentChanged(bool)));
+    QObject::connect(pluginGui->accent_downbeats, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(accentChanged(bool)));
+    QObject::connect(pluginGui->accent_offbeats, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(accentChanged(bool)));
+    QObject::connect(pluginGui->accent_alternate, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(accentChanged(bool)));
+    QObject::connect(pluginGui->accent_3_3_2, SIGNAL(toggled(bool)),
+            pluginGui, SLOT(accentChanged(bool)));
+    QObject::connect(pluginGui->accent_level_dial, SIGNAL(valueChanged(int)),
+            pluginGui, SLOT(accentLevelChanged(int)));
 
     return (LV2UI_Handle)pluginGui;
 }
@@ -352,6 +1195,16 @@ void port_event(LV2UI_Handle ui, uint32_t port_index, uint32_t buffer_size,
     float* pval = (float*) buffer;
     int n;
 
+    if (port_index == SIMPLEARPEGGIATOR_NOTIFY &&
+            format == pluginGui->atom_eventTransfer) {
+        const LV2_Atom_Object* obj = (const LV2_Atom_Object*) buffer;
+        if (obj->atom.type == pluginGui->atom_Object &&
+                obj->body.otype == pluginGui->load_DSPLoad) {
+            pluginGui->showLoad(obj);
+        }
+        return;
+    }
+
     if ((format != 0) || (port_index < 0) || (port_index >= SIMPLEARPEGGIATOR_N_PORTS)) {
         return;
     }
@@ -363,6 +1216,38 @@ void port_event(LV2UI_Handle ui, uint32_t port_index, uint32_t buffer_size,
             if(n == 0) pluginGui->chord_octave->setChecked(true);
             if(n == 1) pluginGui->chord_major->setChecked(true);
             if(n == 2) pluginGui->chord_minor->setChecked(true);
+            if(n == 3) pluginGui->chord_major7->setChecked(true);
+            if(n == 4) pluginGui->chord_minor7->setChecked(true);
+            if(n == 5) pluginGui->chord_dominant7->setChecked(true);
+            if(n == 6) pluginGui->chord_sus2->setChecked(true);
+            if(n == 7) pluginGui->chord_sus4->setChecked(true);
+            if(n == 8) pluginGui->chord_diminished->setChecked(true);
+            if(n == 9) pluginGui->chord_augmented->setChecked(true);
+            if(n == 10) pluginGui->chord_power->setChecked(true);
+            if(n == 11) pluginGui->chord_user->setChecked(true);
+            break;
+        case SIMPLEARPEGGIATOR_USER_CHORD:
+            // one write for the whole mask, not one per box
+            n = (int) (*pval  + 0.5);
+            for(int i = 0; i < 12; i++) {
+                pluginGui->user_chord[i]->blockSignals(true);
+                pluginGui->user_chord[i]->setChecked((n >> i) & 1);
+                pluginGui->user_chord[i]->blockSignals(false);
+            }
+            break;
+        case SIMPLEARPEGGIATOR_KEY:
+            pluginGui->key_dial->setValue((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_SCALE:
+            pluginGui->scale_box->setCurrentIndex((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_USER_SCALE:
+            n = (int) (*pval  + 0.5);
+            for(int i = 0; i < 12; i++) {
+                pluginGui->user_scale[i]->blockSignals(true);
+                pluginGui->user_scale[i]->setChecked((n >> i) & 1);
+                pluginGui->user_scale[i]->blockSignals(false);
+            }
             break;
         case SIMPLEARPEGGIATOR_TIME:
             n = (int) (*pval  + 0.5);
@@ -385,12 +1270,86 @@ void port_event(LV2UI_Handle ui, uint32_t port_index, uint32_t buffer_size,
         case SIMPLEARPEGGIATOR_SKIP:
             pluginGui->skip_dial->setValue((int)(*pval  + 0.5));
             break;
+        case SIMPLEARPEGGIATOR_EUCLID_STEPS:
+            pluginGui->euclid_steps_dial->setValue((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_EUCLID_PULSES:
+            pluginGui->euclid_pulses_dial->setValue((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_EUCLID_ROTATE:
+            pluginGui->euclid_rotate_dial->setValue((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_PULSE_CHANCE:
+            pluginGui->pulse_chance_dial->setValue((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_FILL_CHANCE:
+            pluginGui->fill_chance_dial->setValue((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_RATCHET:
+            pluginGui->ratchet_dial->setValue((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_STRUM:
+            pluginGui->strum_dial->setValue((int)(*pval  + 0.5));
+            break;
         case SIMPLEARPEGGIATOR_DIR:
             n = (int) (*pval  + 0.5);
             if(n == 0) pluginGui->dir_up->setChecked(true);
             if(n == 1) pluginGui->dir_down->setChecked(true);
             if(n == 2) pluginGui->dir_updown->setChecked(true);
             break;
+        case SIMPLEARPEGGIATOR_MODE:
+            n = (int) (*pval  + 0.5);
+            if(n == 0) pluginGui->mode_transpose->setChecked(true);
+            if(n == 1) pluginGui->mode_sorted->setChecked(true);
+            if(n == 2) pluginGui->mode_asplayed->setChecked(true);
+            if(n == 3) pluginGui->mode_chord->setChecked(true);
+            break;
+        case SIMPLEARPEGGIATOR_SYNC:
+            n = (int) (*pval  + 0.5);
+            if(n == SYNC_AUTO) pluginGui->sync_auto->setChecked(true);
+            if(n == SYNC_INTERNAL) pluginGui->sync_internal->setChecked(true);
+            if(n == SYNC_MIDI) pluginGui->sync_midi->setChecked(true);
+            break;
+        case SIMPLEARPEGGIATOR_CHANNELS:
+            n = (int) (*pval  + 0.5);
+            if(n == CHANNELS_OMNI) pluginGui->channels_omni->setChecked(true);
+            if(n == CHANNELS_MULTI) pluginGui->channels_multi->setChecked(true);
+            break;
+        case SIMPLEARPEGGIATOR_POLYMETER:
+            pluginGui->pattern_polymeter->setChecked(*pval > 0.5);
+            break;
+        case SIMPLEARPEGGIATOR_TEMPO:
+            pluginGui->tempo_dial->setValue((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_SWING:
+            pluginGui->swing_dial->setValue((int)(*pval  + 0.5));
+            break;
+        case SIMPLEARPEGGIATOR_GROOVE:
+            n = (int) (*pval  + 0.5);
+            if(n == 0) pluginGui->groove_none->setChecked(true);
+            if(n == 1) pluginGui->groove_shuffle->setChecked(true);
+            if(n == 2) pluginGui->groove_laid_back->setChecked(true);
+            if(n == 3) pluginGui->groove_push->setChecked(true);
+            if(n == 4) pluginGui->groove_user->setChecked(true);
+            break;
+        case SIMPLEARPEGGIATOR_VELOCITY:
+            n = (int) (*pval  + 0.5);
+            if(n == 0) pluginGui->velocity_linear->setChecked(true);
+            if(n == 1) pluginGui->velocity_soft->setChecked(true);
+            if(n == 2) pluginGui->velocity_hard->setChecked(true);
+            if(n == 3) pluginGui->velocity_fixed->setChecked(true);
+            break;
+        case SIMPLEARPEGGIATOR_ACCENT:
+            n = (int) (*pval  + 0.5);
+            if(n == 0) pluginGui->accent_none->setChecked(true);
+            if(n == 1) pluginGui->accent_downbeats->setChecked(true);
+            if(n == 2) pluginGui->accent_offbeats->setChecked(true);
+            if(n == 3) pluginGui->accent_alternate->setChecked(true);
+            if(n == 4) pluginGui->accent_3_3_2->setChecked(true);
+            break;
+        case SIMPLEARPEGGIATOR_ACCENT_LEVEL:
+            pluginGui->accent_level_dial->setValue((int)(*pval  + 0.5));
+            break;
     }
 }
 
@@ -3,33 +3,980 @@
 #include "minunit.h"
 
 #include "arpeggiator.c"
+#include "rtlog.c"
+#include "dspload.c"
 
 int tests_run = 0;
 
-int foo = 7;
-
 static char* test_note_as_fraction_of_bar() {
     // test notes a fraction of a bar in different time signatures
     float d = 0.001;
-    setTime(NOTE_1_1);
-    mu_assert("error, 1/1 in 4/4", fabs(note_as_fraction_of_bar(4, 4) - 1.0) < d);
-    setTime(NOTE_1_2);
-    mu_assert("error, 1/2 in 3/4", fabs(note_as_fraction_of_bar(3, 4) - 0.666) < d);
-    setTime(NOTE_1_8);
-    mu_assert("error, 1/8 in 4/4", fabs(note_as_fraction_of_bar(4, 4) - 0.125) < d);
-    setTime(NOTE_1_32);
-    mu_assert("error, 1/32 in 4/4", fabs(note_as_fraction_of_bar(4, 4) - 0.03125) < d);
-    setTime(NOTE_1_8);
-    mu_assert("error, 1/8 in 3/4", fabs(note_as_fraction_of_bar(3, 4)  - 0.1666) < d);
+    Arpeggiator arp = {0};
+    setTime(&arp, NOTE_1_1);
+    mu_assert("error, 1/1 in 4/4", fabs(note_as_fraction_of_bar(&arp, 4, 4) - 1.0) < d);
+    setTime(&arp, NOTE_1_2);
+    mu_assert("error, 1/2 in 3/4", fabs(note_as_fraction_of_bar(&arp, 3, 4) - 0.666) < d);
+    setTime(&arp, NOTE_1_8);
+    mu_assert("error, 1/8 in 4/4", fabs(note_as_fraction_of_bar(&arp, 4, 4) - 0.125) < d);
+    setTime(&arp, NOTE_1_32);
+    mu_assert("error, 1/32 in 4/4", fabs(note_as_fraction_of_bar(&arp, 4, 4) - 0.03125) < d);
+    setTime(&arp, NOTE_1_8);
+    mu_assert("error, 1/8 in 3/4", fabs(note_as_fraction_of_bar(&arp, 3, 4)  - 0.1666) < d);
+    return 0;
+}
+
+static char* test_independent_instances() {
+    // two engines must not share pattern state
+    Arpeggiator a = {0}, b = {0};
+    setChord(&a, OCTAVE); setRange(&a, 2); setDir(&a, DIR_UP);
+    setChord(&b, OCTAVE); setRange(&b, 3); setDir(&b, DIR_UP);
+    updateArpeggioNotes(&a);
+    updateArpeggioNotes(&b);
+    mu_assert("error, a length", a.table->length == 2);
+    mu_assert("error, b length", b.table->length == 3);
+    mu_assert("error, a step 1", nextNote(&a, 60) == 60);
+    mu_assert("error, a step 2", nextNote(&a, 60) == 72);
+    mu_assert("error, b step 1", nextNote(&b, 60) == 60);
+    mu_assert("error, a index wrapped", a.note_index == 0);
+    mu_assert("error, b index", b.note_index == 1);
+    return 0;
+}
+
+static char* test_copy_settings() {
+    // a channel engine takes the settings but keeps its keys and position
+    Arpeggiator a = {0}, b = {0};
+    setMode(&a, MODE_SORTED); setRange(&a, 2); setSkip(&a, 100);
+    setSeed(&a, 7); seedRandom(&a, 7);
+    setMode(&b, MODE_SORTED); setRange(&b, 1);
+    addHeldNote(&b, 60); addHeldNote(&b, 64);
+    nextStep(&b, (uint8_t[128]) {0});
+    copySettings(&b, &a);
+    mu_assert("error, settings", b.range == 2 && b.skip == 100 && b.seed == 7);
+    mu_assert("error, keys kept", b.held.count == 2 && b.note_index == 1);
+    mu_assert("error, reseeded", b.random_state == a.random_state);
+    mu_assert("error, skip stepper", nextStep(&b, (uint8_t[128]) {0}) == 0);
+    return 0;
+}
+
+static char* test_clock_no_drift() {
+    // step boundaries must land on the exact frame even hours into a song
+    ArpClock clk;
+    clockInit(&clk, 44100, 133.7);
+    clockSetRolling(&clk, true, 0);
+    clockSetStep(&clk, 0.125, 0);
+    double fpb = 60.0 / 133.7 * 44100;
+    int64_t steps[] = { 1, 7, 1000, 123457, 4000000 };
+    for(int i = 0; i < 5; i++) {
+        uint64_t exact = (uint64_t) ceil(steps[i] * 0.125 * fpb - 1e-6);
+        mu_assert("error, step frame drifted", clockStepFrame(&clk, steps[i]) == exact);
+    }
+    return 0;
+}
+
+static char* test_clock_locate() {
+    ArpClock clk;
+    clockInit(&clk, 48000, 120);
+    clockSetRolling(&clk, true, 0);
+    clockSetStep(&clk, 0.25, 0);
+    mu_assert("error, first step", clk.next_step == 0);
+    mu_assert("error, step 1 frame", clockStepFrame(&clk, 1) == 6000);
+    // a small host correction keeps the step sequence
+    clk.next_step = 5;
+    mu_assert("error, correction seen as jump", !clockLocate(&clk, 1.2501, 30000));
+    mu_assert("error, step lost on correction", clk.next_step == 5);
+    mu_assert("error, re-anchored step frame", clockStepFrame(&clk, 6) == 35998);
+    // a float rounded position within a frame doesn't move the steps
+    mu_assert("error, rounding seen as jump",
+            !clockLocate(&clk, clockBeatAt(&clk, 36000) - 2e-5, 36000));
+    mu_assert("error, rounding re-anchored", clockStepFrame(&clk, 6) == 35998);
+    // a relocation starts at the first step after the new position
+    mu_assert("error, jump not detected", clockLocate(&clk, 8.1, 40000));
+    mu_assert("error, step after jump", clk.next_step == 33);
+    // tempo changes keep the beat position
+    clockSetTempo(&clk, 48000, 60, 40000);
+    mu_assert("error, tempo change moved position", fabs(clockBeatAt(&clk, 40000) - 8.1) < 1e-9);
+    mu_assert("error, step frame after tempo change", clockStepFrame(&clk, 33) == 40000 + 7200);
+    return 0;
+}
+
+static char* test_seeded_skip() {
+    // the same seed gives the same skip pattern in every instance
+    Arpeggiator a = {0}, b = {0};
+    setChord(&a, OCTAVE); setRange(&a, 3); setSkip(&a, 50); setSeed(&a, 42);
+    setChord(&b, OCTAVE); setRange(&b, 3); setSkip(&b, 50); setSeed(&b, 42);
+    updateArpeggioNotes(&a);
+    updateArpeggioNotes(&b);
+    int skipped = 0;
+    for(int i = 0; i < 1000; i++) {
+        uint8_t note = nextNote(&a, 60);
+        mu_assert("error, seeded sequences differ", note == nextNote(&b, 60));
+        if(note == 128) ++skipped;
+    }
+    mu_assert("error, skip rate", skipped > 400 && skipped < 600);
+    // restarting replays the sequence
+    uint8_t first[16];
+    resetArpeggio(&a);
+    for(int i = 0; i < 16; i++) first[i] = nextNote(&a, 60);
+    resetArpeggio(&a);
+    for(int i = 0; i < 16; i++) {
+        mu_assert("error, reset did not replay", nextNote(&a, 60) == first[i]);
+    }
+    return 0;
+}
+
+static double drained[RTLOG_SIZE + 1];
+static int n_drained = 0;
+
+static void collect_log_record(void* handle, const RTLogRecord* record) {
+    drained[n_drained++] = record->args[0];
+}
+
+static char* test_midi_clock() {
+    ArpMidiClock mc;
+    midiClockInit(&mc, 48000, 100);
+    midiClockStart(&mc);
+    mu_assert("error, running", mc.running);
+    // 120 bpm at 48 kHz is 1000 frames per tick, sent with up to 60
+    // frames of jitter
+    uint32_t x = 1;
+    uint64_t frame = 0;
+    for(int i = 0; i < 24 * 32; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        frame = 5000 + 1000 * (uint64_t) i;
+        midiClockTick(&mc, frame + x % 121 - 60);
+    }
+    mu_assert("error, locked tempo", fabs(midiClockBpm(&mc, 48000) - 120) < 0.5);
+    // the interpolated position is well within one tick
+    double beat = midiClockBeatAt(&mc, frame + 500);
+    mu_assert("error, position", fabs(beat - (24 * 32 - 1 + 0.5) / 24.0) < 0.5 / 24);
+
+    // a jump to 150 bpm (800 frames per tick) locks again
+    for(int i = 1; i <= 48; i++) midiClockTick(&mc, frame + 800 * (uint64_t) i);
+    mu_assert("error, new tempo", fabs(midiClockBpm(&mc, 48000) - 150) < 0.5);
+    frame += 800 * 48;
+
+    // a single lost tick doesn't move the tempo much
+    midiClockTick(&mc, frame + 1600);
+    mu_assert("error, lost tick", fabs(midiClockBpm(&mc, 48000) - 150) < 5);
+
+    // the song position pointer sets the beat of the next tick
+    midiClockStop(&mc);
+    midiClockSongPosition(&mc, 8);
+    midiClockContinue(&mc);
+    midiClockTick(&mc, frame + 2400);
+    mu_assert("error, song position", fabs(midiClockBeatAt(&mc, frame + 2400) - 2) < 0.05);
+    return 0;
+}
+
+static char* test_groove() {
+    ArpGroove groove;
+    float offsets[ARP_GROOVE_STEPS];
+    grooveClear(&groove);
+    grooveOffsets(&groove, 0, offsets);
+    mu_assert("error, straight", offsets[0] == 0 && offsets[15] == 0 && groove.velocity[7] == 1);
+    grooveOffsets(&groove, 100, offsets);
+    mu_assert("error, swing", offsets[0] == 0 && fabs(offsets[1] - ARP_GROOVE_MAX_OFFSET) < 1e-6);
+    grooveOffsets(&arp_grooves[GROOVE_SHUFFLE], 100, offsets);
+    mu_assert("error, offset limit", offsets[1] <= ARP_GROOVE_MAX_OFFSET);
+
+    // two steps repeated over the cycle, out of range values limited
+    mu_assert("error, parse", parseGroove("# swing\n\n0 100\n 20 50\n", &groove));
+    mu_assert("error, parsed", groove.offset[0] == 0 && fabs(groove.offset[1] - 0.2) < 1e-6 &&
+            fabs(groove.velocity[1] - 0.5) < 1e-6);
+    mu_assert("error, repeated", groove.offset[15] == groove.offset[1] &&
+            groove.velocity[14] == 1);
+    mu_assert("error, limits", parseGroove("-80 150", &groove) &&
+            groove.offset[3] == -(float) ARP_GROOVE_MAX_OFFSET && groove.velocity[3] == 1);
+    mu_assert("error, no steps", !parseGroove("# nothing\nabc\n", &groove));
+    mu_assert("error, unchanged", groove.velocity[0] == 1);
+    mu_assert("error, nan", parseGroove("nan nan", &groove) &&
+            groove.offset[0] == 0 && groove.velocity[0] == 1);
+    // grooves from a saved state are held to the same ranges
+    groove.offset[2] = 3;
+    groove.offset[5] = NAN;
+    groove.velocity[9] = -1;
+    groove.velocity[10] = NAN;
+    grooveLimit(&groove);
+    mu_assert("error, limited", groove.offset[2] == (float) ARP_GROOVE_MAX_OFFSET &&
+            groove.offset[5] == 0 && groove.velocity[9] == 0 && groove.velocity[10] == 1);
+    return 0;
+}
+
+static char* test_scales() {
+    Arpeggiator arp = {0};
+    uint8_t map[128];
+    setRange(&arp, 2);
+    setChord(&arp, MAJOR);
+    updateArpeggioNotes(&arp);
+    mu_assert("error, major", arp.table->length == 6 && arp.table->notes[1] == 4 &&
+            arp.table->notes[2] == 7 && arp.table->notes[5] == 19);
+    setChord(&arp, DOMINANT_7);
+    updateArpeggioNotes(&arp);
+    mu_assert("error, seventh", arp.table->length == 8 && arp.table->notes[3] == 10);
+    setChord(&arp, CHORD_USER);
+    setUserChord(&arp, 0x1005); // 0 2, and a bit above the octave
+    updateArpeggioNotes(&arp);
+    mu_assert("error, user chord", arp.user_chord == 0x005 && arp.table->length == 4 &&
+            arp.table->notes[1] == 2 && arp.table->notes[3] == 14);
+
+    buildScaleMap(map, 0, arp_scales[SCALE_MAJOR]);
+    mu_assert("error, in scale", map[60] == 60 && map[64] == 64 && map[127] == 127);
+    mu_assert("error, snapped down", map[61] == 60 && map[66] == 65 && map[0] == 0);
+    buildScaleMap(map, 2, arp_scales[SCALE_MAJOR]); // D major
+    mu_assert("error, key", map[61] == 61 && map[60] == 59 && map[65] == 64);
+    buildScaleMap(map, 9, arp_scales[SCALE_MINOR_PENTATONIC]); // A C D E G
+    mu_assert("error, pentatonic", map[59] == 60 && map[58] == 57 && map[65] == 64 && map[66] == 67);
+    buildScaleMap(map, 0, arp_scales[SCALE_CHROMATIC]);
+    mu_assert("error, chromatic", map[61] == 61);
+    buildScaleMap(map, 0, 0);
+    mu_assert("error, empty scale", map[61] == 61);
+    return 0;
+}
+
+static char* test_velocity() {
+    Arpeggiator arp;
+    ArpVelocityMap map;
+    memset(&arp, 0, sizeof(arp));
+    buildVelocityMap(&map, VELOCITY_LINEAR, ACCENT_NONE, 50, &arp_grooves[GROOVE_NONE]);
+    mu_assert("error, linear", map.step[0][100] == 100 && map.step[15][1] == 1 && map.step[3][0] == 1);
+    buildVelocityMap(&map, VELOCITY_SOFT, ACCENT_NONE, 50, &arp_grooves[GROOVE_NONE]);
+    mu_assert("error, soft", map.step[0][32] > 32 && map.step[0][127] == 127);
+    buildVelocityMap(&map, VELOCITY_HARD, ACCENT_NONE, 50, &arp_grooves[GROOVE_NONE]);
+    mu_assert("error, hard", map.step[0][64] < 64 && map.step[0][127] == 127);
+    buildVelocityMap(&map, VELOCITY_FIXED, ACCENT_DOWNBEATS, 50, &arp_grooves[GROOVE_SHUFFLE]);
+    mu_assert("error, fixed", map.step[0][10] == 127 && map.step[1][10] == 102);
+    buildVelocityMap(&map, VELOCITY_LINEAR, ACCENT_DOWNBEATS, 50, &arp_grooves[GROOVE_NONE]);
+    mu_assert("error, accent", map.step[4][27] == 77 && map.step[5][27] == 27);
+
+    // octaves above a held key take its velocity
+    setMode(&arp, MODE_SORTED);
+    setKeyVelocity(&arp, 60, 90);
+    setKeyVelocity(&arp, 64, 40);
+    heldAdd(&arp.held, 60);
+    heldAdd(&arp.held, 64);
+    mu_assert("error, key velocity", noteVelocity(&arp, 64) == 40 && noteVelocity(&arp, 72) == 90 &&
+            noteVelocity(&arp, 88) == 40);
+    setMode(&arp, MODE_TRANSPOSE);
+    mu_assert("error, transpose velocity", noteVelocity(&arp, 64) == 90);
+    return 0;
+}
+
+static char* test_rtlog() {
+    RTLog log;
+    rtlog_init(&log);
+    mu_assert("error, empty log pending", !rtlog_pending(&log));
+    for(int i = 0; i < RTLOG_SIZE; i++) {
+        mu_assert("error, push failed", rtlog_push(&log, RTLOG_NOTE, "%f", i, 0, 0));
+    }
+    mu_assert("error, push to full ring", !rtlog_push(&log, RTLOG_NOTE, "%f", 99, 0, 0));
+    mu_assert("error, dropped count", atomic_load(&log.dropped) == 1);
+    mu_assert("error, drain count", rtlog_drain(&log, collect_log_record, NULL) == RTLOG_SIZE);
+    for(int i = 0; i < RTLOG_SIZE; i++) {
+        mu_assert("error, drain order", drained[i] == i);
+    }
+    mu_assert("error, drained log pending", !rtlog_pending(&log));
+    mu_assert("error, push after drain", rtlog_push(&log, RTLOG_NOTE, "%f", 1, 0, 0));
+    return 0;
+}
+
+static char* test_held_notes() {
+    HeldNotes held;
+    uint8_t notes[128];
+    heldClear(&held);
+    mu_assert("error, add", heldAdd(&held, 67));
+    mu_assert("error, add", heldAdd(&held, 60));
+    mu_assert("error, add", heldAdd(&held, 127));
+    mu_assert("error, add", heldAdd(&held, 64));
+    mu_assert("error, add twice", !heldAdd(&held, 60));
+    mu_assert("error, count", held.count == 4);
+    mu_assert("error, sorted count", heldSorted(&held, notes) == 4);
+    mu_assert("error, sorted order", notes[0] == 60 && notes[1] == 64 &&
+            notes[2] == 67 && notes[3] == 127);
+    mu_assert("error, remove", heldRemove(&held, 60));
+    mu_assert("error, remove twice", !heldRemove(&held, 60));
+    mu_assert("error, played order", held.count == 3 && held.order[0] == 67 &&
+            held.order[1] == 127 && held.order[2] == 64);
+    mu_assert("error, contains", heldContains(&held, 64) && !heldContains(&held, 60));
+    return 0;
+}
+
+static char* test_note_modes() {
+    Arpeggiator arp = {0};
+    uint8_t notes[128];
+    setRange(&arp, 2); setDir(&arp, DIR_UP); setMode(&arp, MODE_SORTED);
+    updateArpeggioNotes(&arp);
+    addHeldNote(&arp, 67);
+    addHeldNote(&arp, 60);
+    uint8_t sorted[] = { 60, 67, 72, 79 };
+    for(int i = 0; i < 4; i++) {
+        mu_assert("error, sorted count", nextStep(&arp, notes) == 1);
+        mu_assert("error, sorted note", notes[0] == sorted[i]);
+    }
+
+    setMode(&arp, MODE_AS_PLAYED);
+    updateArpeggioNotes(&arp);
+    uint8_t played[] = { 67, 60, 79, 72 };
+    for(int i = 0; i < 4; i++) {
+        mu_assert("error, as played count", nextStep(&arp, notes) == 1);
+        mu_assert("error, as played note", notes[0] == played[i]);
+    }
+
+    setMode(&arp, MODE_CHORD);
+    setDir(&arp, DIR_DOWN);
+    updateArpeggioNotes(&arp);
+    mu_assert("error, chord size", nextStep(&arp, notes) == 2);
+    mu_assert("error, chord notes", notes[0] == 72 && notes[1] == 79);
+    mu_assert("error, chord size", nextStep(&arp, notes) == 2);
+    mu_assert("error, chord notes", notes[0] == 60 && notes[1] == 67);
+
+    removeHeldNote(&arp, 60);
+    removeHeldNote(&arp, 67);
+    mu_assert("error, nothing held", nextStep(&arp, notes) == 0);
+    return 0;
+}
+
+static char* test_directions() {
+    Arpeggiator arp = {0};
+    setChord(&arp, OCTAVE); setRange(&arp, 3); setDir(&arp, DIR_DOWN);
+    updateArpeggioNotes(&arp);
+    mu_assert("error, down length", arp.table->length == 3);
+    mu_assert("error, down", nextNote(&arp, 48) == 72);
+    mu_assert("error, down", nextNote(&arp, 48) == 60);
+    mu_assert("error, down", nextNote(&arp, 48) == 48);
+
+    setDir(&arp, DIR_UPDOWN);
+    updateArpeggioNotes(&arp);
+    uint8_t updown[] = { 48, 60, 72, 60, 48, 60 };
+    for(int i = 0; i < 6; i++) {
+        mu_assert("error, up-down", nextNote(&arp, 48) == updown[i]);
+    }
+    return 0;
+}
+
+static char* test_steppers() {
+    // the step function follows the table and the features in use
+    Arpeggiator arp = {0};
+    setChord(&arp, OCTAVE); setRange(&arp, 2);
+    updateArpeggioNotes(&arp);
+    mu_assert("error, single", arp.step == stepSingle);
+    setSkip(&arp, 50);
+    mu_assert("error, single with skip", arp.step == stepSingleSkip);
+    setMode(&arp, MODE_CHORD);
+    addHeldNote(&arp, 60);
+    addHeldNote(&arp, 64);
+    mu_assert("error, chord with skip", arp.step == stepChordSkip);
+    setSkip(&arp, 0);
+    mu_assert("error, chord", arp.step == stepChord);
+    mu_assert("error, chord notes", arp.notes == notesChord);
+    removeHeldNote(&arp, 60);
+    removeHeldNote(&arp, 64);
+    mu_assert("error, empty", arp.step == stepEmpty && arp.notes == notesEmpty);
+    setMode(&arp, MODE_TRANSPOSE);
+    updateArpeggioNotes(&arp);
+    mu_assert("error, single notes", arp.notes == notesSingle);
+    return 0;
+}
+
+/* Stepping as it was done before the tables were compiled: a modulo of
+   the step counter, and the cycle skip worked out on every step. The
+   table must be built without a cycle. */
+static uint32_t legacyStep(Arpeggiator* arp, const ArpTable* table, uint8_t base_note, uint8_t* notes) {
+    uint32_t i, n = 0;
+    if(table->length == 0) return 0;
+    uint32_t steps = table->length / table->step_size;
+
+    uint32_t step = arp->note_index % steps;
+    const uint8_t* source = &table->notes[step * table->step_size];
+    for(i = 0; i < table->step_size; i++) {
+        uint32_t note = source[i] + base_note;
+        if(note < 128) notes[n++] = note;
+    }
+    if(arp->cycle > 0) {
+        if(step == (arp->cycle % steps)) {
+            ++arp->note_index;
+        }
+    }
+    if((((uint64_t) nextRandom(arp) * 100) >> 32) < arp->skip) {
+        n = 0;
+    }
+    ++arp->note_index;
+    return n;
+}
+
+static char* test_compiled_steps() {
+    static ArpTable plain;
+    uint8_t notes[128];
+    // the compiled order is the order the cycle skip used to give
+    for(int chord = OCTAVE; chord < CHORD_USER; chord++)
+    for(int range = 1; range <= 4; range++)
+    for(int dir = DIR_UP; dir < DIR_ERROR; dir++)
+    for(int cycle = 0; cycle <= 12; cycle++) {
+        Arpeggiator arp = {0}, old = {0};
+        setChord(&arp, chord); setRange(&arp, range); setDir(&arp, dir);
+        setChord(&old, chord); setRange(&old, range); setDir(&old, dir);
+        buildArpeggioTable(&old, &plain);
+        setCycle(&arp, cycle); setCycle(&old, cycle);
+        updateArpeggioNotes(&arp);
+        for(int i = 0; i < 50; i++) {
+            mu_assert("error, legacy step", legacyStep(&old, &plain, 40, notes) == 1);
+            mu_assert("error, compiled order", nextNote(&arp, 40) == notes[0]);
+        }
+    }
+
+    // chord steps with every note out of range are flagged
+    Arpeggiator arp = {0};
+    setMode(&arp, MODE_CHORD); setRange(&arp, 2);
+    addHeldNote(&arp, 120);
+    mu_assert("error, steps", arp.table->steps == 2);
+    mu_assert("error, flags", arp.table->flags[0] == 0 && arp.table->flags[1] == ARP_STEP_SILENT);
+    mu_assert("error, first step", nextStep(&arp, notes) == 1 && notes[0] == 120);
+    mu_assert("error, silent step", nextStep(&arp, notes) == 0);
+
+    // a shorter table continues from its loop start
+    setMode(&arp, MODE_SORTED); setRange(&arp, 1);
+    removeHeldNote(&arp, 120);
+    addHeldNote(&arp, 60); addHeldNote(&arp, 64); addHeldNote(&arp, 67);
+    resetArpeggio(&arp);
+    nextStep(&arp, notes);
+    nextStep(&arp, notes);
+    removeHeldNote(&arp, 67);
+    mu_assert("error, wrap", nextStep(&arp, notes) == 1 && notes[0] == 60);
+    mu_assert("error, continue", nextStep(&arp, notes) == 1 && notes[0] == 64);
+    return 0;
+}
+
+static char* test_note_off_queue() {
+    static NoteOffQueue queue;
+    noteOffClear(&queue);
+    mu_assert("error, empty peek", noteOffPeek(&queue) == NULL);
+    // pseudo random frames come out in order
+    uint32_t x = 12345;
+    for(int i = 0; i < ARP_MAX_NOTE_OFFS; i++) {
+        x = x * 1103515245 + 12345;
+        mu_assert("error, push", noteOffPush(&queue, x % 10000, i % 128, i % 16));
+    }
+    mu_assert("error, push to full queue", !noteOffPush(&queue, 1, 1, 0));
+    uint64_t last = 0;
+    for(int i = 0; i < ARP_MAX_NOTE_OFFS; i++) {
+        NoteOff off = noteOffPop(&queue);
+        mu_assert("error, pop order", off.frame >= last);
+        mu_assert("error, pop channel", off.channel == (off.note % 16));
+        last = off.frame;
+    }
+    mu_assert("error, not empty", queue.count == 0);
+    // queued note ons keep their velocity and length
+    noteOnPush(&queue, 200, 64, 2, 90, 1500);
+    noteOffPush(&queue, 100, 60, 1);
+    NoteOff off = noteOffPop(&queue), on = noteOffPop(&queue);
+    mu_assert("error, note off first", off.frame == 100 && off.velocity == 0);
+    mu_assert("error, note on", on.frame == 200 && on.note == 64 && on.channel == 2 &&
+            on.velocity == 90 && on.length == 1500);
+    return 0;
+}
+
+static char* test_lanes() {
+    static ArpLanes vector, scalar;
+    ArpLaneStep a, b;
+    // every lane count, so that the partial vectors at the end are
+    // covered, with some lanes not due and some skipping
+    for(uint32_t count = 1; count <= ARP_MAX_LANES; count++) {
+        lanesInit(&vector, count);
+        for(uint32_t i = 0; i < count; i++) {
+            vector.length[i] = 1 + (i * 7) % ARP_LANE_STEPS;
+            vector.loop[i] = i % 3 < vector.length[i] ? i % 3 : 0;
+            vector.hits[i] = 1 + i % 8;
+            vector.gate[i] = i * 0.37;
+            lanesSetSkip(&vector, i, (i * 13) % 120);
+            for(uint32_t j = 0; j < ARP_LANE_STEPS; j++) vector.values[i][j] = i * 100 + j;
+        }
+        scalar = vector;
+        uint64_t due = 0x9e3779b97f4a7c15ull;
+        for(int step = 0; step < 200; step++) {
+            due = due << 1 | due >> 63;
+            lanesStep(&vector, due, 0.25 + step, &a);
+            lanesStepScalar(&scalar, due, 0.25 + step, &b);
+            mu_assert("error, lane values", !memcmp(a.value, b.value, count * sizeof(int32_t)));
+            mu_assert("error, lane steps", !memcmp(a.step, b.step, count * sizeof(uint32_t)));
+            mu_assert("error, lane gates", !memcmp(a.off, b.off, count * sizeof(double)));
+            mu_assert("error, lane play", a.play == b.play);
+            mu_assert("error, not due", !(a.play & ~due));
+        }
+        mu_assert("error, lane state", !memcmp(vector.index, scalar.index, count * sizeof(uint32_t)));
+        mu_assert("error, lane random", !memcmp(vector.random, scalar.random, count * sizeof(uint32_t)));
+    }
+    // lanes of different lengths wrap on their own
+    lanesInit(&scalar, 2);
+    scalar.length[0] = 3;
+    scalar.length[1] = 4;
+    for(uint32_t j = 0; j < 4; j++) scalar.values[0][j] = scalar.values[1][j] = j;
+    for(int step = 0; step < 12; step++) {
+        lanesStep(&scalar, 3, 1, &a);
+        mu_assert("error, lane wrap", a.value[0] == step % 3 && a.value[1] == step % 4);
+        mu_assert("error, lane plays", a.play == 3);
+    }
+    // a lane that isn't due stays where it is
+    lanesStep(&scalar, 2, 1, &a);
+    mu_assert("error, lane not due", scalar.index[0] == 0 && scalar.index[1] == 1);
+    // shortened past the position: starts again from the first step
+    scalar.index[0] = 2;
+    scalar.length[0] = 1;
+    vector = scalar;
+    lanesStep(&vector, 1, 1, &a);
+    lanesStepScalar(&scalar, 1, 1, &b);
+    mu_assert("error, lane shortened", a.value[0] == 0 && vector.index[0] == 0);
+    mu_assert("error, scalar lane shortened", b.value[0] == 0 && scalar.index[0] == 0);
+    // the gate is a fraction of a hit
+    scalar.hits[1] = 4;
+    scalar.gate[1] = 0.5;
+    lanesStep(&scalar, 2, 1, &a);
+    mu_assert("error, lane gate", a.off[1] == 0.125);
+    return 0;
+}
+
+static char* test_engine_lanes() {
+    // the threshold skips the same random numbers as the engine
+    static const float skips[] = { 0, 0.5, 1, 23, 33.3f, 50, 99, 99.5f, 100, 150 };
+    static ArpLanes lanes;
+    lanesInit(&lanes, 1);
+    for(uint32_t k = 0; k < sizeof(skips) / sizeof(skips[0]); k++) {
+        lanesSetSkip(&lanes, 0, skips[k]);
+        uint32_t x = 1;
+        for(int i = 0; i < 100000; i++) {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            // and the numbers right at the threshold
+            uint32_t r = i & 1 ? x : lanes.skip[0] + (i >> 1) % 3 - 1;
+            bool engine = (((uint64_t) r * 100) >> 32) < skips[k];
+            bool lane = lanes.skip[0] && r <= lanes.skip[0];
+            mu_assert("error, skip threshold", engine == lane);
+        }
+    }
+
+    // an engine stepped through a lane plays what nextStep() plays
+    for(int cycle = 0; cycle <= 3; cycle++) {
+        Arpeggiator arp = {0}, lane_arp = {0};
+        setChord(&arp, MAJOR); setRange(&arp, 2); setCycle(&arp, cycle);
+        setSkip(&arp, 23); setSeed(&arp, 5);
+        copySettings(&lane_arp, &arp);
+        addHeldNote(&arp, 60); addHeldNote(&lane_arp, 60);
+        updateArpeggioNotes(&arp); updateArpeggioNotes(&lane_arp);
+        lanesInit(&lanes, 1);
+        lanesSeed(&lanes, 0, 5);
+        lanesSetSkip(&lanes, 0, lane_arp.skip);
+        lanes.length[0] = lane_arp.table->steps;
+        lanes.loop[0] = lane_arp.table->loop_step;
+        uint8_t a[128], b[128];
+        for(int i = 0; i < 100; i++) {
+            ArpLaneStep out;
+            uint32_t n = nextStep(&arp, a);
+            lanesStep(&lanes, 1, 1, &out);
+            uint32_t m = out.play & 1 ? stepNotes(&lane_arp, out.step[0], b) : 0;
+            mu_assert("error, lane engine", n == m && !memcmp(a, b, n));
+        }
+    }
+    return 0;
+}
+
+static char* test_pattern() {
+    static ArpPattern pattern;
+    static ArpLanes lanes;
+    patternClear(&pattern);
+    mu_assert("error, pattern parse", parsePattern(
+                "# comment\npitch 1 3 2\nrhythm x - . x\n\nvelocity 100 50\nvelocity 80", &pattern));
+    mu_assert("error, pattern lengths", pattern.length[LANE_PITCH] == 3 &&
+            pattern.length[LANE_RHYTHM] == 4 && pattern.length[LANE_GATE] == 0 &&
+            pattern.length[LANE_VELOCITY] == 3);
+    mu_assert("error, pattern pitch", pattern.values[LANE_PITCH][1] == 2);
+    mu_assert("error, pattern rhythm", pattern.values[LANE_RHYTHM][1] == RHYTHM_TIE &&
+            pattern.values[LANE_RHYTHM][2] == RHYTHM_REST);
+    mu_assert("error, pattern added lines", pattern.values[LANE_VELOCITY][2] == 80);
+    mu_assert("error, unknown lane", !parsePattern("swing 1 2", &pattern));
+    mu_assert("error, bad rhythm", !parsePattern("rhythm x o", &pattern));
+    mu_assert("error, too many hits", !parsePattern("rhythm x 9", &pattern));
+    mu_assert("error, pitch 0", !parsePattern("pitch 0 1", &pattern));
+    mu_assert("error, empty pattern", !parsePattern("# nothing\n", &pattern));
+    char text[512] = "gate";
+    for(int i = 0; i <= ARP_LANE_STEPS; i++) strcat(text, " 50");
+    mu_assert("error, lane too long", !parsePattern(text, &pattern));
+    mu_assert("error, pattern kept", pattern.length[LANE_PITCH] == 3);
+
+    // the lanes step independently, and the unused gate lane is neutral
+    lanesInit(&lanes, ARP_LANE_TYPES);
+    patternLanes(&pattern, &lanes, 0);
+    const int32_t pitches[3] = { 0, 2, 1 }, velocities[3] = { 100, 50, 80 };
+    ArpLaneStep step;
+    for(int i = 0; i < 12; i++) {
+        lanesStep(&lanes, UINT64_MAX, 1, &step);
+        mu_assert("error, pitch lane", step.value[LANE_PITCH] == pitches[i % 3]);
+        mu_assert("error, velocity lane", step.value[LANE_VELOCITY] == velocities[i % 3]);
+        mu_assert("error, gate lane", step.value[LANE_GATE] == -1);
+        // the first step of each 4 is held on through the next
+        mu_assert("error, ties", patternTies(&lanes, LANE_RHYTHM) == (i % 4 == 0));
+    }
+    parsePattern("rhythm - -", &pattern);
+    patternLanes(&pattern, &lanes, 0);
+    mu_assert("error, ties all round", patternTies(&lanes, LANE_RHYTHM) == 2);
+    mu_assert("error, ratchet", parsePattern("rhythm x 3 8", &pattern) &&
+            pattern.values[LANE_RHYTHM][1] == 3 && pattern.values[LANE_RHYTHM][2] == 8);
+
+    // saved patterns are checked and limited to the parser's ranges
+    static ArpPatternState state;
+    static ArpPattern restored;
+    mu_assert("error, gate parse", parsePattern("gate 500 -3 90", &pattern) &&
+            pattern.values[LANE_GATE][0] == 400 && pattern.values[LANE_GATE][1] == 0);
+    savePattern(&pattern, &state);
+    mu_assert("error, restore", restorePattern(&restored, &state, sizeof(state)) &&
+            restored.length[LANE_GATE] == 3 && restored.values[LANE_GATE][2] == 90);
+    state.pattern.values[LANE_PITCH][0] = -5;
+    state.pattern.values[LANE_RHYTHM][0] = -9;
+    state.pattern.values[LANE_RHYTHM][1] = 99;
+    state.pattern.values[LANE_GATE][0] = 1000;
+    state.pattern.values[LANE_VELOCITY][0] = -1;
+    mu_assert("error, restore limited", restorePattern(&restored, &state, sizeof(state)) &&
+            restored.values[LANE_PITCH][0] == 0 &&
+            restored.values[LANE_RHYTHM][0] == RHYTHM_TIE &&
+            restored.values[LANE_RHYTHM][1] == ARP_MAX_RATCHETS &&
+            restored.values[LANE_GATE][0] == 400 && restored.values[LANE_VELOCITY][0] == 0);
+    state.pattern.length[LANE_GATE] = ARP_LANE_STEPS + 1;
+    mu_assert("error, restore length", !restorePattern(&restored, &state, sizeof(state)));
+    state.pattern.length[LANE_GATE] = 3;
+    state.version = ARP_PATTERN_VERSION + 1;
+    mu_assert("error, restore version", !restorePattern(&restored, &state, sizeof(state)));
+    state.version = ARP_PATTERN_VERSION;
+    state.magic = 0;
+    mu_assert("error, restore magic", !restorePattern(&restored, &state, sizeof(state)));
+    mu_assert("error, restore size", !restorePattern(&restored, &state.pattern, sizeof(ArpPattern)));
+    mu_assert("error, restore unchanged", restored.values[LANE_GATE][0] == 400);
+    return 0;
+}
+
+static char* test_euclid() {
+    // E(3, 8) is the tresillo, and rotating moves the start of the cycle
+    mu_assert("error, E(3, 8)", euclidMask(3, 8, 0) == 0x49);
+    mu_assert("error, E(3, 8) rotated", euclidMask(3, 8, 3) == 0x29);
+    mu_assert("error, E(0, 8)", euclidMask(0, 8, 0) == 0);
+    mu_assert("error, E(8, 8)", euclidMask(8, 8, 0) == 0xff);
+    mu_assert("error, E(64, 64)", euclidMask(64, 64, 0) == UINT64_MAX);
+    for(uint32_t steps = 1; steps <= ARP_RHYTHM_STEPS; steps++) {
+        for(uint32_t pulses = 0; pulses <= steps; pulses++) {
+            uint64_t mask = euclidMask(pulses, steps, steps / 3);
+            mu_assert("error, pulse count", (uint32_t) __builtin_popcountll(mask) == pulses);
+            mu_assert("error, outside the cycle", steps == 64 || mask >> steps == 0);
+        }
+    }
+
+    // pulses always play and the steps between them never do
+    static ArpRhythm rhythm;
+    Arpeggiator arp = {0};
+    seedRandom(&arp, 1);
+    buildRhythm(&rhythm, 3, 8, 0, 100, 0);
+    uint32_t index = 0;
+    for(int i = 0; i < 24; i++) {
+        mu_assert("error, euclid step", rhythmStep(&rhythm, &index, &arp.random_state) == ((0x49 >> (i % 8)) & 1));
+    }
+    mu_assert("error, cycle position", index == 0);
+    // steps that can't play take no random numbers
+    uint32_t random_state = arp.random_state;
+    buildRhythm(&rhythm, 0, 8, 0, 100, 0);
+    for(int i = 0; i < 8; i++) rhythmStep(&rhythm, &index, &arp.random_state);
+    mu_assert("error, random numbers", arp.random_state == random_state);
+
+    // half of the pulses and a quarter of the other steps play
+    buildRhythm(&rhythm, 4, 16, 0, 50, 25);
+    mu_assert("error, mask with fills", rhythm.mask == 0xffff);
+    int pulses = 0, fills = 0;
+    for(int i = 0; i < 16000; i++) {
+        bool pulse = i % 4 == 0;
+        if(rhythmStep(&rhythm, &index, &arp.random_state)) pulse ? ++pulses : ++fills;
+    }
+    mu_assert("error, pulse chance", pulses > 1800 && pulses < 2200);
+    mu_assert("error, fill chance", fills > 2700 && fills < 3300);
+
+    // a shorter cycle starts over
+    index = 7;
+    buildRhythm(&rhythm, 1, 4, 0, 100, 0);
+    mu_assert("error, shortened cycle", rhythmStep(&rhythm, &index, &arp.random_state) && index == 1);
+    return 0;
+}
+
+static char* test_dspload() {
+    DSPLoad load;
+    dspload_clear(&load);
+    mu_assert("error, bucket 0", dspload_bucket(0) == 0);
+    mu_assert("error, bucket 511 ns", dspload_bucket(511) == 0);
+    mu_assert("error, bucket 512 ns", dspload_bucket(512) == 1);
+    mu_assert("error, bucket 1023 ns", dspload_bucket(1023) == 1);
+    mu_assert("error, bucket 1024 ns", dspload_bucket(1024) == 2);
+    mu_assert("error, bucket 1 s", dspload_bucket(1000000000) == DSPLOAD_BUCKETS - 1);
+
+    // 4 calls of 64 frames at 48 kHz, each taking 1/10 of the block time
+    for(int i = 0; i < 4; i++) dspload_record(&load, 133333, 64, 3, i == 3);
+    mu_assert("error, calls", load.calls == 4 && load.window_calls == 4);
+    mu_assert("error, events", load.events == 12);
+    mu_assert("error, overflows", load.overflows == 1);
+    mu_assert("error, histogram", load.histogram[dspload_bucket(133333)] == 4);
+    mu_assert("error, load", fabs(dspload_ratio(&load, 48000) - 0.1) < 0.001);
+    dspload_record(&load, 2000000, 64, 0, 0);
+    mu_assert("error, max", load.window_max_ns == 2000000);
+
+    // a new window keeps the totals
+    dspload_clear_window(&load);
+    mu_assert("error, window", load.window_calls == 0 && load.window_max_ns == 0);
+    mu_assert("error, empty window load", dspload_ratio(&load, 48000) == 0);
+    mu_assert("error, totals kept", load.calls == 5 && load.events == 12);
+
+    uint64_t t0 = dspload_now();
+    mu_assert("error, monotonic", dspload_now() >= t0);
+    return 0;
+}
+
+static char* test_snapshot() {
+    Arpeggiator a = {0}, b = {0};
+    ArpSnapshot snapshot;
+    uint8_t notes[ARP_MAX_NOTES];
+    setChord(&a, MINOR); setRange(&a, 3); setTime(&a, NOTE_1_8);
+    setGate(&a, 150); setCycle(&a, 2); setSkip(&a, 40);
+    setDir(&a, DIR_UPDOWN); setMode(&a, MODE_TRANSPOSE); setSeed(&a, 99);
+    updateArpeggioNotes(&a);
+    addHeldNote(&a, 60);
+    for(int i = 0; i < 5; i++) nextStep(&a, notes);
+
+    saveSnapshot(&a, &snapshot);
+    mu_assert("error, restore", restoreSnapshot(&b, &snapshot, sizeof(snapshot)));
+    mu_assert("error, parameters", b.chord == MINOR && b.range == 3 &&
+            b.time == NOTE_1_8 && b.gate == 150 && b.cycle == 2 &&
+            b.skip == 40 && b.dir == DIR_UPDOWN && b.seed == 99);
+    mu_assert("error, no held keys", b.held.count == 0);
+    mu_assert("error, table", b.table->length == a.table->length &&
+            !memcmp(b.table->notes, a.table->notes, sizeof(a.table->notes)));
+    // both continue with the same notes and random skips
+    heldAdd(&b.held, 60);
+    for(int i = 0; i < 20; i++) {
+        uint8_t na[ARP_MAX_NOTES], nb[ARP_MAX_NOTES];
+        uint32_t ca = nextStep(&a, na);
+        uint32_t cb = nextStep(&b, nb);
+        mu_assert("error, continued step", ca == cb && (ca == 0 || na[0] == nb[0]));
+    }
+
+    // other versions and garbage leave the engine alone
+    Arpeggiator c = {0};
+    snapshot.version = ARP_SNAPSHOT_VERSION + 1;
+    mu_assert("error, version", !restoreSnapshot(&c, &snapshot, sizeof(snapshot)));
+    snapshot.version = ARP_SNAPSHOT_VERSION;
+    mu_assert("error, size", !restoreSnapshot(&c, &snapshot, sizeof(snapshot) - 4));
+    snapshot.mode = MODE_ERROR;
+    mu_assert("error, mode", !restoreSnapshot(&c, &snapshot, sizeof(snapshot)));
+    mu_assert("error, unchanged", c.range == 0 && c.table == NULL);
+    snapshot.mode = MODE_TRANSPOSE;
+    mu_assert("error, valid again", restoreSnapshot(&c, &snapshot, sizeof(snapshot)));
+
+    // tables that would make a step write past its 128 notes
+    Arpeggiator d = {0};
+    ArpSnapshot bad = snapshot;
+    bad.step_size = 256; bad.steps = 2; bad.arpeggio_length = 512;
+    bad.loop_step = 0; bad.note_index = 0;
+    mu_assert("error, oversized step", !restoreSnapshot(&d, &bad, sizeof(bad)));
+    bad = snapshot;
+    // 0x80000001 * 2 wraps to 2 in 32 bits
+    bad.step_size = 2; bad.steps = 0x80000001u; bad.arpeggio_length = 2;
+    mu_assert("error, wrapping product", !restoreSnapshot(&d, &bad, sizeof(bad)));
+    bad = snapshot;
+    bad.note_index = bad.steps;
+    mu_assert("error, position past the table", !restoreSnapshot(&d, &bad, sizeof(bad)));
+    bad = snapshot;
+    bad.arpeggio_notes[0] = 200;
+    mu_assert("error, note out of range", !restoreSnapshot(&d, &bad, sizeof(bad)));
+    mu_assert("error, bad tables unchanged", d.range == 0 && d.table == NULL);
+    return 0;
+}
+
+static char* test_presets() {
+    Arpeggiator arp = {0};
+    ArpPreset bass = { .chord = OCTAVE, .range = 2, .time = NOTE_1_8, .gate = 100,
+        .dir = DIR_UP, .mode = MODE_TRANSPOSE };
+    ArpPreset down = { .chord = MINOR, .range = 2, .time = NOTE_1_16, .gate = 50,
+        .dir = DIR_DOWN, .mode = MODE_TRANSPOSE };
+    ArpPreset sorted = { .chord = OCTAVE, .range = 1, .time = NOTE_1_4, .gate = 100,
+        .dir = DIR_UP, .mode = MODE_SORTED };
+    uint8_t notes[128];
+    compilePreset(&bass);
+    compilePreset(&down);
+    compilePreset(&sorted);
+    mu_assert("error, bass table", bass.table.length == 2 &&
+            bass.table.notes[0] == 0 && bass.table.notes[1] == 12);
+    mu_assert("error, down table", down.table.length == 6 && down.table.notes[0] == 19);
+    mu_assert("error, sorted table is built from the keys", sorted.table.length == 0);
+
+    setRange(&arp, 3);
+    updateArpeggioNotes(&arp);
+    addHeldNote(&arp, 60);
+    nextStep(&arp, notes);
+    // the compiled table is played directly, from the start
+    applyPreset(&arp, &down);
+    mu_assert("error, preset table", arp.table == &down.table);
+    mu_assert("error, preset parameters", arp.chord == MINOR && arp.time == NOTE_1_16 &&
+            arp.gate == 50 && arp.dir == DIR_DOWN);
+    mu_assert("error, restart", nextStep(&arp, notes) == 1 && notes[0] == 79);
+    // the held note modes leave the table to the caller
+    addHeldNote(&arp, 64);
+    applyPreset(&arp, &sorted);
+    mu_assert("error, old table kept", arp.table == &down.table);
+    buildArpeggioNotes(&arp);
+    mu_assert("error, own table", arp.table == &arp.table_buffer);
+    mu_assert("error, sorted 1", nextStep(&arp, notes) == 1 && notes[0] == 60);
+    mu_assert("error, sorted 2", nextStep(&arp, notes) == 1 && notes[0] == 64);
+    applyPreset(&arp, &bass);
+    mu_assert("error, bass", nextStep(&arp, notes) == 1 && notes[0] == 60);
+    mu_assert("error, bass octave", nextStep(&arp, notes) == 1 && notes[0] == 72);
+    return 0;
+}
+
+/* The built-in presets are the ones in Simple_Apreggiator_presets.lv2, in
+   the same order. The bundle leaves the mode port at its default. */
+static char* test_presets_bundle() {
+    FILE* f = fopen("Simple_Apreggiator_presets.lv2/presets.ttl", "r");
+    char line[256], symbol[64] = "";
+    int preset = -1;
+    float value;
+    mu_assert("error, presets.ttl", f != NULL);
+    while(fgets(line, sizeof(line), f)) {
+        if(strstr(line, "rdfs:label")) {
+            ++preset;
+            if(preset >= ARP_PRESETS) break;
+            mu_assert("error, preset mode", arp_presets[preset].mode == MODE_TRANSPOSE);
+        } else if(sscanf(line, " lv2:symbol \"%63[^\"]\"", symbol) == 1) {
+            continue;
+        } else if(sscanf(line, " pset:value %f", &value) == 1 && preset >= 0) {
+            const ArpPreset* p = &arp_presets[preset];
+            int v = (int) value;
+            if(!strcmp(symbol, "chordtype")) mu_assert("error, preset chord", (int) p->chord == v);
+            else if(!strcmp(symbol, "range")) mu_assert("error, preset range", p->range == v);
+            else if(!strcmp(symbol, "time")) mu_assert("error, preset time", (int) p->time == v);
+            else if(!strcmp(symbol, "gate")) mu_assert("error, preset gate", p->gate == v);
+            else if(!strcmp(symbol, "cycle")) mu_assert("error, preset cycle", p->cycle == v);
+            else if(!strcmp(symbol, "skip")) mu_assert("error, preset skip", p->skip == v);
+            else if(!strcmp(symbol, "direction")) mu_assert("error, preset dir", (int) p->dir == v);
+            else mu_assert("error, preset port not in ArpPreset", 0);
+        }
+    }
+    fclose(f);
+    mu_assert("error, preset count", preset == ARP_PRESETS - 1);
     return 0;
 }
 
 static char* all_tests() {
     mu_run_test(test_note_as_fraction_of_bar);
+    mu_run_test(test_independent_instances);
+    mu_run_test(test_copy_settings);
+    mu_run_test(test_clock_no_drift);
+    mu_run_test(test_clock_locate);
+    mu_run_test(test_seeded_skip);
+    mu_run_test(test_midi_clock);
+    mu_run_test(test_groove);
+    mu_run_test(test_velocity);
+    mu_run_test(test_scales);
+    mu_run_test(test_rtlog);
+    mu_run_test(test_held_notes);
+    mu_run_test(test_note_modes);
+    mu_run_test(test_directions);
+    mu_run_test(test_compiled_steps);
+    mu_run_test(test_steppers);
+    mu_run_test(test_note_off_queue);
+    mu_run_test(test_lanes);
+    mu_run_test(test_engine_lanes);
+    mu_run_test(test_pattern);
+    mu_run_test(test_euclid);
+    mu_run_test(test_dspload);
+    mu_run_test(test_snapshot);
+    mu_run_test(test_presets);
+    mu_run_test(test_presets_bundle);
     return 0;
 }
 
+/* Steps per second with the legacy stepping and the compiled table.
+   Run by "make bench-steps" on an optimised build. */
+static void bench_steps(double seconds) {
+    static ArpTable plain;
+    Arpeggiator arp = {0}, old = {0};
+    uint8_t notes[128];
+    uint32_t sum = 0;
+    const uint32_t batch = 1 << 20;
+
+    setChord(&arp, MAJOR); setRange(&arp, 4); setDir(&arp, DIR_UPDOWN);
+    setSkip(&arp, 10); setSeed(&arp, 1);
+    setChord(&old, MAJOR); setRange(&old, 4); setDir(&old, DIR_UPDOWN);
+    setSkip(&old, 10); setSeed(&old, 1);
+    buildArpeggioTable(&old, &plain);
+    setCycle(&arp, 5); setCycle(&old, 5);
+    updateArpeggioNotes(&arp);
+    resetArpeggio(&old);
+
+    printf("stepping,steps_per_sec\n");
+    for(int compiled = 0; compiled < 2; compiled++) {
+        uint64_t steps = 0, start = dspload_now(), elapsed;
+        do {
+            for(uint32_t i = 0; i < batch; i++) {
+                uint32_t n = compiled ? arp.step(&arp, 40, notes) :
+                    legacyStep(&old, &plain, 40, notes);
+                sum += n ? notes[0] : 0;
+            }
+            steps += batch;
+            elapsed = dspload_now() - start;
+        } while(elapsed < seconds * 1e9);
+        printf("%s,%.0f\n", compiled ? "compiled" : "legacy", steps / (elapsed * 1e-9));
+    }
+    // keeps the loops from being optimised away
+    if(sum == 1) printf("\n");
+}
+
+/* Time per step of all lanes, one lane at a time and with the vector
+   kernel, from 1 to 64 lanes. Run by "make bench-lanes". */
+static void bench_lanes(double seconds) {
+    static ArpLanes lanes;
+    ArpLaneStep out;
+    uint64_t sum = 0;
+    const uint32_t batch = 1 << 16;
+
+    // every lane due, half of them skipping, so each step reads the
+    // values, works out the gates, draws and compares the random numbers
+    // and wraps the positions
+    printf("lanes,scalar_ns,vector_ns\n");
+    for(uint32_t count = 1; count <= ARP_MAX_LANES; count *= 2) {
+        double ns[2];
+        lanesInit(&lanes, count);
+        for(uint32_t i = 0; i < count; i++) {
+            lanes.length[i] = 3 + i % 13;
+            lanes.hits[i] = 1 + i % 4;
+            lanes.gate[i] = 0.5;
+            lanesSetSkip(&lanes, i, i & 1 ? 25 : 0);
+        }
+        for(int vector = 0; vector < 2; vector++) {
+            uint64_t steps = 0, start = dspload_now(), elapsed;
+            do {
+                for(uint32_t i = 0; i < batch; i++) {
+                    if(vector) lanesStep(&lanes, UINT64_MAX, 0.25, &out);
+                    else lanesStepScalar(&lanes, UINT64_MAX, 0.25, &out);
+                    sum += out.value[0] + out.play;
+                }
+                steps += batch;
+                elapsed = dspload_now() - start;
+            } while(elapsed < seconds * 1e9);
+            ns[vector] = (double) elapsed / steps;
+        }
+        printf("%u,%.1f,%.1f\n", count, ns[0], ns[1]);
+    }
+    // keeps the loops from being optimised away
+    if(sum == 1) printf("\n");
+}
+
 int main(int argc, char **argv) {
+    if(argc > 1 && !strcmp(argv[1], "--bench")) {
+        bench_steps(argc > 2 ? atof(argv[2]) : 2);
+        return 0;
+    }
+    if(argc > 1 && !strcmp(argv[1], "--bench-lanes")) {
+        bench_lanes(argc > 2 ? atof(argv[2]) : 0.5);
+        return 0;
+    }
     char *result = all_tests();
     if (result != 0) {
         printf("%s\n", result);
@@ -0,0 +1,464 @@
+/*
+   SimpleArpeggiator LV2 Plugin
+   Copyright 2017 Johan Berntsson
+
+   Permission to use, copy, modify, and/or distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+
+   THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+   */
+
+/* Golden output regression tests for the plugin binary.
+
+   Each scenario in golden/<name>.scn is rendered through the plugin by
+   minihost.c at block sizes from 1 to 8192 frames, and the output MIDI
+   stream must match golden/<name>.out frame for frame. Timing must not
+   depend on where the run() block boundaries fall, so all block sizes
+   are compared against the same golden file.
+
+   "./test_render --update" rewrites the golden files, rendering with a
+   block size of 1 frame.
+
+   Scenario file syntax, one command per line, events in frame order:
+
+   rate <sample rate>
+   length <frames to render>
+   control <port index> <value>
+   transport <bpm> <beats per bar> <beat unit>
+       (send a time:Position at the start of every block, like most hosts)
+   position <frame> <bpm> <speed> <bar> <bar beat> <beats per bar> <beat unit>
+   midi <frame> <status> <data1> <data2>   (status in hex)
+   pattern <frame> <path>   (set the pattern file)
+   workdelay <blocks>
+       (the worker responses arrive this many blocks late, the output must
+       not change)
+   reload <frame>
+       (at the first block from frame on, the state is saved and restored
+       into a new instance, which plays on. Nothing may happen in the 8192
+       frames after frame, so that the output doesn't depend on the block
+       size, and the scenario needs a transport for the new instance's
+       clock) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+
+#include "lv2/lv2plug.in/ns/ext/atom/util.h"
+
+#include "minihost.h"
+#include "simplearpeggiator.h"
+
+#define MAX_EVENTS 16384
+#define GOLDEN_DIR "golden/"
+
+int tests_run = 0;
+
+static const char* plugin_path = "./simplearpeggiator.so";
+static int update_golden = 0;
+
+static const uint32_t block_sizes[] = {
+    1, 2, 3, 7, 16, 31, 64, 100, 128, 256, 512, 1000, 1024, 2048, 4096, 8192
+};
+
+typedef enum {
+    INPUT_CONTROL,
+    INPUT_POSITION,
+    INPUT_MIDI,
+    INPUT_PATTERN,
+    INPUT_RELOAD
+} inputtype;
+
+typedef struct {
+    inputtype type;
+    uint64_t  frame;
+    uint32_t  port;
+    float     value;
+    float     bpm, speed, bar_beat, beats_per_bar;
+    int64_t   bar;
+    int32_t   beat_unit;
+    uint8_t   msg[3];
+    char      path[128];
+} Input;
+
+typedef struct {
+    double   rate;
+    uint64_t length;
+    int      transport;
+    uint32_t work_delay;
+    float    bpm, beats_per_bar;
+    int32_t  beat_unit;
+    uint32_t n_inputs;
+    Input    inputs[MAX_EVENTS];
+} Scenario;
+
+typedef struct {
+    uint64_t frame;
+    uint8_t  msg[3];
+} Output;
+
+typedef struct {
+    uint32_t count;
+    Output   events[MAX_EVENTS];
+} Render;
+
+static char message[512];
+static Scenario scenario;
+static Render golden, render;
+
+static char* load_scenario(const char* name) {
+    char path[256], line[256];
+    snprintf(path, sizeof(path), GOLDEN_DIR "%s.scn", name);
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        snprintf(message, sizeof(message), "error, cannot open %s", path);
+        return message;
+    }
+    memset(&scenario, 0, sizeof(scenario));
+    scenario.rate = 48000;
+    while(fgets(line, sizeof(line), f)) {
+        Input* in = &scenario.inputs[scenario.n_inputs];
+        unsigned long long frame;
+        unsigned int status, data1, data2;
+        long long bar;
+        char cmd[32];
+
+        if(sscanf(line, "%31s", cmd) != 1 || cmd[0] == '#') continue;
+        if(scenario.n_inputs == MAX_EVENTS) break;
+        if(!strcmp(cmd, "rate")) {
+            sscanf(line, "%*s %lf", &scenario.rate);
+        } else if(!strcmp(cmd, "length")) {
+            sscanf(line, "%*s %llu", &frame);
+            scenario.length = frame;
+        } else if(!strcmp(cmd, "transport")) {
+            scenario.transport = sscanf(line, "%*s %f %f %d", &scenario.bpm,
+                    &scenario.beats_per_bar, &scenario.beat_unit) == 3;
+        } else if(!strcmp(cmd, "workdelay")) {
+            sscanf(line, "%*s %u", &scenario.work_delay);
+        } else if(!strcmp(cmd, "control")) {
+            in->type = INPUT_CONTROL;
+            if(sscanf(line, "%*s %u %f", &in->port, &in->value) == 2) {
+                ++scenario.n_inputs;
+            }
+        } else if(!strcmp(cmd, "position")) {
+            in->type = INPUT_POSITION;
+            if(sscanf(line, "%*s %llu %f %f %lld %f %f %d", &frame, &in->bpm,
+                        &in->speed, &bar, &in->bar_beat, &in->beats_per_bar,
+                        &in->beat_unit) == 7) {
+                in->frame = frame;
+                in->bar = bar;
+                ++scenario.n_inputs;
+            }
+        } else if(!strcmp(cmd, "midi")) {
+            in->type = INPUT_MIDI;
+            if(sscanf(line, "%*s %llu %x %u %u", &frame, &status, &data1, &data2) == 4) {
+                in->frame = frame;
+                in->msg[0] = status;
+                in->msg[1] = data1;
+                in->msg[2] = data2;
+                ++scenario.n_inputs;
+            }
+        } else if(!strcmp(cmd, "reload")) {
+            in->type = INPUT_RELOAD;
+            if(sscanf(line, "%*s %llu", &frame) == 1) {
+                in->frame = frame;
+                ++scenario.n_inputs;
+            }
+        } else if(!strcmp(cmd, "pattern")) {
+            in->type = INPUT_PATTERN;
+            if(sscanf(line, "%*s %llu %127s", &frame, in->path) == 2) {
+                in->frame = frame;
+                ++scenario.n_inputs;
+            }
+        } else {
+            snprintf(message, sizeof(message), "error, %s: unknown command %s", path, cmd);
+            fclose(f);
+            return message;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static MiniHost* new_host(void) {
+    MiniHost* host = minihost_new(plugin_path, scenario.rate);
+    if(!host) return NULL;
+    minihost_set_quiet(host, 1);
+    minihost_set_work_delay(host, scenario.work_delay);
+    // control ports are read once per block, so they are all set up front
+    for(uint32_t i = 0; i < scenario.n_inputs; i++) {
+        const Input* in = &scenario.inputs[i];
+        if(in->type == INPUT_CONTROL) minihost_set_control(host, in->port, in->value);
+    }
+    return host;
+}
+
+// saves the state of host and restores it into a new instance
+static MiniHost* reload_host(MiniHost* host) {
+    MiniHostState* state = minihost_save_state(host);
+    minihost_free(host);
+    if(!state) return NULL;
+    host = new_host();
+    if(host && minihost_restore_state(host, state)) {
+        minihost_free(host);
+        host = NULL;
+    }
+    minihost_free_state(state);
+    return host;
+}
+
+static char* render_scenario(uint32_t block_size, Render* out) {
+    MiniHost* host = new_host();
+    if(!host) return "error, cannot load the plugin";
+
+    out->count = 0;
+    uint32_t next = 0;
+    for(uint64_t pos = 0; pos < scenario.length; pos += block_size) {
+        uint64_t n = scenario.length - pos;
+        if(n > block_size) n = block_size;
+
+        if(next < scenario.n_inputs && scenario.inputs[next].type == INPUT_RELOAD &&
+                scenario.inputs[next].frame <= pos) {
+            ++next;
+            if(!(host = reload_host(host))) return "error, cannot reload the state";
+        }
+
+        if(scenario.transport) {
+            double beat = pos * scenario.bpm / (60.0 * scenario.rate);
+            int64_t bar = (int64_t) (beat / scenario.beats_per_bar);
+            minihost_add_position(host, 0, scenario.bpm, 1, bar,
+                    beat - bar * scenario.beats_per_bar,
+                    scenario.beats_per_bar, scenario.beat_unit);
+        }
+        for(; next < scenario.n_inputs; next++) {
+            const Input* in = &scenario.inputs[next];
+            if(in->type == INPUT_CONTROL) continue;
+            if(in->frame >= pos + n || in->type == INPUT_RELOAD) break;
+            uint32_t frame = (uint32_t) (in->frame - pos);
+            if(in->type == INPUT_POSITION) {
+                minihost_add_position(host, frame, in->bpm, in->speed, in->bar,
+                        in->bar_beat, in->beats_per_bar, in->beat_unit);
+            } else if(in->type == INPUT_PATTERN) {
+                minihost_add_path(host, frame, SIMPLEARPEGGIATOR__patternFile, in->path);
+            } else {
+                minihost_add_midi(host, frame, in->msg[0], in->msg[1], in->msg[2]);
+            }
+        }
+        minihost_run(host, (uint32_t) n);
+
+        LV2_ATOM_SEQUENCE_FOREACH(minihost_output(host), ev) {
+            if(out->count == MAX_EVENTS) break;
+            const uint8_t* msg = (const uint8_t*) (ev + 1);
+            Output* o = &out->events[out->count++];
+            memset(o, 0, sizeof(Output));
+            o->frame = pos + ev->time.frames;
+            memcpy(o->msg, msg, ev->body.size < 3 ? ev->body.size : 3);
+        }
+    }
+    minihost_free(host);
+    return 0;
+}
+
+static char* load_golden(const char* name) {
+    char path[256];
+    snprintf(path, sizeof(path), GOLDEN_DIR "%s.out", name);
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        snprintf(message, sizeof(message),
+                "error, cannot open %s (run ./test_render --update)", path);
+        return message;
+    }
+    unsigned long long frame;
+    unsigned int status, data1, data2;
+    golden.count = 0;
+    while(golden.count < MAX_EVENTS &&
+            fscanf(f, "%llu %x %u %u", &frame, &status, &data1, &data2) == 4) {
+        Output* o = &golden.events[golden.count++];
+        o->frame = frame;
+        o->msg[0] = status;
+        o->msg[1] = data1;
+        o->msg[2] = data2;
+    }
+    fclose(f);
+    return 0;
+}
+
+static char* save_golden(const char* name) {
+    char path[256];
+    snprintf(path, sizeof(path), GOLDEN_DIR "%s.out", name);
+    FILE* f = fopen(path, "w");
+    if(!f) {
+        snprintf(message, sizeof(message), "error, cannot write %s", path);
+        return message;
+    }
+    for(uint32_t i = 0; i < golden.count; i++) {
+        const Output* o = &golden.events[i];
+        fprintf(f, "%llu %02x %u %u\n", (unsigned long long) o->frame,
+                o->msg[0], o->msg[1], o->msg[2]);
+    }
+    fclose(f);
+    return 0;
+}
+
+static char* compare(const char* name, uint32_t block_size) {
+    for(uint32_t i = 0; i < golden.count || i < render.count; i++) {
+        if(i == golden.count || i == render.count) {
+            snprintf(message, sizeof(message),
+                    "error, %s at block size %u: %u events, expected %u",
+                    name, block_size, render.count, golden.count);
+            return message;
+        }
+        const Output* g = &golden.events[i];
+        const Output* r = &render.events[i];
+        if(g->frame != r->frame || memcmp(g->msg, r->msg, 3)) {
+            snprintf(message, sizeof(message),
+                    "error, %s at block size %u, event %u: "
+                    "%llu %02x %u %u, expected %llu %02x %u %u",
+                    name, block_size, i,
+                    (unsigned long long) r->frame, r->msg[0], r->msg[1], r->msg[2],
+                    (unsigned long long) g->frame, g->msg[0], g->msg[1], g->msg[2]);
+            return message;
+        }
+    }
+    return 0;
+}
+
+static char* check_scenario(const char* name) {
+    char* result = load_scenario(name);
+    if(result) return result;
+
+    if(update_golden) {
+        if((result = render_scenario(1, &golden))) return result;
+        if((result = save_golden(name))) return result;
+    } else if((result = load_golden(name))) {
+        return result;
+    }
+    for(size_t i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+        if((result = render_scenario(block_sizes[i], &render))) return result;
+        if((result = compare(name, block_sizes[i]))) return result;
+    }
+    return 0;
+}
+
+static char* test_transpose() {
+    return check_scenario("transpose");
+}
+
+static char* test_sorted_updown_long_gate() {
+    return check_scenario("sorted_updown_long_gate");
+}
+
+static char* test_as_played_host_transport() {
+    return check_scenario("as_played_host_transport");
+}
+
+static char* test_chord_three_four() {
+    return check_scenario("chord_three_four");
+}
+
+static char* test_stop_start_locate() {
+    return check_scenario("stop_start_locate");
+}
+
+static char* test_seeded_skip_cycle() {
+    return check_scenario("seeded_skip_cycle");
+}
+
+static char* test_worker_delay() {
+    return check_scenario("worker_delay");
+}
+
+static char* test_program_change() {
+    return check_scenario("program_change");
+}
+
+static char* test_free_running() {
+    return check_scenario("free_running");
+}
+
+static char* test_midi_clock() {
+    return check_scenario("midi_clock");
+}
+
+static char* test_swing_groove() {
+    return check_scenario("swing_groove");
+}
+
+static char* test_velocity_accents() {
+    return check_scenario("velocity_accents");
+}
+
+static char* test_scale_quantize() {
+    return check_scenario("scale_quantize");
+}
+
+static char* test_multi_channel() {
+    return check_scenario("multi_channel");
+}
+
+static char* test_polymeter() {
+    return check_scenario("polymeter");
+}
+
+static char* test_euclid() {
+    return check_scenario("euclid");
+}
+
+static char* test_ratchet_strum() {
+    return check_scenario("ratchet_strum");
+}
+
+static char* test_ratchet_pattern() {
+    return check_scenario("ratchet_pattern");
+}
+
+static char* test_state_channels() {
+    return check_scenario("state_channels");
+}
+
+static char* all_tests() {
+    mu_run_test(test_transpose);
+    mu_run_test(test_sorted_updown_long_gate);
+    mu_run_test(test_as_played_host_transport);
+    mu_run_test(test_chord_three_four);
+    mu_run_test(test_stop_start_locate);
+    mu_run_test(test_seeded_skip_cycle);
+    mu_run_test(test_program_change);
+    mu_run_test(test_worker_delay);
+    mu_run_test(test_free_running);
+    mu_run_test(test_midi_clock);
+    mu_run_test(test_swing_groove);
+    mu_run_test(test_velocity_accents);
+    mu_run_test(test_scale_quantize);
+    mu_run_test(test_multi_channel);
+    mu_run_test(test_polymeter);
+    mu_run_test(test_euclid);
+    mu_run_test(test_ratchet_strum);
+    mu_run_test(test_ratchet_pattern);
+    mu_run_test(test_state_channels);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--update")) update_golden = 1;
+        else plugin_path = argv[i];
+    }
+    char *result = all_tests();
+    if (result != 0) {
+        printf("%s\n", result);
+    }
+    else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+
+    return result != 0;
+}